@@ -0,0 +1,299 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: AlarmTable.h
+ * Description:
+ * Alarm engine with latching alarms, first-out indication, timestamps,
+ * occurrence counters, acknowledgment via registers and an alarm-change
+ * sequence. Alarms are raised lock-free, also from interrupts.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+#include <time.h>
+#include "IODevice.h"
+#include "Variable.h"
+
+/**
+ * @brief Bits of an alarm's state register
+ */
+enum AlarmState : uint16_t {
+    ALARM_ACTIVE    = 1 << 0,   ///< Condition present
+    ALARM_UNACKED   = 1 << 1,   ///< Occurred and not yet acknowledged
+    ALARM_FIRST_OUT = 1 << 2    ///< First alarm of the current episode
+};
+
+
+/**
+ * @brief Per-alarm data; the atomics are written from raising contexts
+ */
+struct Alarm {
+    std::atomic<uint16_t> pendingCount{0};  ///< Occurrences not yet taken over by update()
+    std::atomic<uint32_t> raisedAt{0};      ///< millis() of the first pending occurrence
+    uint32_t time = 0;        ///< RTC time (UTC s) of the last occurrence
+    uint16_t count = 0;       ///< Occurrences since boot (wrapping)
+    uint16_t state = 0;       ///< AlarmState bits
+};
+
+class AlarmEngine;
+
+/**
+ * @class AlarmRegister
+ * @brief One input register of the alarm table.
+ */
+class AlarmRegister : public IODevice {
+private:
+    const AlarmEngine* _engine = nullptr;
+    uint16_t _index = 0;      ///< Alarm * 4 + field
+
+public:
+    AlarmRegister() {
+        setType(ModbusType::InputRegister);
+    }
+
+    void bind(const AlarmEngine* engine, uint16_t index) {
+        _engine = engine;
+        _index = index;
+    }
+
+    uint16_t getInputValue() const override;
+};
+
+
+/**
+ * @class AlarmEngine
+ * @brief Alarm table replacing a plain error bit field.
+ *
+ * @details
+ *   Alarms are identified by their index (at most 16). raise() records a
+ *   transient occurrence, set() a condition that stays active until it is
+ *   cleared; both only use atomic read-modify-write operations and can be
+ *   called from interrupts and other threads. update(), called in the scan,
+ *   takes the occurrences over: an occurring alarm becomes unacknowledged
+ *   (latched) with the RTC time of its first occurrence and its counter
+ *   increased, so transient events are never lost between polls. The
+ *   first alarm latching while no other alarm is unacknowledged is marked
+ *   first-out. Every change advances the alarm-change sequence, so clients
+ *   poll one register and read the table only when it moved.
+ *
+ *   The engine maps to a write-only acknowledge register: writing a
+ *   non-zero mask acknowledges those alarms (0xFFFF all), and the register
+ *   reads back 0, so writing back the just-read unackedMask acknowledges
+ *   exactly those alarms. The summary and the table (four input registers
+ *   per alarm: state, count, time high, time low) follow as items:
+ *
+ *     { &a }, { &a.sequence }, { &a.activeMask }, { &a.unackedMask },
+ *     { &a.firstOut }, { &a.table[0] } ... { &a.table[4 * N - 1] }
+ *
+ *   firstOut is the first-out alarm index + 1, 0 if none. Storage is
+ *   provided by AlarmTable<N>.
+ */
+class AlarmEngine : public IODevice {
+private:
+    Alarm* _alarms;
+    uint8_t _count;
+    std::atomic<uint32_t> _raised{0};       ///< Alarms with pending occurrences
+    std::atomic<uint32_t> _conditions{0};   ///< Alarms whose condition is present
+    uint16_t _sequence = 0;                 ///< Alarm-change sequence
+    int _firstOut = -1;                     ///< First-out alarm, -1 if none
+
+    /**
+     * @brief Mask of alarms with all bits of a state set
+     */
+    uint16_t mask(uint16_t bits) const {
+        uint16_t m = 0;
+        for (uint8_t i = 0; i < _count; ++i) {
+            if ((_alarms[i].state & bits) == bits) m |= 1u << i;
+        }
+        return m;
+    }
+
+    /**
+     * @brief Take over the pending occurrences of an alarm
+     * @return false if they were already taken over with an earlier flag
+     */
+    bool latch(uint8_t id, uint32_t nowMs, uint32_t nowUtc) {
+        Alarm& a = _alarms[id];
+        uint16_t n = a.pendingCount.exchange(0);
+        if (!n) return false;
+        uint32_t at = a.raisedAt.load();
+        a.count += n;
+        a.time = nowUtc - (nowMs - at) / 1000UL;
+        if (!mask(ALARM_UNACKED) && _firstOut < 0) {
+            _firstOut = id;
+            a.state |= ALARM_FIRST_OUT;
+        }
+        a.state |= ALARM_UNACKED;
+        return true;
+    }
+
+protected:
+    AlarmEngine(Alarm* alarms, uint8_t count)
+        : _alarms(alarms), _count(count) {
+        setType(ModbusType::HoldingRegister);
+    }
+
+public:
+    InputVariable<uint16_t> sequence   { [this]() { return _sequence; } };
+    InputVariable<uint16_t> activeMask { [this]() { return mask(ALARM_ACTIVE); } };
+    InputVariable<uint16_t> unackedMask{ [this]() { return mask(ALARM_UNACKED); } };
+    InputVariable<uint16_t> firstOut   { [this]() { return _firstOut + 1; } };
+
+    AlarmEngine(const AlarmEngine&) = delete;             // members capture this
+    AlarmEngine& operator=(const AlarmEngine&) = delete;
+
+    /**
+     * @brief Record a transient occurrence (ISR-safe)
+     */
+    void raise(uint8_t id) {
+        if (id >= _count) return;
+        Alarm& a = _alarms[id];
+        if (a.pendingCount.fetch_add(1) == 0) a.raisedAt.store(millis());
+        _raised.fetch_or(1UL << id);
+    }
+
+    /**
+     * @brief Set or clear a condition; setting counts as an occurrence (ISR-safe)
+     */
+    void set(uint8_t id, bool active) {
+        if (id >= _count) return;
+        if (!active) {
+            _conditions.fetch_and(~(1UL << id));
+        } else if (!(_conditions.fetch_or(1UL << id) & (1UL << id))) {
+            raise(id);
+        }
+    }
+
+    /**
+     * @brief Acknowledge alarms; inactive ones return to normal
+     */
+    void acknowledge(uint16_t which) {
+        bool changed = false;
+        for (uint8_t i = 0; i < _count; ++i) {
+            Alarm& a = _alarms[i];
+            if (!(which & (1u << i)) || !(a.state & ALARM_UNACKED)) continue;
+            a.state &= ~(ALARM_UNACKED | ALARM_FIRST_OUT);
+            if (_firstOut == i) _firstOut = -1;
+            changed = true;
+        }
+        if (changed) ++_sequence;
+    }
+
+    /**
+     * @brief Take over occurrences and conditions raised since the last call
+     */
+    void update() override {
+        uint32_t raised = _raised.exchange(0);
+        uint32_t conditions = _conditions.load();
+        uint32_t nowMs = millis();
+        uint32_t nowUtc = static_cast<uint32_t>(time(nullptr));
+        bool changed = false;
+
+        for (uint8_t i = 0; i < _count; ++i) {
+            Alarm& a = _alarms[i];
+            if ((raised & (1UL << i)) && latch(i, nowMs, nowUtc)) {
+                changed = true;
+
+                #ifdef IDEBUG
+                Serial.print("Alarm ");
+                Serial.print(i);
+                Serial.print(" count ");
+                Serial.println(a.count);
+                #endif
+            }
+            bool active = conditions & (1UL << i);
+            if (active != static_cast<bool>(a.state & ALARM_ACTIVE)) {
+                a.state ^= ALARM_ACTIVE;
+                changed = true;
+            }
+        }
+        if (changed) ++_sequence;
+    }
+
+    /**
+     * @brief Compatibility bit field: bit i set while alarm i is active or unacknowledged
+     */
+    uint16_t errorCode() const { return mask(ALARM_ACTIVE) | mask(ALARM_UNACKED); }
+
+    /**
+     * @brief Mask of alarms with the given AlarmState bits
+     */
+    uint16_t withState(uint16_t bits) const { return mask(bits); }
+
+    /**
+     * @brief Alarm data for diagnostics
+     */
+    const Alarm& alarm(uint8_t id) const { return _alarms[id]; }
+
+    uint8_t size() const { return _count; }
+
+    /**
+     * @brief Value of table register i (alarm i / 4, field i % 4)
+     */
+    uint16_t tableValue(uint16_t i) const {
+        const Alarm& a = _alarms[i / 4];
+        switch (i % 4) {
+            case 0:  return a.state;
+            case 1:  return a.count;
+            case 2:  return static_cast<uint16_t>(a.time >> 16);
+            default: return static_cast<uint16_t>(a.time);
+        }
+    }
+
+    // Acknowledge register; reads 0 so every non-zero write is seen as a change
+    uint16_t getHoldingValue() const override { return 0; }
+    void setFromHolding(uint16_t value) override { acknowledge(value); }
+};
+
+inline uint16_t AlarmRegister::getInputValue() const {
+    return _engine ? _engine->tableValue(_index) : INVALID_VALUE;
+}
+
+
+/**
+ * @brief AlarmEngine with storage for N alarms
+ *
+ * @code
+ * enum : uint8_t { ALARM_OVERTEMP, ALARM_PRESSURE };
+ * AlarmTable<2> alarms;
+ * void onPressureSwitch() { alarms.raise(ALARM_PRESSURE); }   // ISR
+ * @endcode
+ */
+template<uint8_t N>
+class AlarmTable : public AlarmEngine {
+    static_assert(N > 0 && N <= 16, "the acknowledge register holds 16 alarms");
+
+private:
+    Alarm _storage[N];
+
+public:
+    AlarmRegister table[4 * N];
+
+    AlarmTable() : AlarmEngine(_storage, N) {
+        for (uint16_t i = 0; i < 4 * N; ++i) table[i].bind(this, i);
+    }
+};
@@ -0,0 +1,197 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: AnalogStatistics.h
+ * Description:
+ * Rolling-window statistics (min, max, mean, standard deviation) of an
+ * AnalogInput, updated in O(1) per sample and exposed as input registers.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <Arduino.h>
+#include <math.h>
+#include "IODevice.h"
+#include "Variable.h"
+
+/**
+ * @class AnalogStatistics
+ * @brief Statistics over the last samples of an analog value.
+ *
+ * @details
+ *   Samples are taken every interval ms (holding register) into a ring
+ *   buffer of capacity samples, so the window is capacity * interval.
+ *   Integer running sums give mean and standard deviation without drift;
+ *   minimum and maximum come from monotonic queues (ring buffers of sample
+ *   slots), so every sample costs O(1) amortized. Changing the interval
+ *   restarts the window. Registers, listed as items:
+ *
+ *     { &s.minimum }, { &s.maximum }, { &s.mean }, { &s.stddev },
+ *     { &s.count }, { &s.interval }
+ *
+ *   All values are in the units of the input; count is the number of
+ *   samples in the window (capacity once the window is full).
+ *   Storage is provided by WindowStatistics<N>.
+ */
+class AnalogStatistics {
+private:
+    uint16_t* _values;            ///< Sample ring
+    uint16_t* _minQueue;          ///< Slots with increasing values (front = minimum)
+    uint16_t* _maxQueue;          ///< Slots with decreasing values (front = maximum)
+    uint16_t _capacity;           ///< Samples per window
+    uint16_t _count = 0;          ///< Samples in the window
+    uint16_t _pos = 0;            ///< Slot of the next sample
+    uint16_t _minHead = 0, _minSize = 0;
+    uint16_t _maxHead = 0, _maxSize = 0;
+    uint32_t _sum = 0;            ///< Sum of the samples in the window
+    uint64_t _sumSquares = 0;     ///< Sum of the squared samples
+    uint16_t _interval;           ///< Sample interval (ms)
+    unsigned long _lastSample = 0;
+    AnalogStatistics* _next = nullptr;  ///< Next statistics of the same input
+
+    uint16_t& at(uint16_t* queue, uint16_t head, uint16_t i) {
+        return queue[(head + i) % _capacity];
+    }
+
+    uint16_t minSlot() const { return _minQueue[_minHead]; }
+    uint16_t maxSlot() const { return _maxQueue[_maxHead]; }
+
+    void push(uint16_t value) {
+        // The sample leaving the window is in the slot being overwritten
+        if (_count == _capacity) {
+            uint16_t old = _values[_pos];
+            _sum -= old;
+            _sumSquares -= static_cast<uint32_t>(old) * old;
+            if (_minSize && minSlot() == _pos) { _minHead = (_minHead + 1) % _capacity; --_minSize; }
+            if (_maxSize && maxSlot() == _pos) { _maxHead = (_maxHead + 1) % _capacity; --_maxSize; }
+        } else {
+            ++_count;
+        }
+
+        _values[_pos] = value;
+        _sum += value;
+        _sumSquares += static_cast<uint32_t>(value) * value;
+
+        while (_minSize && _values[at(_minQueue, _minHead, _minSize - 1)] >= value) --_minSize;
+        at(_minQueue, _minHead, _minSize++) = _pos;
+        while (_maxSize && _values[at(_maxQueue, _maxHead, _maxSize - 1)] <= value) --_maxSize;
+        at(_maxQueue, _maxHead, _maxSize++) = _pos;
+
+        _pos = (_pos + 1) % _capacity;
+    }
+
+    uint16_t meanValue() const {
+        return _count ? (_sum + _count / 2) / _count : INVALID_VALUE;
+    }
+
+    uint16_t stddevValue() const {
+        if (!_count) return INVALID_VALUE;
+        // n² * variance = n * sum(x²) - sum(x)², exact in 64 bits
+        uint64_t n = _count;
+        uint64_t scaled = n * _sumSquares - static_cast<uint64_t>(_sum) * _sum;
+        return static_cast<uint16_t>(sqrtf(static_cast<float>(scaled)) / n + 0.5f);
+    }
+
+protected:
+    AnalogStatistics(uint16_t* values, uint16_t* minQueue, uint16_t* maxQueue,
+                     uint16_t capacity, uint16_t intervalMs)
+        : _values(values), _minQueue(minQueue), _maxQueue(maxQueue),
+          _capacity(capacity), _interval(intervalMs ? intervalMs : 1) {}
+
+public:
+    InputVariable<uint16_t> minimum { [this]() { return _count ? _values[minSlot()] : INVALID_VALUE; } };
+    InputVariable<uint16_t> maximum { [this]() { return _count ? _values[maxSlot()] : INVALID_VALUE; } };
+    InputVariable<uint16_t> mean    { [this]() { return meanValue(); } };
+    InputVariable<uint16_t> stddev  { [this]() { return stddevValue(); } };
+    InputVariable<uint16_t> count   { [this]() { return _count; } };
+    Variable<uint16_t>      interval { [this]() { return _interval; },
+                                       [this](uint16_t v) { setInterval(v); } };
+
+    AnalogStatistics(const AnalogStatistics&) = delete;             // members capture this
+    AnalogStatistics& operator=(const AnalogStatistics&) = delete;
+
+    /**
+     * @brief Offer the current value; a sample is taken once per interval
+     */
+    void sample(uint16_t value) {
+        unsigned long now = millis();
+        if (_count && now - _lastSample < _interval) return;
+        _lastSample = now;
+        push(value);
+    }
+
+    /**
+     * @brief Drop all samples
+     */
+    void reset() {
+        _count = _pos = 0;
+        _minHead = _minSize = _maxHead = _maxSize = 0;
+        _sum = 0;
+        _sumSquares = 0;
+    }
+
+    /**
+     * @brief Change the sample interval and restart the window
+     */
+    void setInterval(uint16_t intervalMs) {
+        _interval = intervalMs ? intervalMs : 1;
+        reset();
+    }
+
+    /**
+     * @brief Window length in ms
+     */
+    uint32_t window() const { return static_cast<uint32_t>(_capacity) * _interval; }
+
+    AnalogStatistics* next() const { return _next; }
+    void setNext(AnalogStatistics* next) { _next = next; }
+};
+
+
+/**
+ * @brief AnalogStatistics with storage for N samples (6 bytes per sample)
+ *
+ * @code
+ * WindowStatistics<600> flowMinute(100);    // 600 samples every 100 ms = 1 min
+ * flowSensor.attach(flowMinute);
+ * @endcode
+ */
+template<uint16_t N>
+class WindowStatistics : public AnalogStatistics {
+    static_assert(N > 0, "window needs at least one sample");
+
+private:
+    uint16_t _valueStorage[N];
+    uint16_t _minStorage[N];
+    uint16_t _maxStorage[N];
+
+public:
+    /**
+     * @brief Construct with the sample interval
+     * @param intervalMs Sample interval in ms; the window is N * intervalMs
+     */
+    explicit WindowStatistics(uint16_t intervalMs)
+        : AnalogStatistics(_valueStorage, _minStorage, _maxStorage, N, intervalMs) {}
+};
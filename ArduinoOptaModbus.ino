@@ -57,6 +57,21 @@
 #include "Input.h"
 #include "Variable.h"
 #include "Heartbeat.h"
+#include "AlarmTable.h"
+#ifdef MODBUS_PEER_PORT
+#include "PeerLink.h"
+#endif
+#ifdef MODBUS_DEVICE_CONFIG
+#include "DeviceConfig.h"
+#endif
+#ifdef MODBUS_FIRMWARE_UPDATE
+#include "FirmwareUpdate.h"
+#include "MBRBlockDevice.h"
+#include "FATFileSystem.h"
+#ifndef MODBUS_FIRMWARE_PARTITION
+#error "config.h lacks MODBUS_FIRMWARE_PARTITION (flash partition mounted as /fs, see config.example.h)"
+#endif
+#endif
 #include "ModbusItem.h"
 #include "ModbusHandler.h"
 
@@ -77,44 +92,27 @@ unsigned long lastUpdate = 0;
  */
 unsigned long updateInterval = 100;
 
-/**
- * @brief Global error code published via Modbus.
- *        Individual bits are defined below via ERR_* flags.
- */
-uint16_t errorCode = 0;
-
-/**
- * @brief Heartbeat state tracking.
- *
- * @details
- *  - `isAlive` reflects the current heartbeat value received from the watchdog.
- *  - `wasAlive` stores the previous cycle's value to detect rising/falling edges.
- *
- *  These flags are used to set or clear ERR_HEARTBEAT when the watchdog signal
- *  switches from alive → dead or dead → alive.
- */
-bool wasAlive = true;
-bool isAlive  = true;
-
 
 // -----------------------------------------------------------------------------
-// Error flags
+// Alarms
 // -----------------------------------------------------------------------------
 
-/// @brief Watchdog/heartbeat signal lost.
-constexpr uint16_t ERR_HEARTBEAT = 1 << 4;
-
-/// @brief Expansion module not detected or faulty.
-constexpr uint16_t ERR_EXPANSION = 1 << 3;
-
-/// @brief Modbus initialization or communication error.
-constexpr uint16_t ERR_MODBUS    = 1 << 2;
-
-/// @brief General-purpose system error.
-constexpr uint16_t ERR_GENERAL   = 1 << 1;
+/**
+ * @brief Alarm ids; bit i of the former errorCode register is alarm i.
+ */
+enum AlarmId : uint8_t {
+    ALARM_SENSOR    = 0,   ///< Sensor-related error
+    ALARM_GENERAL   = 1,   ///< General-purpose system error
+    ALARM_MODBUS    = 2,   ///< Modbus initialization or communication error
+    ALARM_EXPANSION = 3,   ///< Expansion module not detected or faulty
+    ALARM_HEARTBEAT = 4,   ///< Watchdog/heartbeat signal lost
+    ALARM_COUNT
+};
 
-/// @brief Sensor-related error.
-constexpr uint16_t ERR_SENSOR    = 1 << 0;
+/**
+ * @brief Latching alarm table published via Modbus (see AlarmTable.h).
+ */
+AlarmTable<ALARM_COUNT> alarms;
 
 
 // -----------------------------------------------------------------------------
@@ -155,14 +153,75 @@ Variable<unsigned long> updateFreq(
     [](unsigned long val){ updateInterval = val; } // setter: allows remote change
 );
 
-// Error code variable (read-only via Modbus)
+// Error code variable (read-only via Modbus): alarms active or unacknowledged
 Variable<uint16_t> errorCodeVar(
-    [](){ return errorCode; }                 // getter: exposes errorCode
+    [](){ return alarms.errorCode(); }        // getter: exposes the alarm bits
     // read-only → setter intentionally omitted
 );
 
-// Heartbeat object: writes to isAlive via provided setter
-Heartbeat hb([](bool val){ isAlive = val; });
+// Heartbeat object: reports a lost heartbeat as alarm condition
+Heartbeat hb([](bool val){ alarms.set(ALARM_HEARTBEAT, !val); });
+
+#ifdef MODBUS_PEER_PORT
+// Door sensor state of the neighbouring cabinet (node 2, topic 1), read-only
+SharedVariable remoteDoorSensor(2, 1);
+
+// Values published to the other controllers (topic, device, optional deadband)
+const PeerPublication peerPublications[] = {
+    { 1, &doorSensor }
+};
+
+SharedVariable* const peerSubscriptions[] = { &remoteDoorSensor };
+
+PeerLink peerLink(peerPublications, sizeof(peerPublications) / sizeof(PeerPublication),
+                  peerSubscriptions, sizeof(peerSubscriptions) / sizeof(SharedVariable*));
+#endif
+
+
+#ifdef MODBUS_FIRMWARE_UPDATE
+/**
+ * @brief Flash partition holding MODBUS_FIRMWARE_FILE, mounted as /fs in setup().
+ */
+mbed::MBRBlockDevice firmwarePartition(mbed::BlockDevice::get_default_instance(), MODBUS_FIRMWARE_PARTITION);
+mbed::FATFileSystem firmwareFs("fs");
+
+FileFirmwareStore firmwareStore(MODBUS_FIRMWARE_FILE);
+void activateFirmware();
+
+/**
+ * @brief Firmware image received with PUT /firmware, written in idle time.
+ *
+ * The reboot command installs a verified image through activateFirmware().
+ */
+FirmwareUpdate firmware(firmwareStore, activateFirmware);
+
+/**
+ * @brief Make the bootloader install the staged image at the next reset
+ *
+ * Sets the update flag in the RTC backup registers like Arduino_Portenta_OTA:
+ * magic, storage type (FAT on an MBR partition of the QSPI flash), partition
+ * and image length. The bootloader then installs UPDATE.BIN from the root
+ * of that partition, so MODBUS_FIRMWARE_FILE must be "/fs/UPDATE.BIN".
+ */
+void activateFirmware() {
+    static constexpr uint32_t OTA_MAGIC = 0x07AA;
+    static constexpr uint32_t QSPI_FLASH_FATFS_MBR = 2 << 2;
+
+    firmwareFs.unmount();
+
+    RTC_HandleTypeDef rtc = {};
+    rtc.Instance = RTC;
+    HAL_PWR_EnableBkUpAccess();
+    HAL_RTCEx_BKUPWrite(&rtc, RTC_BKP_DR0, OTA_MAGIC);
+    HAL_RTCEx_BKUPWrite(&rtc, RTC_BKP_DR1, QSPI_FLASH_FATFS_MBR);
+    HAL_RTCEx_BKUPWrite(&rtc, RTC_BKP_DR2, MODBUS_FIRMWARE_PARTITION);
+    HAL_RTCEx_BKUPWrite(&rtc, RTC_BKP_DR3, firmware.stats().imageBytes);
+
+    #ifdef IDEBUG
+    Serial.println("Firmware activated, rebooting into the bootloader");
+    #endif
+}
+#endif
 
 
 // -----------------------------------------------------------------------------
@@ -172,10 +231,14 @@ Heartbeat hb([](bool val){ isAlive = val; });
 /**
  * @brief List of all IODevice instances exposed via Modbus mapping.
  *
- * Note: ModbusItem constructor assigns sequential base addresses during setup(),
+ * Note: ModbusHandler assigns sequential base addresses during setup(),
  * so the array order determines the mapped (internal) register index 0..N-1.
+ * With MODBUS_DENSE_ADDRESSING each table is packed instead (see the address
+ * map printed at startup in debug builds).
  * Offsets for external addressing (e.g. 40000 for holdings) are added in ModbusItem.
  */
+static_assert(ALARM_COUNT == 5, "modbusList maps alarms.table[0..19]: add four entries per alarm id");
+
 ModbusItem modbusList[] = {
     { &wateringValve1 },    // internal index 0  -> external coil offset + 0
     { &wateringValve2 },    // internal index 1
@@ -186,8 +249,44 @@ ModbusItem modbusList[] = {
     { &doorSensor },        // internal index 6  -> discrete input region
     { &updateFreq },        // internal index 7  -> holding region
     { &errorCodeVar },      // internal index 8  -> holding region          
-    { &hb }                 // internal index 9  -> holding region (heartbeat)
+    { &hb },                // internal index 9  -> holding region (heartbeat)
+#ifdef MODBUS_PEER_PORT
+    { &remoteDoorSensor },  // internal index 10 -> holding region (peer value)
+#endif
+    { &alarms },            // holding region: write a mask to acknowledge (reads 0)
+    { &alarms.sequence },   // input region: alarm-change sequence
+    { &alarms.activeMask },
+    { &alarms.unackedMask }, // unacknowledged alarms
+    { &alarms.firstOut },
+    // Alarm table: state, count, time high, time low per alarm
+    { &alarms.table[0] },  { &alarms.table[1] },  { &alarms.table[2] },  { &alarms.table[3] },
+    { &alarms.table[4] },  { &alarms.table[5] },  { &alarms.table[6] },  { &alarms.table[7] },
+    { &alarms.table[8] },  { &alarms.table[9] },  { &alarms.table[10] }, { &alarms.table[11] },
+    { &alarms.table[12] }, { &alarms.table[13] }, { &alarms.table[14] }, { &alarms.table[15] },
+    { &alarms.table[16] }, { &alarms.table[17] }, { &alarms.table[18] }, { &alarms.table[19] },
+#ifdef MODBUS_FIRMWARE_UPDATE
+    { &firmware },          // holding region: update state / reboot command
+#endif
+};
+
+
+#ifdef MODBUS_MULTICAST_PORT
+/**
+ * @brief Multicast command groups: id 1 sheds the heat pump and legionella load.
+ */
+const CommandGroup commandGroups[] = {
+    { 1, &heatPump },
+    { 1, &legionella }
 };
+#endif
+
+
+#ifdef MODBUS_DEVICE_CONFIG
+/**
+ * @brief Devices from the stored configuration, appended to modbusList.
+ */
+DeviceConfig deviceConfig(localBackend, expBackend);
+#endif
 
 
 // --- ModbusHandler ---
@@ -228,7 +327,7 @@ void setup() {
         #ifdef IDEBUG
         Serial.println("No valid Digital Expansion found.");
         #endif
-        errorCode |= ERR_EXPANSION;
+        alarms.set(ALARM_EXPANSION, true);
         expBackend = new NullPinBackend();
     }
 
@@ -236,9 +335,49 @@ void setup() {
     Serial.println("Starting Ethernet + ModbusHandler...");
     #endif
 
+    #ifdef MODBUS_DEVICE_CONFIG
+    if (deviceConfig.loadStored(modbusList, sizeof(modbusList) / sizeof(ModbusItem))) {
+        modbusHandler.setItems(deviceConfig.items(), deviceConfig.count());
+        #ifdef IDEBUG
+        Serial.print("Device configuration: ");
+        Serial.print(deviceConfig.stats().devices);
+        Serial.print(" devices in ");
+        Serial.print(deviceConfig.stats().constructionUs);
+        Serial.print(" us, arena ");
+        Serial.print(deviceConfig.stats().arenaUsed);
+        Serial.print("/");
+        Serial.println(deviceConfig.stats().arenaSize);
+        #endif
+    }
+    #endif
+
+    #ifdef MODBUS_FIRMWARE_UPDATE
+    if (firmwareFs.mount(&firmwarePartition) != 0) {
+        #ifdef IDEBUG
+        Serial.println("Firmware partition not mounted, PUT /firmware will fail");
+        #endif
+    }
+    #endif
+
+    #if defined(MODBUS_HTTP_PORT) && (defined(MODBUS_DEVICE_CONFIG) || defined(MODBUS_FIRMWARE_UPDATE))
+    modbusHandler.setUploadHandler([](const char* path, size_t offset, const uint8_t* data, size_t len, bool last, bool aborted) {
+        #ifdef MODBUS_FIRMWARE_UPDATE
+        if (strcmp(path, "/firmware") == 0) return firmware.upload(path, offset, data, len, last, aborted);
+        #endif
+        #ifdef MODBUS_DEVICE_CONFIG
+        return deviceConfig.upload(path, offset, data, len, last, aborted);
+        #else
+        return 404;
+        #endif
+    });
+    #endif
+    #if defined(MODBUS_HTTP_PORT) && defined(MODBUS_FIRMWARE_UPDATE)
+    modbusHandler.setUploadReady([](const char* path) { return firmware.ready(path); });
+    #endif
+
     // Handler initialisieren: Ethernet + ModbusTCP-Server
     if (!modbusHandler.begin()) {
-        errorCode |= ERR_MODBUS;
+        alarms.set(ALARM_MODBUS, true);
         #ifdef IDEBUG
         Serial.println("ModbusHandler init failed!");
         #endif
@@ -249,11 +388,53 @@ void setup() {
     // Alle Items einrichten
     modbusHandler.setupItems();
 
+    #ifdef MODBUS_MULTICAST_PORT
+    modbusHandler.setCommandGroups(commandGroups, sizeof(commandGroups) / sizeof(CommandGroup));
+    #endif
+
+    #ifdef MODBUS_HTTP_PORT
+    // Application part of GET /metrics
+    modbusHandler.setMetricsHook([](MetricsWriter& out) {
+        static const char* const labels[ALARM_COUNT] = {
+            "alarm=\"sensor\"", "alarm=\"general\"", "alarm=\"modbus\"",
+            "alarm=\"expansion\"", "alarm=\"heartbeat\"",
+        };
+        out.metric("opta_error_code", "gauge", "Error bit field", alarms.errorCode());
+        out.family("opta_alarm_active", "gauge", "Alarm condition present");
+        for (uint8_t i = 0; i < ALARM_COUNT; ++i) out.sample("opta_alarm_active", labels[i], (alarms.withState(ALARM_ACTIVE) >> i) & 1);
+        out.family("opta_alarm_unacknowledged", "gauge", "Alarm occurred and not acknowledged");
+        for (uint8_t i = 0; i < ALARM_COUNT; ++i) out.sample("opta_alarm_unacknowledged", labels[i], (alarms.withState(ALARM_UNACKED) >> i) & 1);
+        out.family("opta_alarm_occurrences_total", "counter", "Alarm occurrences");
+        for (uint8_t i = 0; i < ALARM_COUNT; ++i) out.sample("opta_alarm_occurrences_total", labels[i], alarms.alarm(i).count);
+        out.metric("opta_expansion_transactions_total", "counter", "Expansion bus transactions",
+                   expBackend ? expBackend->transactions() : 0);
+        #ifdef MODBUS_DEVICE_CONFIG
+        out.metric("opta_config_devices", "gauge", "Devices built from the device configuration", deviceConfig.stats().devices);
+        out.metric("opta_config_arena_bytes", "gauge", "Device arena bytes in use", deviceConfig.stats().arenaUsed);
+        out.metric("opta_config_construction_microseconds", "gauge", "Device construction time at boot", deviceConfig.stats().constructionUs);
+        #endif
+        #ifdef MODBUS_FIRMWARE_UPDATE
+        const FirmwareStats& fw = firmware.stats();
+        out.metric("opta_firmware_state", "gauge", "Firmware update state", static_cast<uint16_t>(firmware.state()));
+        out.metric("opta_firmware_activation", "gauge", "Reboot command accepted (activation hook set)", firmware.canActivate() ? 1 : 0);
+        out.metric("opta_firmware_progress_percent", "gauge", "Firmware write and verify progress", firmware.progress());
+        out.metric("opta_firmware_bytes_per_second", "gauge", "Throughput of the last verified transfer", fw.bytesPerSecond);
+        out.metric("opta_firmware_step_max_microseconds", "gauge", "Longest firmware storage operation", fw.stepUsMax);
+        out.metric("opta_firmware_service_max_microseconds", "gauge", "Longest firmware slice in loop()", fw.serviceUsMax);
+        #endif
+    });
+    #endif
+
     #ifdef IDEBUG
     Serial.println("ok. Modbus TCP ready");
+    modbusHandler.printAddressMap(Serial);
     #endif
 
 
+    #ifdef MODBUS_PEER_PORT
+    peerLink.begin();
+    #endif
+
     hb.attachHandler(&modbusHandler);
     #ifdef IDEBUG
     Serial.println("Heartbeat attached");
@@ -268,9 +449,9 @@ void loop() {
 
     OptaController.update();
  
-    if (digitalRead(OPTA_CONTROLLER_DETECT_PIN) == LOW) {
-        errorCode |= ERR_EXPANSION;
-    }
+    // Active while the expansion is missing (detect pin low, or none found at
+    // boot); every dropout latches again until acknowledged
+    alarms.set(ALARM_EXPANSION, !expBackend->present());
 
     unsigned long now = millis();
     if (now - lastUpdate >= updateInterval) {
@@ -282,13 +463,23 @@ void loop() {
         modbusHandler.update();
     }
 
-    OptaController.checkForExpansions();
+    #ifdef MODBUS_FIRMWARE_UPDATE
+    // Idle time only: never start a slice shortly before the next cycle. An
+    // update interval within the guard (updateFreq is client-writable) leaves
+    // no such time; at least one slice then follows every cycle, so writing,
+    // verifying and a commanded reboot still progress.
+    static unsigned long slicedCycle = 0;   // lastUpdate of the cycle the last slice followed
+    if (millis() - lastUpdate + MODBUS_FIRMWARE_GUARD_MS < updateInterval || slicedCycle != lastUpdate) {
+        slicedCycle = lastUpdate;
+        firmware.service();
+    }
+    #endif
 
-    // Update heartbeat error bit on edges of the watchdog state
-    if (wasAlive && !isAlive) errorCode |=  ERR_HEARTBEAT;  // rising error: heartbeat lost
-    if (!wasAlive && isAlive) errorCode &= ~ERR_HEARTBEAT;  // recovered: clear heartbeat error
+    #ifdef MODBUS_PEER_PORT
+    // Every iteration: peer values must not wait for the update interval
+    peerLink.update();
+    #endif
 
-    // Save previous heartbeat for edge detection next cycle
-    wasAlive = isAlive;
+    OptaController.checkForExpansions();
 
 }
\ No newline at end of file
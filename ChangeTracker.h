@@ -0,0 +1,58 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: ChangeTracker.h
+ * Description:
+ * Global change sequence for Modbus items.
+ * Lets clients poll only the values that changed since a known sequence.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cstdint>
+
+/**
+ * @brief Global change sequence shared by all ModbusItems of a handler.
+ *
+ * Every time a ModbusItem detects a new value (in either direction) it draws
+ * the next sequence number and remembers it. Clients compare these numbers
+ * against the last sequence they have seen to find out what changed.
+ */
+class ChangeTracker {
+private:
+    uint32_t _sequence = 0;   /**< Sequence number of the most recent change */
+
+public:
+    /**
+     * @brief Advance the sequence for a new change
+     * @return The sequence number assigned to the change
+     */
+    uint32_t next() { return ++_sequence; }
+
+    /**
+     * @brief Sequence number of the most recent change
+     */
+    uint32_t sequence() const { return _sequence; }
+};
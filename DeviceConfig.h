@@ -0,0 +1,354 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: DeviceConfig.h
+ * Description:
+ * Builds devices and ModbusItems at boot from a binary device description
+ * (stored in flash or uploaded over HTTP) inside a fixed arena.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <new>
+#include <utility>
+#include <kvstore_global_api.h>
+#include "config.h"
+#include "IODevice.h"
+#include "PinBackend.h"
+#include "Relay.h"
+#include "Input.h"
+#include "ModbusItem.h"
+
+/**
+ * @brief Device types of a configuration record
+ */
+enum class DeviceKind : uint8_t {
+    StableRelay   = 1,
+    SafeRelay     = 2,
+    DiscreteInput = 3,
+    AnalogInput   = 4,
+    Register      = 5   ///< Plain holding register (StoredRegister)
+};
+
+
+/**
+ * @class StoredRegister
+ * @brief Holding register keeping the last written value (setpoints, parameters).
+ */
+class StoredRegister : public IODevice {
+private:
+    uint16_t _value;   ///< Current value
+
+public:
+    explicit StoredRegister(uint16_t initial = 0) : _value(initial) {
+        setType(ModbusType::HoldingRegister);
+    }
+
+    uint16_t getHoldingValue() const override { return _value; }
+    void setFromHolding(uint16_t value) override { _value = value; }
+};
+
+
+/**
+ * @class DeviceArena
+ * @brief Bump allocator over a static buffer; objects are never freed individually.
+ */
+class DeviceArena {
+private:
+    alignas(8) uint8_t _storage[MODBUS_CONFIG_ARENA];  ///< Object storage
+    size_t _used = 0;                                   ///< Bytes allocated
+
+public:
+    /**
+     * @brief Reserve aligned memory, or nullptr if the arena is full
+     */
+    void* allocate(size_t size, size_t align) {
+        size_t start = (_used + align - 1) & ~(align - 1);
+        if (start + size > sizeof(_storage)) return nullptr;
+        _used = start + size;
+        return &_storage[start];
+    }
+
+    /**
+     * @brief Construct an object in the arena, or nullptr if the arena is full
+     */
+    template<typename T, typename... Args>
+    T* create(Args&&... args) {
+        void* p = allocate(sizeof(T), alignof(T));
+        return p ? new (p) T(std::forward<Args>(args)...) : nullptr;
+    }
+
+    void reset() { _used = 0; }
+    size_t used() const { return _used; }
+    size_t capacity() const { return sizeof(_storage); }
+};
+
+
+/**
+ * @brief Result of the last load
+ */
+struct DeviceConfigStats {
+    uint32_t constructionUs = 0;  ///< Time to construct devices and items
+    size_t   arenaUsed = 0;       ///< Arena bytes in use
+    size_t   arenaSize = 0;       ///< Arena capacity
+    uint16_t devices = 0;         ///< Devices constructed from the configuration
+};
+
+
+/**
+ * @class DeviceConfig
+ * @brief Constructs devices and their ModbusItems from a device description.
+ *
+ * @details
+ *   Binary layout (big-endian, CRC-16/Modbus over all preceding bytes, low
+ *   byte first):
+ *
+ *     0 'O' 'D' | 2 version (1) | 3 reserved | 4 count (u16) |
+ *     6 count * { type, backend (0 local, 1 expansion), pin, led pin,
+ *                 enter safe action, leave safe action, poll group,
+ *                 reserved, value (u16, initial value of a Register) } |
+ *     crc (u16)
+ *
+ *   The items of an optional fixed list (e.g. heartbeat and variables of the
+ *   sketch) come first, followed by one item per record. Devices and the
+ *   item array are placement-constructed in a static arena of
+ *   MODBUS_CONFIG_ARENA bytes; nothing is allocated on the heap. A
+ *   configuration is loaded once at boot, before ModbusHandler::begin();
+ *   an uploaded one is validated, stored and applied at the next boot.
+ *   tools/device_config.py converts between JSON and this format.
+ */
+class DeviceConfig {
+private:
+    static constexpr size_t HEADER_SIZE = 6;
+    static constexpr size_t RECORD_SIZE = 10;
+    static constexpr const char* KV_KEY = "/kv/devcfg";
+    static constexpr uint8_t EXPANSION_OUTPUTS = 8;    ///< Relay channels of a digital expansion
+    static constexpr uint8_t EXPANSION_INPUTS = 16;    ///< Input channels of a digital expansion
+
+    PinBackend*&      _local;                            ///< Backend for backend 0
+    PinBackend*&      _expansion;                        ///< Backend for backend 1
+    DeviceArena       _arena;                            ///< Device and item storage
+    ModbusItem*       _items = nullptr;                  ///< Constructed item list
+    size_t            _numItems = 0;                     ///< Items in _items
+    size_t            _numFixed = 0;                     ///< Fixed items placed first
+    uint8_t           _staging[MODBUS_CONFIG_MAX_SIZE];  ///< Stored or uploaded description
+    size_t            _stagingLen = 0;                   ///< Bytes in _staging
+    DeviceConfigStats _stats;                            ///< Result of the last load
+
+    static size_t align(size_t n, size_t a) { return (n + a - 1) & ~(a - 1); }
+
+    /**
+     * @brief Whether a pin exists on a backend (0 local, 1 expansion)
+     */
+    static bool validPin(uint8_t backend, uint8_t pin, bool output) {
+        if (backend == 0) return pin < PINS_COUNT;
+        return pin < (output ? EXPANSION_OUTPUTS : EXPANSION_INPUTS);
+    }
+
+    /**
+     * @brief Pin and LED fields of a record fit its backend
+     */
+    static bool validPins(const uint8_t* rec) {
+        switch (static_cast<DeviceKind>(rec[0])) {
+            case DeviceKind::StableRelay:
+            case DeviceKind::SafeRelay:     return validPin(rec[1], rec[2], true) && (!rec[3] || validPin(rec[1], rec[3], true));
+            case DeviceKind::DiscreteInput: return validPin(rec[1], rec[2], false);
+            case DeviceKind::AnalogInput:   return rec[1] == 0 && validPin(0, rec[2], false);   // no analog expansion inputs
+            default:                        return true;
+        }
+    }
+
+    static size_t footprint(DeviceKind kind) {
+        switch (kind) {
+            case DeviceKind::StableRelay:   return align(sizeof(StableRelay), 8);
+            case DeviceKind::SafeRelay:     return align(sizeof(SafeRelay), 8);
+            case DeviceKind::DiscreteInput: return align(sizeof(DiscreteInput), 8);
+            case DeviceKind::AnalogInput:   return align(sizeof(AnalogInput), 8);
+            case DeviceKind::Register:      return align(sizeof(StoredRegister), 8);
+            default:                        return 0;
+        }
+    }
+
+    IODevice* construct(const uint8_t* rec) {
+        PinBackend*& backend = rec[1] ? _expansion : _local;
+        const SafeAction enter = static_cast<SafeAction>(rec[4]);
+        const SafeAction leave = static_cast<SafeAction>(rec[5]);
+
+        switch (static_cast<DeviceKind>(rec[0])) {
+            case DeviceKind::StableRelay:   return _arena.create<StableRelay>(backend, rec[2], rec[3], enter, leave);
+            case DeviceKind::SafeRelay:     return _arena.create<SafeRelay>(backend, rec[2], rec[3], enter, leave);
+            case DeviceKind::DiscreteInput: return _arena.create<DiscreteInput>(backend, rec[2]);
+            case DeviceKind::AnalogInput:   return _arena.create<AnalogInput>(backend, rec[2]);
+            case DeviceKind::Register:      return _arena.create<StoredRegister>(static_cast<uint16_t>((rec[8] << 8) | rec[9]));
+            default:                        return nullptr;
+        }
+    }
+
+public:
+    /**
+     * @brief Constructor
+     * @param local     Backend for on-board pins
+     * @param expansion Backend for expansion module pins
+     */
+    DeviceConfig(PinBackend*& local, PinBackend*& expansion)
+        : _local(local), _expansion(expansion) {}
+
+    /**
+     * @brief CRC-16/Modbus
+     */
+    static uint16_t crc16(const uint8_t* data, size_t len) {
+        uint16_t crc = 0xFFFF;
+        for (size_t i = 0; i < len; ++i) {
+            crc ^= data[i];
+            for (int b = 0; b < 8; ++b) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+        return crc;
+    }
+
+    /**
+     * @brief Check framing, CRC and record contents (incl. pin ranges per backend)
+     * @param numFixed Items placed before the configured ones
+     * @return Arena bytes needed, or 0 if the description is invalid
+     */
+    static size_t validate(const uint8_t* data, size_t len, size_t numFixed = 0) {
+        if (len < HEADER_SIZE + 2 || data[0] != 'O' || data[1] != 'D' || data[2] != 1) return 0;
+        const size_t count = (data[4] << 8) | data[5];
+        if (len != HEADER_SIZE + count * RECORD_SIZE + 2) return 0;
+        if (crc16(data, len - 2) != (data[len - 2] | (data[len - 1] << 8))) return 0;
+
+        size_t required = align(sizeof(ModbusItem) * (numFixed + count), 8);
+        for (size_t r = 0; r < count; ++r) {
+            const uint8_t* rec = &data[HEADER_SIZE + r * RECORD_SIZE];
+            size_t size = footprint(static_cast<DeviceKind>(rec[0]));
+            if (!size || rec[1] > 1 || rec[4] > RESTORE || rec[5] > RESTORE || !validPins(rec)) return 0;
+            required += size;
+        }
+        return required;
+    }
+
+    /**
+     * @brief Construct devices and items from a description
+     * @param data     Description (see class documentation)
+     * @param len      Length in bytes
+     * @param fixed    Items placed first (copied), may be nullptr
+     * @param numFixed Number of fixed items
+     * @return true if all devices were constructed
+     */
+    bool load(const uint8_t* data, size_t len, const ModbusItem* fixed = nullptr, size_t numFixed = 0) {
+        const unsigned long start = micros();
+        _numFixed = numFixed;
+        _items = nullptr;
+        _numItems = 0;
+        _arena.reset();
+
+        const size_t required = validate(data, len, numFixed);
+        if (!required || required > _arena.capacity()) {
+            #ifdef IDEBUG
+            Serial.println(required ? "Device configuration exceeds arena" : "Device configuration invalid");
+            #endif
+            return false;
+        }
+
+        const size_t count = (data[4] << 8) | data[5];
+        ModbusItem* items = static_cast<ModbusItem*>(
+            _arena.allocate(sizeof(ModbusItem) * (numFixed + count), alignof(ModbusItem)));
+        if (!items) return false;
+
+        for (size_t i = 0; i < numFixed; ++i) new (&items[i]) ModbusItem(fixed[i]);
+        for (size_t r = 0; r < count; ++r) {
+            const uint8_t* rec = &data[HEADER_SIZE + r * RECORD_SIZE];
+            IODevice* device = construct(rec);
+            if (!device) {
+                _arena.reset();
+                return false;
+            }
+            new (&items[numFixed + r]) ModbusItem(device, nullptr, rec[6]);
+        }
+
+        _items = items;
+        _numItems = numFixed + count;
+        _stats.constructionUs = micros() - start;
+        _stats.arenaUsed = _arena.used();
+        _stats.arenaSize = _arena.capacity();
+        _stats.devices = count;
+        return true;
+    }
+
+    /**
+     * @brief Load the description stored in flash
+     * @return false if none is stored or it is invalid
+     */
+    bool loadStored(const ModbusItem* fixed = nullptr, size_t numFixed = 0) {
+        size_t len = 0;
+        _numFixed = numFixed;
+        if (kv_get(KV_KEY, _staging, sizeof(_staging), &len) != 0) return false;
+        _stagingLen = len;
+        return load(_staging, len, fixed, numFixed);
+    }
+
+    /**
+     * @brief Validate and store a description in flash (applied at the next boot)
+     */
+    static bool store(const uint8_t* data, size_t len, size_t numFixed = 0) {
+        const size_t required = validate(data, len, numFixed);
+        if (!required || required > MODBUS_CONFIG_ARENA) return false;
+        return kv_set(KV_KEY, data, len, 0) == 0;
+    }
+
+    /**
+     * @brief HttpServer upload handler for PUT /config
+     * @return 0 to continue, or the HTTP status of the response
+     */
+    int upload(const char* path, size_t offset, const uint8_t* data, size_t len, bool last, bool aborted = false) {
+        if (strcmp(path, "/config") != 0) return 404;
+        if (aborted) {
+            _stagingLen = 0;
+            return 0;
+        }
+        if (offset + len > sizeof(_staging)) return 413;
+        if (offset == 0) _stagingLen = 0;
+        if (len) memcpy(&_staging[offset], data, len);
+        _stagingLen = offset + len;
+        if (!last) return 0;
+        return store(_staging, _stagingLen, _numFixed) ? 204 : 400;
+    }
+
+    /**
+     * @brief Constructed item list (valid after a successful load)
+     */
+    ModbusItem* items() const { return _items; }
+
+    /**
+     * @brief Number of items including the fixed ones
+     */
+    size_t count() const { return _numItems; }
+
+    /**
+     * @brief Construction time and arena usage of the last load
+     */
+    const DeviceConfigStats& stats() const { return _stats; }
+};
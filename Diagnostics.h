@@ -0,0 +1,204 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: Diagnostics.h
+ * Description:
+ * Runtime counters of the controller (cycle time, Modbus requests per
+ * function code, connections) and a Prometheus text-format writer.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+/**
+ * @brief Upper bounds (µs) of the cycle-time histogram buckets.
+ */
+static constexpr uint32_t CYCLE_BUCKETS_US[] = { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000 };
+static constexpr size_t   CYCLE_BUCKET_COUNT = sizeof(CYCLE_BUCKETS_US) / sizeof(CYCLE_BUCKETS_US[0]);
+
+/**
+ * @brief Duration statistics of the update cycle.
+ */
+struct CycleStats {
+    uint32_t count = 0;                          ///< Measured cycles
+    uint32_t lastUs = 0;                         ///< Duration of the last cycle
+    uint32_t maxUs = 0;                          ///< Longest cycle
+    uint64_t totalUs = 0;                        ///< Sum of all cycles
+    uint32_t buckets[CYCLE_BUCKET_COUNT] = {};   ///< Cycles <= bound (non-cumulative)
+
+    /**
+     * @brief Record one cycle duration
+     */
+    void record(uint32_t us) {
+        ++count;
+        lastUs = us;
+        totalUs += us;
+        if (us > maxUs) maxUs = us;
+        for (size_t b = 0; b < CYCLE_BUCKET_COUNT; ++b) {
+            if (us <= CYCLE_BUCKETS_US[b]) { ++buckets[b]; break; }
+        }
+    }
+};
+
+/**
+ * @brief Counters collected by ModbusHandler.
+ */
+struct Diagnostics {
+    CycleStats cycle;                    ///< ModbusHandler::update() durations
+    uint32_t   requests[128] = {};       ///< Requests received per function code
+    uint32_t   connectionsAccepted = 0;  ///< Client connections accepted since boot
+    uint8_t    connectionsActive = 0;    ///< Client connections currently open
+};
+
+
+/**
+ * @class MeteredClient
+ * @brief Client wrapper counting Modbus requests per function code.
+ *
+ * ModbusTCPServer is bound to this wrapper instead of the connection; every
+ * byte it reads passes an MBAP frame parser that counts the function code.
+ */
+class MeteredClient : public Client {
+private:
+    Client*      _target = nullptr;  ///< Wrapped connection
+    Diagnostics& _diag;              ///< Counters to update
+    uint8_t      _header[8];         ///< MBAP header + function code
+    size_t       _pos = 0;           ///< Bytes of _header received
+    size_t       _skip = 0;          ///< Remaining PDU bytes of the current frame
+
+    void observe(const uint8_t* data, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            if (_skip) { --_skip; continue; }
+            _header[_pos++] = data[i];
+            if (_pos < sizeof(_header)) continue;
+
+            size_t frameLen = (static_cast<size_t>(_header[4]) << 8) | _header[5];
+            ++_diag.requests[_header[7] & 0x7F];
+            _skip = frameLen >= 2 ? frameLen - 2 : 0;
+            _pos = 0;
+        }
+    }
+
+public:
+    explicit MeteredClient(Diagnostics& diag) : _diag(diag) {}
+
+    /**
+     * @brief Wrap another connection and reset the frame parser
+     */
+    void attach(Client* target) {
+        _target = target;
+        _pos = 0;
+        _skip = 0;
+    }
+
+    int connect(IPAddress ip, uint16_t port) override { return _target ? _target->connect(ip, port) : 0; }
+    int connect(const char* host, uint16_t port) override { return _target ? _target->connect(host, port) : 0; }
+    size_t write(uint8_t b) override { return _target ? _target->write(b) : 0; }
+    size_t write(const uint8_t* buf, size_t size) override { return _target ? _target->write(buf, size) : 0; }
+    int available() override { return _target ? _target->available() : 0; }
+
+    int read() override {
+        int b = _target ? _target->read() : -1;
+        if (b >= 0) {
+            uint8_t v = static_cast<uint8_t>(b);
+            observe(&v, 1);
+        }
+        return b;
+    }
+
+    int read(uint8_t* buf, size_t size) override {
+        int n = _target ? _target->read(buf, size) : -1;
+        if (n > 0) observe(buf, n);
+        return n;
+    }
+
+    int peek() override { return _target ? _target->peek() : -1; }
+    void flush() override { if (_target) _target->flush(); }
+    void stop() override { if (_target) _target->stop(); }
+    uint8_t connected() override { return _target ? _target->connected() : 0; }
+    operator bool() override { return _target && static_cast<bool>(*_target); }
+};
+
+
+/**
+ * @class MetricsWriter
+ * @brief Appends Prometheus text exposition lines to a fixed buffer.
+ */
+class MetricsWriter {
+private:
+    char*  _buf;               ///< Output buffer
+    size_t _size;              ///< Buffer capacity
+    size_t _len = 0;           ///< Bytes written
+    bool   _overflow = false;  ///< Output was truncated
+
+public:
+    MetricsWriter(char* buf, size_t size) : _buf(buf), _size(size) {}
+
+    /**
+     * @brief Append formatted text
+     */
+    void printf(const char* fmt, ...) {
+        if (_overflow) return;
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(&_buf[_len], _size - _len, fmt, args);
+        va_end(args);
+        if (n < 0 || _len + n >= _size) {
+            _overflow = true;
+            return;
+        }
+        _len += n;
+    }
+
+    /**
+     * @brief # HELP and # TYPE lines of a metric family
+     */
+    void family(const char* name, const char* type, const char* help) {
+        printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    }
+
+    /**
+     * @brief One sample; labels may be nullptr or e.g. "fc=\"3\""
+     */
+    void sample(const char* name, const char* labels, unsigned long long value) {
+        if (labels) printf("%s{%s} %llu\n", name, labels, value);
+        else printf("%s %llu\n", name, value);
+    }
+
+    /**
+     * @brief Family with a single unlabeled sample
+     */
+    void metric(const char* name, const char* type, const char* help, unsigned long long value) {
+        family(name, type, help);
+        sample(name, nullptr, value);
+    }
+
+    size_t length() const { return _len; }
+    bool overflow() const { return _overflow; }
+    void clear() { _len = 0; _overflow = false; }
+};
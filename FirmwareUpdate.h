@@ -0,0 +1,345 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: FirmwareUpdate.h
+ * Description:
+ * Background firmware update: the image is received over HTTP PUT,
+ * written to storage in small steps during idle time, read back and
+ * verified, and activated by a commanded reboot.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+#include "config.h"
+#include "IODevice.h"
+
+/**
+ * @brief Storage receiving a firmware image
+ */
+class FirmwareStore {
+public:
+    virtual bool open() = 0;                                              ///< Start a new, empty image
+    virtual bool write(size_t offset, const uint8_t* data, size_t len) = 0;
+    virtual bool read(size_t offset, uint8_t* data, size_t len) = 0;      ///< Read back written data
+    virtual void close() = 0;                                             ///< Image complete
+    virtual ~FirmwareStore() = default;
+};
+
+
+/**
+ * @brief Image stored as a file
+ *
+ * On the controller the path lies on a mounted file system in the QSPI
+ * flash (e.g. the partition the bootloader installs updates from); on a
+ * host build any file emulates the flash.
+ */
+class FileFirmwareStore : public FirmwareStore {
+private:
+    const char* _path;
+    FILE* _file = nullptr;
+
+public:
+    explicit FileFirmwareStore(const char* path) : _path(path) {}
+
+    bool open() override {
+        close();
+        _file = fopen(_path, "w+b");
+        return _file != nullptr;
+    }
+
+    bool write(size_t offset, const uint8_t* data, size_t len) override {
+        return _file && fseek(_file, offset, SEEK_SET) == 0 && fwrite(data, 1, len, _file) == len;
+    }
+
+    bool read(size_t offset, uint8_t* data, size_t len) override {
+        return _file && fseek(_file, offset, SEEK_SET) == 0 && fread(data, 1, len, _file) == len;
+    }
+
+    void close() override {
+        if (_file) fclose(_file);
+        _file = nullptr;
+    }
+
+    ~FileFirmwareStore() override { close(); }
+};
+
+
+/**
+ * @brief State of a FirmwareUpdate (value of its register)
+ */
+enum class FirmwareState : uint16_t {
+    Idle      = 0,
+    Receiving = 1,   ///< Upload running
+    Writing   = 2,   ///< Upload complete, buffered data being written
+    Verifying = 3,   ///< Reading the image back
+    Verified  = 4,   ///< Ready to activate
+    Failed    = 5,
+    Rebooting = 6
+};
+
+
+/**
+ * @brief Transfer statistics
+ */
+struct FirmwareStats {
+    uint32_t imageBytes = 0;     ///< Length of the last image
+    uint32_t transferMs = 0;     ///< First chunk to verified
+    uint32_t bytesPerSecond = 0; ///< Image length / transferMs
+    uint32_t stepUsMax = 0;      ///< Longest single storage operation
+    uint32_t serviceUsMax = 0;   ///< Longest service() call (added loop jitter)
+};
+
+
+/**
+ * @class FirmwareUpdate
+ * @brief Receives and stores a firmware image without stalling the scan.
+ *
+ * @details
+ *   PUT /firmware carries the image followed by its CRC-32 (IEEE, little
+ *   endian; see tools/firmware_upload.py). upload() only copies chunks into
+ *   a ring buffer of MODBUS_FIRMWARE_BUFFER bytes and ready() throttles the
+ *   HTTP server while it is full; the upload is answered with 202 Accepted.
+ *   service(), called from loop() in the idle time before the next update
+ *   cycle, writes blocks of MODBUS_FIRMWARE_BLOCK bytes and afterwards reads
+ *   the image back to verify the CRC, as long as its time budget allows:
+ *   one storage operation at most is started beyond the budget, so the
+ *   added jitter is bounded by the budget plus stepUsMax.
+ *
+ *   The device maps to a holding register returning the FirmwareState;
+ *   writing MODBUS_FIRMWARE_REBOOT in state Verified calls the activation
+ *   hook (e.g. setting the bootloader's update flag) and resets the
+ *   controller at the next service(). Without an activation hook a reset
+ *   would only restart the old image, so the command is refused and the
+ *   register stays Verified.
+ */
+class FirmwareUpdate : public IODevice {
+private:
+    FirmwareStore& _store;
+    std::function<void()> _activate;          ///< Board-specific activation before reboot
+    uint8_t _ring[MODBUS_FIRMWARE_BUFFER];    ///< Received, not yet written bytes
+    size_t _head = 0;                         ///< Next byte to write
+    size_t _fill = 0;                         ///< Bytes in the ring
+    uint8_t _block[MODBUS_FIRMWARE_BLOCK];    ///< Write/verify block
+    FirmwareState _state = FirmwareState::Idle;
+    size_t _received = 0;                     ///< Bytes received (image + CRC)
+    size_t _written = 0;                      ///< Image bytes written
+    size_t _verified = 0;                     ///< Image bytes read back
+    size_t _imageLength = 0;                  ///< Known when the upload ended
+    bool _ended = false;                      ///< Last chunk received
+    uint32_t _expectedCrc = 0;                ///< CRC sent with the image
+    uint32_t _crc = 0;                        ///< CRC of the read-back image
+    unsigned long _started = 0;               ///< millis() of the first chunk
+    FirmwareStats _stats;
+
+    static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t len) {
+        crc = ~crc;
+        while (len--) {
+            crc ^= *data++;
+            for (int i = 0; i < 8; ++i) crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+        }
+        return ~crc;
+    }
+
+    /**
+     * @brief Copy n bytes out of the ring
+     */
+    void take(uint8_t* out, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = _ring[_head];
+            _head = (_head + 1) % sizeof(_ring);
+        }
+        _fill -= n;
+    }
+
+    void fail() {
+        _store.close();
+        _state = FirmwareState::Failed;
+
+        #ifdef IDEBUG
+        Serial.println("Firmware update failed");
+        #endif
+    }
+
+    /**
+     * @brief One storage operation; false if there is nothing to do
+     */
+    bool step() {
+        if (_state == FirmwareState::Receiving || _state == FirmwareState::Writing) {
+            // The last 4 bytes received are the CRC, never image data
+            size_t writable = _fill > 4 ? _fill - 4 : 0;
+            size_t n = writable < sizeof(_block) ? writable : sizeof(_block);
+            if (n < sizeof(_block) && !_ended) return false;   // wait for a full block
+
+            if (n == 0) {
+                uint8_t crc[4];
+                take(crc, 4);
+                _expectedCrc = crc[0] | (crc[1] << 8) | (crc[2] << 16) | (static_cast<uint32_t>(crc[3]) << 24);
+                _state = FirmwareState::Verifying;
+                return true;
+            }
+            take(_block, n);
+            if (!_store.write(_written, _block, n)) { fail(); return false; }
+            _written += n;
+            return true;
+        }
+
+        if (_state == FirmwareState::Verifying) {
+            size_t n = _imageLength - _verified;
+            if (n > sizeof(_block)) n = sizeof(_block);
+            if (n && !_store.read(_verified, _block, n)) { fail(); return false; }
+            _crc = crc32(_crc, _block, n);
+            _verified += n;
+            if (_verified < _imageLength) return true;
+
+            _store.close();
+            if (_crc != _expectedCrc) { fail(); return false; }
+            _state = FirmwareState::Verified;
+            _stats.imageBytes = _imageLength;
+            _stats.transferMs = millis() - _started;
+            _stats.bytesPerSecond = _stats.transferMs ? (uint64_t)_imageLength * 1000 / _stats.transferMs : 0;
+
+            #ifdef IDEBUG
+            Serial.print("Firmware verified: ");
+            Serial.print(_imageLength);
+            Serial.print(" bytes, ");
+            Serial.print(_stats.bytesPerSecond);
+            Serial.println(" B/s");
+            #endif
+            return false;
+        }
+        return false;
+    }
+
+public:
+    /**
+     * @brief Construct the updater
+     * @param store    Storage for the image
+     * @param activate Called before the commanded reboot (optional)
+     */
+    explicit FirmwareUpdate(FirmwareStore& store, std::function<void()> activate = nullptr)
+        : _store(store), _activate(activate) {
+        setType(ModbusType::HoldingRegister);
+    }
+
+    /**
+     * @brief HttpServer upload handler for PUT /firmware
+     * @return 0 to continue, or the HTTP status of the response
+     */
+    int upload(const char* path, size_t offset, const uint8_t* data, size_t len, bool last, bool aborted = false) {
+        if (strcmp(path, "/firmware") != 0) return 404;
+        if (aborted) {
+            if (_state == FirmwareState::Receiving) fail();   // partial image
+            return 0;
+        }
+
+        if (offset == 0) {
+            if (_state == FirmwareState::Writing || _state == FirmwareState::Verifying ||
+                _state == FirmwareState::Rebooting) return 409;
+            if (!_store.open()) { fail(); return 500; }
+            _head = _fill = 0;
+            _received = _written = _verified = _imageLength = 0;
+            _crc = 0;
+            _ended = false;
+            _started = millis();
+            _state = FirmwareState::Receiving;
+        }
+        if (_state != FirmwareState::Receiving || offset != _received) return 400;
+        if (len > sizeof(_ring) - _fill) { fail(); return 503; }   // ready() was not honoured
+
+        for (size_t i = 0; i < len; ++i) _ring[(_head + _fill + i) % sizeof(_ring)] = data[i];
+        _fill += len;
+        _received += len;
+
+        if (!last) return 0;
+        if (_received < 4) { fail(); return 400; }
+        _imageLength = _received - 4;
+        _ended = true;
+        _state = FirmwareState::Writing;
+        return 202;
+    }
+
+    /**
+     * @brief Whether the ring has room for the next HTTP chunk
+     */
+    bool ready(const char* path) const {
+        return strcmp(path, "/firmware") != 0 || sizeof(_ring) - _fill >= MODBUS_HTTP_UPLOAD_CHUNK;
+    }
+
+    /**
+     * @brief Perform storage operations for up to budgetUs microseconds
+     *
+     * Call from loop() only when the next update cycle is not due soon.
+     */
+    void service(uint32_t budgetUs = MODBUS_FIRMWARE_SLICE_US) {
+        if (_state == FirmwareState::Rebooting) {
+            if (_activate) _activate();
+            NVIC_SystemReset();
+        }
+
+        const uint32_t start = micros();
+        uint32_t stepUs = 0;
+        while (micros() - start + stepUs <= budgetUs) {
+            const uint32_t stepStart = micros();
+            if (!step()) break;
+            stepUs = micros() - stepStart;
+            if (stepUs > _stats.stepUsMax) _stats.stepUsMax = stepUs;
+        }
+        const uint32_t total = micros() - start;
+        if (total > _stats.serviceUsMax) _stats.serviceUsMax = total;
+    }
+
+    FirmwareState state() const { return _state; }
+
+    /**
+     * @brief An activation hook is set, so MODBUS_FIRMWARE_REBOOT is accepted
+     */
+    bool canActivate() const { return static_cast<bool>(_activate); }
+    const FirmwareStats& stats() const { return _stats; }
+
+    /**
+     * @brief Progress of the current transfer in percent (written + verified)
+     */
+    uint8_t progress() const {
+        if (!_imageLength) return 0;
+        return static_cast<uint8_t>((static_cast<uint64_t>(_written + _verified) * 50) / _imageLength);
+    }
+
+    // State register; MODBUS_FIRMWARE_REBOOT activates a verified image
+    uint16_t getHoldingValue() const override { return static_cast<uint16_t>(_state); }
+    void setFromHolding(uint16_t value) override {
+        if (value != MODBUS_FIRMWARE_REBOOT || _state != FirmwareState::Verified) return;
+        if (!_activate) {
+            #ifdef IDEBUG
+            Serial.println("Firmware reboot refused: no activation hook");
+            #endif
+            return;
+        }
+        _state = FirmwareState::Rebooting;
+    }
+};
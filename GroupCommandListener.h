@@ -0,0 +1,250 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: GroupCommandListener.h
+ * Description:
+ * Authenticated UDP multicast commands addressed to many controllers at once
+ * (switch relay group, enter/leave safe state, set value).
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+
+#include "config.h"
+#include "IODevice.h"
+#include <Ethernet.h>
+#include <kvstore_global_api.h>
+#include "mbedtls/md.h"
+
+#ifndef MODBUS_MULTICAST_SENDERS
+#error "config.h lacks MODBUS_MULTICAST_SENDERS (group command replay table, see config.example.h)"
+#endif
+#ifndef MODBUS_MULTICAST_WINDOW
+#error "config.h lacks MODBUS_MULTICAST_WINDOW (reserved replay counters, see config.example.h)"
+#endif
+
+/**
+ * @brief Commands carried by a group command datagram.
+ */
+enum class GroupCommandType : uint8_t {
+    SwitchGroup = 1,   ///< Write value (0/1) to all coils of the command group
+    SafeState   = 2,   ///< value != 0: enter safe state, 0: leave safe state
+    SetValue    = 3    ///< Write value to all holding registers of the command group
+};
+
+/**
+ * @brief Local binding of a command group id to a device.
+ *
+ * Several entries may share an id; a command for that id reaches all of them.
+ */
+struct CommandGroup {
+    uint8_t   id;       ///< Command group id used in the datagram
+    IODevice* device;   ///< Device receiving the command
+};
+
+/**
+ * @brief A decoded and authenticated group command.
+ */
+struct GroupCommand {
+    GroupCommandType type;   ///< Command
+    uint8_t  group;          ///< Command group id
+    uint16_t value;          ///< Coil state or register value
+};
+
+/**
+ * @class GroupCommandListener
+ * @brief Receives group commands on a multicast address.
+ *
+ * @details
+ *   Datagram layout (32 bytes, big-endian):
+ *     0  'O' 'G'          magic
+ *     2  version (1)
+ *     3  command          GroupCommandType
+ *     4  counter (u32)    strictly increasing per sender, replay protection
+ *     8  targets (u32)    controllers whose MODBUS_MULTICAST_MEMBERSHIP
+ *                         shares a bit with this mask execute the command
+ *     12 group id
+ *     13 sender id
+ *     14 value (u16)
+ *     16 tag              first 16 bytes of HMAC-SHA256(MODBUS_MULTICAST_KEY, bytes 0..15)
+ *
+ *   The last accepted counter is kept per sender id (at most
+ *   MODBUS_MULTICAST_SENDERS senders; further ones are rejected). The KV
+ *   store holds a reservation per sender instead of every counter: a
+ *   command beyond the reservation moves it to counter + MODBUS_MULTICAST_WINDOW,
+ *   and persist() writes it after the command was applied. At boot every
+ *   sender starts at its reservation, so a captured datagram does not
+ *   replay after a restart either, and flash is written about once per
+ *   window instead of once per command. After a restart a sender's
+ *   commands are accepted again once its counter passes the reservation
+ *   (tools/group_command.py counts tenths of seconds, so within
+ *   MODBUS_MULTICAST_WINDOW / 10 s). The first command of a sender never
+ *   seen before sets its baseline. tools/group_command.py builds and sends
+ *   datagrams.
+ */
+class GroupCommandListener {
+private:
+    static constexpr size_t PACKET_SIZE = 32;
+    static constexpr size_t SIGNED_SIZE = 16;
+    static constexpr size_t TAG_SIZE = 16;
+
+    static constexpr const char* KV_KEY = "/kv/mcast";
+
+    /**
+     * @brief Last accepted counter of one sender
+     */
+    struct SenderCounter {
+        uint32_t counter;    ///< Last accepted (RAM only, reserved after boot)
+        uint32_t reserved;   ///< Persisted upper bound of accepted counters
+        uint8_t  sender;
+        uint8_t  used;
+    };
+
+    EthernetUDP   _udp;                                 ///< Multicast socket
+    SenderCounter _senders[MODBUS_MULTICAST_SENDERS];   ///< Replay baselines (reservations persisted)
+    bool          _dirty = false;                       ///< A reservation moved, not yet persisted
+    uint32_t      _rejected = 0;                        ///< Datagrams failing authentication or replay check
+
+    static uint32_t get32(const uint8_t* p) {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+               (static_cast<uint32_t>(p[2]) << 8)  |  static_cast<uint32_t>(p[3]);
+    }
+
+    /**
+     * @brief Check the HMAC tag in constant time
+     */
+    static bool authentic(const uint8_t* packet) {
+        static const char key[] = MODBUS_MULTICAST_KEY;
+        uint8_t mac[32];
+        if (mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                            reinterpret_cast<const unsigned char*>(key), sizeof(key) - 1,
+                            packet, SIGNED_SIZE, mac) != 0) return false;
+
+        uint8_t diff = 0;
+        for (size_t i = 0; i < TAG_SIZE; ++i) diff |= mac[i] ^ packet[SIGNED_SIZE + i];
+        return diff == 0;
+    }
+
+    /**
+     * @brief Replay check; records the counter if it is new for the sender
+     */
+    bool fresh(uint8_t sender, uint32_t counter) {
+        SenderCounter* entry = nullptr;
+        for (SenderCounter& s : _senders) {
+            if (s.used && s.sender == sender) {
+                if (static_cast<int32_t>(counter - s.counter) <= 0) return false;
+                entry = &s;
+                break;
+            }
+            if (!s.used && !entry) entry = &s;
+        }
+        if (!entry) return false;   // table full
+
+        if (!entry->used || static_cast<int32_t>(counter - entry->reserved) > 0) {
+            entry->reserved = counter + MODBUS_MULTICAST_WINDOW;
+            _dirty = true;
+        }
+        entry->counter = counter;
+        entry->sender = sender;
+        entry->used = 1;
+        return true;
+    }
+
+public:
+    /**
+     * @brief Join the multicast group
+     */
+    void begin() {
+        size_t len = 0;
+        if (kv_get(KV_KEY, _senders, sizeof(_senders), &len) != 0 || len != sizeof(_senders)) {
+            memset(_senders, 0, sizeof(_senders));
+        }
+        // Counters accepted before the restart may not have been persisted
+        for (SenderCounter& s : _senders) s.counter = s.reserved;
+        _udp.beginMulticast(IPAddress(MODBUS_MULTICAST_ADDRESS), MODBUS_MULTICAST_PORT);
+    }
+
+    /**
+     * @brief Write moved reservations to the KV store
+     *
+     * Call after the received commands were applied, so the flash write
+     * does not delay them.
+     */
+    void persist() {
+        if (!_dirty) return;
+        kv_set(KV_KEY, _senders, sizeof(_senders), 0);
+        _dirty = false;
+    }
+
+    /**
+     * @brief Number of datagrams rejected since boot
+     */
+    uint32_t rejected() const { return _rejected; }
+
+    /**
+     * @brief Fetch the next valid command addressed to this controller
+     * @param cmd Receives the decoded command
+     * @return true if a command was received (non-blocking)
+     */
+    bool receive(GroupCommand& cmd) {
+        uint8_t packet[PACKET_SIZE];
+
+        while (_udp.parsePacket() > 0) {
+            int len = _udp.read(packet, sizeof(packet));
+            if (len != static_cast<int>(PACKET_SIZE)) continue;
+            if (packet[0] != 'O' || packet[1] != 'G' || packet[2] != 1) continue;
+
+            if (!authentic(packet)) {
+                ++_rejected;
+                continue;
+            }
+
+            if (!(get32(&packet[8]) & MODBUS_MULTICAST_MEMBERSHIP)) continue;
+
+            if (!fresh(packet[13], get32(&packet[4]))) {
+                ++_rejected;
+                #ifdef IDEBUG
+                Serial.println("Group command replay rejected");
+                #endif
+                continue;
+            }
+
+            cmd.type  = static_cast<GroupCommandType>(packet[3]);
+            cmd.group = packet[12];
+            cmd.value = (static_cast<uint16_t>(packet[14]) << 8) | packet[15];
+
+            #ifdef IDEBUG
+            Serial.print("Group command ");
+            Serial.print(packet[3]);
+            Serial.print(" group ");
+            Serial.print(cmd.group);
+            Serial.print(" value ");
+            Serial.println(cmd.value);
+            #endif
+            return true;
+        }
+        return false;
+    }
+};
@@ -87,13 +87,13 @@ public:
         if (millis() - _lastChange > HEARTBEAT_DELAY) {
             if (_isAlive) {
                 _isAlive = false;
-                if (_handler) _handler->enterSafeState();
+                if (_handler) _handler->enterSafeState(SAFE_HEARTBEAT);
                 if (_setter) _setter(_isAlive);
             }
         } else {
             if (!_isAlive) {
                 _isAlive = true;
-                if (_handler) _handler->exitSafeState();
+                if (_handler) _handler->exitSafeState(SAFE_HEARTBEAT);
                 if (_setter) _setter(_isAlive);
             }
         }
@@ -63,6 +63,16 @@ enum SafeAction : uint8_t {
     RESTORE = 3
 };
 
+/**
+ * @brief Quality flags of a device value (0 = good).
+ */
+enum Quality : uint8_t {
+    QUALITY_GOOD            = 0,
+    QUALITY_STALE           = 1 << 0,   ///< Value not refreshed in time (e.g. peer timeout)
+    QUALITY_BACKEND_MISSING = 1 << 1,   ///< I/O backend absent, value is not measured
+    QUALITY_OUT_OF_RANGE    = 1 << 2    ///< Value outside the configured valid range
+};
+
 /**
  * @brief Abstract base class for any device that can be mapped to Modbus.
  *
@@ -100,6 +110,16 @@ public:
      */
     virtual void update() {}
 
+    /**
+     * @brief Re-sample a hardware input between scans.
+     *
+     * Reads the current input into the value cache without the side effects
+     * of update() (statistics, timers); fast consumers such as PeerLink call
+     * it between scans (every MODBUS_PEER_SAMPLE_MS). No-op for devices
+     * without inputs.
+     */
+    virtual void refresh() {}
+
     // ---------------------------------------------------------------------
     // Modbus mapping information
     // ---------------------------------------------------------------------
@@ -109,6 +129,14 @@ public:
      */
     ModbusType getType() const { return _type; }
 
+    /**
+     * @brief Whether the device exposes extended data in a holding register
+     *        alongside its primary mapping (e.g. SafeRelay on-time).
+     *
+     * ModbusItem only synchronizes that holding register for devices returning true.
+     */
+    virtual bool hasExtendedData() const { return false; }
+
     // ---------------------------------------------------------------------
     // Modbus read/write API
     //
@@ -126,6 +154,15 @@ public:
      */
     virtual void leaveSafeState() {}
 
+    /**
+     * @brief Stop driving outputs because another controller took them over.
+     *
+     * Called on a hot-standby controller that yields: outputs go off and
+     * pending safe-state requests are dropped, since the device is not
+     * updated again until this controller becomes active.
+     */
+    virtual void releaseOutputs() {}
+
     /**
      * @brief Read the coil (single-bit) value.
      */
@@ -156,6 +193,36 @@ public:
      */
     virtual uint16_t getInputValue() const { return INVALID_VALUE; }
 
+    // ---------------------------------------------------------------------
+    // Replication
+    // ---------------------------------------------------------------------
+
+    /**
+     * @brief Internal state not visible in the Modbus image (e.g. running timers).
+     *
+     * Replicated to a hot-standby controller; 0 means no state.
+     */
+    virtual uint32_t saveState() const { return 0; }
+
+    /**
+     * @brief Restore internal state saved by saveState() on the partner controller.
+     */
+    virtual void restoreState(uint32_t /*state*/) {}
+
+    // ---------------------------------------------------------------------
+    // Diagnostics
+    // ---------------------------------------------------------------------
+
+    /**
+     * @brief Quality flags of the current value (see Quality)
+     */
+    virtual uint8_t quality() const { return QUALITY_GOOD; }
+
+    /**
+     * @brief Number of output switching operations since boot (relays); 0 otherwise.
+     */
+    virtual uint32_t switchCount() const { return 0; }
+
     /**
      * @brief Virtual destructor (required for polymorphic base class).
      */
@@ -40,6 +40,7 @@
 #include <Arduino.h>
 #include "IODevice.h"
 #include "PinBackend.h"
+#include "AnalogStatistics.h"
 
 /**
  * @class DiscreteInput
@@ -74,11 +75,18 @@ public:
         _backend->pinMode(_pin, INPUT);
     }
 
+    /**
+     * @brief Read the pin into the cached state.
+     */
+    void refresh() override {
+        _state = _backend->digitalRead(_pin);
+    }
+
     /**
      * @brief Sample the current digital input state.
      */
     void update() override {
-        _state = _backend->digitalRead(_pin);
+        refresh();
 
         #ifdef IDEBUG_INPUT
         Serial.print("DiscreteInput pin ");
@@ -95,6 +103,13 @@ public:
     bool getDiscreteValue() const override {
         return _state;
     }
+
+    /**
+     * @brief QUALITY_BACKEND_MISSING while the backend is absent
+     */
+    uint8_t quality() const override {
+        return _backend && _backend->present() ? QUALITY_GOOD : QUALITY_BACKEND_MISSING;
+    }
 };
 
 
@@ -104,13 +119,16 @@ public:
  *
  * Reads a hardware analog pin via a PinBackend and exposes the
  * sampled 16-bit value to Modbus. The pin is configured as INPUT
- * on setup().
+ * on setup(). Attached AnalogStatistics are fed every update.
  */
 class AnalogInput : public IODevice {
 private:
     PinBackend*& _backend;     ///< Reference to the pin backend
     uint8_t      _pin;         ///< Analog pin number
     uint16_t     _state = 0;   ///< Last sampled analog value
+    AnalogStatistics* _stats = nullptr;  ///< Optional rolling-window statistics
+    uint16_t     _rangeMin = 0;          ///< Lowest valid reading
+    uint16_t     _rangeMax = 0xFFFE;     ///< Highest valid reading
 
 public:
     /**
@@ -131,11 +149,19 @@ public:
         _backend->pinMode(_pin, INPUT);
     }
 
+    /**
+     * @brief Read the pin into the cached value.
+     */
+    void refresh() override {
+        _state = _backend->analogRead(_pin);
+    }
+
     /**
      * @brief Sample current analog value.
      */
     void update() override {
-        _state = _backend->analogRead(_pin);
+        refresh();
+        for (AnalogStatistics* s = _stats; s; s = s->next()) s->sample(_state);
 
         #ifdef IDEBUG_INPUT
         Serial.print("AnalogInput pin ");
@@ -152,4 +178,33 @@ public:
     uint16_t getInputValue() const override {
         return _state;
     }
+
+    /**
+     * @brief Valid reading range; readings outside are flagged QUALITY_OUT_OF_RANGE
+     *
+     * E.g. a 4-20 mA loop below 4 mA indicates a broken wire.
+     */
+    void setRange(uint16_t minValue, uint16_t maxValue) {
+        _rangeMin = minValue;
+        _rangeMax = maxValue;
+    }
+
+    /**
+     * @brief Backend presence and range of the last reading
+     */
+    uint8_t quality() const override {
+        if (!_backend || !_backend->present()) return QUALITY_BACKEND_MISSING;
+        return (_state < _rangeMin || _state > _rangeMax) ? QUALITY_OUT_OF_RANGE : QUALITY_GOOD;
+    }
+
+    /**
+     * @brief Maintain rolling-window statistics of this input
+     *
+     * Several windows (e.g. one minute and one hour) can be attached.
+     * @param stats Statistics (must outlive the input)
+     */
+    void attach(AnalogStatistics& stats) {
+        stats.setNext(_stats);
+        _stats = &stats;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,188 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: Integrator.h
+ * Description:
+ * Totalizer device integrating an analog rate or relay on-time times
+ * rated power in 64-bit fixed point, persisted periodically and exposed
+ * as a 64-bit input register group with reset.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <Arduino.h>
+#include <kvstore_global_api.h>
+#include "config.h"
+#include "IODevice.h"
+#include "Relay.h"
+#include "Variable.h"
+
+/**
+ * @class Integrator
+ * @brief Totalizer integrated in the scan, independent of polling.
+ *
+ * @details
+ *   Every update adds rate * elapsed ms to a 64-bit accumulator, with the
+ *   rate held since the previous update (exact for relays). The rate is
+ *   either a process value (AnalogInput or Variable, invalid values are
+ *   skipped) or the rated power while a relay is on. The accumulator has a
+ *   resolution of one count-millisecond and does not overflow in practice;
+ *   the total exposed is accumulator / divisor, e.g. 3600000 to turn W
+ *   into Wh or 60000 to turn l/min into l.
+ *
+ *   The integrator maps to a holding register returning the number of
+ *   resets; writing any other value resets the total. The total follows as
+ *   four input registers, most significant word first; 32-bit clients read
+ *   the last two, which wrap like a meter:
+ *
+ *     { &tot }, { &tot.total[0] }, { &tot.total[1] }, { &tot.total[2] }, { &tot.total[3] }
+ *
+ *   With a key, the accumulator is written to the KV store every
+ *   MODBUS_INTEGRATOR_PERSIST ms and on reset, and restored in setup(), so
+ *   at most one persistence period is lost on power failure.
+ */
+class Integrator : public IODevice {
+private:
+    /**
+     * @brief Record in the KV store
+     */
+    struct Persisted {
+        uint64_t accumulator;
+        uint16_t resets;
+    };
+
+    IODevice* _source = nullptr;      ///< Rate source
+    Relay* _relay = nullptr;          ///< Relay whose on-time is integrated
+    uint16_t _ratedPower = 0;         ///< Rate while the relay is on
+    uint32_t _divisor;                ///< Accumulator units per total unit
+    const char* _key;                 ///< KV store key, nullptr = not persisted
+    uint64_t _accumulator = 0;        ///< Sum of rate * ms
+    uint16_t _resets = 0;             ///< Number of resets
+    uint16_t _rate = 0;               ///< Rate held since the last update
+    unsigned long _last = 0;          ///< millis() of the last update
+    unsigned long _lastPersist = 0;   ///< millis() of the last KV write
+
+    uint16_t currentRate() const {
+        if (_relay) return _relay->getCoilValue() ? _ratedPower : 0;
+        uint16_t v = _source->getType() == ModbusType::InputRegister ? _source->getInputValue()
+                                                                     : _source->getHoldingValue();
+        return v == INVALID_VALUE ? 0 : v;
+    }
+
+    uint16_t word(int i) const {
+        return static_cast<uint16_t>(totalValue() >> (16 * (3 - i)));
+    }
+
+    void persist() {
+        if (!_key) return;
+        Persisted p{ _accumulator, _resets };
+        kv_set(_key, &p, sizeof(p), 0);
+        _lastPersist = millis();
+    }
+
+public:
+    InputVariable<uint16_t> total[4] {
+        InputVariable<uint16_t>([this]() { return word(0); }),
+        InputVariable<uint16_t>([this]() { return word(1); }),
+        InputVariable<uint16_t>([this]() { return word(2); }),
+        InputVariable<uint16_t>([this]() { return word(3); })
+    };
+
+    /**
+     * @brief Integrate a process value
+     * @param source  Rate (AnalogInput or Variable)
+     * @param divisor Accumulator units (count * ms) per unit of the total
+     * @param key     KV store key (e.g. "/kv/tot1"), nullptr to not persist
+     */
+    Integrator(IODevice* source, uint32_t divisor, const char* key = nullptr)
+        : _source(source), _divisor(divisor ? divisor : 1), _key(key) {
+        setType(ModbusType::HoldingRegister);
+    }
+
+    /**
+     * @brief Integrate relay on-time times rated power
+     * @param relay      Relay
+     * @param ratedPower Rate while the relay is on (e.g. W)
+     * @param divisor    Accumulator units (count * ms) per unit of the total
+     * @param key        KV store key, nullptr to not persist
+     */
+    Integrator(Relay* relay, uint16_t ratedPower, uint32_t divisor, const char* key = nullptr)
+        : _relay(relay), _ratedPower(ratedPower), _divisor(divisor ? divisor : 1), _key(key) {
+        setType(ModbusType::HoldingRegister);
+    }
+
+    Integrator(const Integrator&) = delete;             // members capture this
+    Integrator& operator=(const Integrator&) = delete;
+
+    void setup() override {
+        Persisted p;
+        size_t len = 0;
+        if (_key && kv_get(_key, &p, sizeof(p), &len) == 0 && len == sizeof(p)) {
+            _accumulator = p.accumulator;
+            _resets = p.resets;
+        }
+        _last = _lastPersist = millis();
+        _rate = currentRate();
+    }
+
+    void update() override {
+        unsigned long now = millis();
+        _accumulator += static_cast<uint64_t>(_rate) * (now - _last);
+        _last = now;
+        _rate = currentRate();
+
+        if (_key && now - _lastPersist >= MODBUS_INTEGRATOR_PERSIST) persist();
+    }
+
+    /**
+     * @brief Clear the total
+     */
+    void reset() {
+        _accumulator = 0;
+        ++_resets;
+        persist();
+
+        #ifdef IDEBUG
+        Serial.print("Integrator reset ");
+        Serial.println(_resets);
+        #endif
+    }
+
+    /**
+     * @brief Total in units of the divisor
+     */
+    uint64_t totalValue() const { return _accumulator / _divisor; }
+
+    // Reset register
+    uint16_t getHoldingValue() const override { return _resets; }
+    void setFromHolding(uint16_t value) override {
+        if (value != _resets) reset();
+    }
+
+    /**
+     * @brief Persist on network loss, a likely precursor of maintenance
+     */
+    void enterSafeState() override { persist(); }
+};
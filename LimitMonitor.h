@@ -0,0 +1,223 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: LimitMonitor.h
+ * Description:
+ * High/low limit monitor for an analog value with hysteresis and delay.
+ * Sets alarm bits and trips the safe action of devices within the scan
+ * that detects the violation.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <Arduino.h>
+#include "IODevice.h"
+#include "Variable.h"
+
+/**
+ * @brief Bits of the LimitMonitor alarm register
+ */
+enum LimitAlarm : uint16_t {
+    LIMIT_HIGH    = 1 << 0,   ///< Above the high limit for longer than the delay
+    LIMIT_LOW     = 1 << 1,   ///< Below the low limit for longer than the delay
+    LIMIT_INVALID = 1 << 2,   ///< Process value invalid (no trip)
+    LIMIT_TRIPPED = 1 << 8    ///< Safe action of the targets active
+};
+
+
+/**
+ * @class LimitMonitor
+ * @brief Local over/under limit trip, independent of the network.
+ *
+ * @details
+ *   A limit is violated when the value is above the high limit (or below
+ *   the low limit) for the delay; it clears when the value returns inside
+ *   by the hysteresis. A violation trips all targets through
+ *   IODevice::enterSafeState() in the same update, i.e. the same path the
+ *   handler uses on network loss; Relays count their safe-state sources,
+ *   so a recovering network does not release a trip, and ignore coil
+ *   writes (clients, group commands) while it holds; schedules and
+ *   controllers leave a relay in safe state alone. Targets need a safe
+ *   action (e.g. SWITCH_OFF) to react. The trip is released when the
+ *   violation clears, or for a latching monitor when the client writes the
+ *   alarm register with LIMIT_TRIPPED cleared (e.g. 0) after it cleared.
+ *
+ *   The monitor maps to a holding register with the LimitAlarm bits; the
+ *   limits and the measured latency follow as items:
+ *
+ *     { &mon }, { &mon.highLimit }, { &mon.lowLimit }, { &mon.hysteresis },
+ *     { &mon.delay }, { &mon.tripLatency }
+ *
+ *   highLimit 0xFFFF and lowLimit 0 disable the respective limit; delay is
+ *   in ms. tripLatency is the time of the last trip from the first sample
+ *   beyond the limit (ms, delay included), so the scan's contribution can
+ *   be measured on the plant.
+ *   List the monitor after its process value so it uses this scan's sample.
+ */
+class LimitMonitor : public IODevice {
+private:
+    IODevice* _pv;                    ///< Monitored value
+    IODevice* const* _targets;        ///< Devices tripped on violation
+    size_t _numTargets;
+    bool _latching;                   ///< Trip held until acknowledged
+    uint16_t _high, _low, _hysteresis, _delay;
+    uint16_t _alarms = 0;             ///< LimitAlarm bits
+    bool _highPending = false, _lowPending = false;
+    unsigned long _highSince = 0, _lowSince = 0;  ///< First sample beyond the limit
+    uint16_t _latency = 0;            ///< Last trip latency (ms)
+    uint16_t _maxLatency = 0;         ///< Worst trip latency since boot (ms)
+    uint32_t _trips = 0;              ///< Number of trips since boot
+
+    uint16_t processValue() const {
+        return _pv->getType() == ModbusType::InputRegister ? _pv->getInputValue()
+                                                           : _pv->getHoldingValue();
+    }
+
+    /**
+     * @brief Evaluate one limit
+     * @param beyond   Value beyond the limit
+     * @param inside   Value back inside by the hysteresis
+     * @param pending  Violation timer running
+     * @param since    Start of the violation
+     * @param bit      Alarm bit
+     */
+    void evaluate(bool beyond, bool inside, bool& pending, unsigned long& since,
+                  uint16_t bit, unsigned long now) {
+        if (_alarms & bit) {
+            if (inside) _alarms &= ~bit;
+            return;
+        }
+        if (!beyond) {
+            pending = false;
+            return;
+        }
+        if (!pending) {
+            pending = true;
+            since = now;
+        }
+        if (now - since >= _delay) {
+            _alarms |= bit;
+            pending = false;
+            if (!(_alarms & LIMIT_TRIPPED)) trip(now - since);
+        }
+    }
+
+    void trip(unsigned long latency) {
+        _alarms |= LIMIT_TRIPPED;
+        ++_trips;
+        _latency = latency > 0xFFFF ? 0xFFFF : latency;
+        if (_latency > _maxLatency) _maxLatency = _latency;
+        for (size_t i = 0; i < _numTargets; ++i) _targets[i]->enterSafeState();
+
+        #ifdef IDEBUG
+        Serial.print("LimitMonitor trip, alarms ");
+        Serial.print(_alarms, HEX);
+        Serial.print(", latency ms ");
+        Serial.println(_latency);
+        #endif
+    }
+
+    void release() {
+        _alarms &= ~LIMIT_TRIPPED;
+        for (size_t i = 0; i < _numTargets; ++i) _targets[i]->leaveSafeState();
+    }
+
+public:
+    Variable<uint16_t> highLimit  { [this]() { return _high; },       [this](uint16_t v) { _high = v; } };
+    Variable<uint16_t> lowLimit   { [this]() { return _low; },        [this](uint16_t v) { _low = v; } };
+    Variable<uint16_t> hysteresis { [this]() { return _hysteresis; }, [this](uint16_t v) { _hysteresis = v; } };
+    Variable<uint16_t> delay      { [this]() { return _delay; },      [this](uint16_t v) { _delay = v; } };
+    InputVariable<uint16_t> tripLatency { [this]() { return _latency; } };
+
+    /**
+     * @brief Construct a limit monitor
+     * @param pv         Monitored value (AnalogInput or Variable)
+     * @param targets    Devices whose safe action is triggered (must outlive the monitor)
+     * @param numTargets Number of targets
+     * @param high       High limit (0xFFFF = none)
+     * @param low        Low limit (0 = none)
+     * @param hyst       Hysteresis for clearing
+     * @param delayMs    Time beyond a limit before the alarm (ms)
+     * @param latching   Hold the trip until the alarm register is written
+     */
+    LimitMonitor(IODevice* pv, IODevice* const* targets, size_t numTargets,
+                 uint16_t high, uint16_t low = 0, uint16_t hyst = 0, uint16_t delayMs = 0,
+                 bool latching = false)
+        : _pv(pv), _targets(targets), _numTargets(numTargets), _latching(latching),
+          _high(high), _low(low), _hysteresis(hyst), _delay(delayMs) {
+        setType(ModbusType::HoldingRegister);
+    }
+
+    LimitMonitor(const LimitMonitor&) = delete;             // members capture this
+    LimitMonitor& operator=(const LimitMonitor&) = delete;
+
+    // Targets were released on yield; evaluate afresh after a takeover
+    void releaseOutputs() override {
+        _alarms &= ~(LIMIT_TRIPPED | LIMIT_HIGH | LIMIT_LOW);
+        _highPending = _lowPending = false;
+    }
+
+    void update() override {
+        unsigned long now = millis();
+        uint16_t pv = processValue();
+
+        if (pv == INVALID_VALUE) {
+            _alarms |= LIMIT_INVALID;
+            return;
+        }
+        _alarms &= ~LIMIT_INVALID;
+
+        evaluate(_high != 0xFFFF && pv > _high, pv + _hysteresis < _high,
+                 _highPending, _highSince, LIMIT_HIGH, now);
+        evaluate(_low != 0 && pv < _low, pv >= _low + _hysteresis,
+                 _lowPending, _lowSince, LIMIT_LOW, now);
+
+        if ((_alarms & LIMIT_TRIPPED) && !(_alarms & (LIMIT_HIGH | LIMIT_LOW)) && !_latching) release();
+    }
+
+    // Alarm register; writing it with LIMIT_TRIPPED cleared acknowledges a
+    // cleared latching trip. The register reads LIMIT_TRIPPED set while the
+    // trip is held, so that write is always a change and reaches the device.
+    uint16_t getHoldingValue() const override { return _alarms; }
+    void setFromHolding(uint16_t value) override {
+        if (value & LIMIT_TRIPPED) return;
+        if ((_alarms & LIMIT_TRIPPED) && !(_alarms & (LIMIT_HIGH | LIMIT_LOW))) release();
+    }
+
+    /**
+     * @brief Current LimitAlarm bits
+     */
+    uint16_t alarms() const { return _alarms; }
+
+    /**
+     * @brief Number of trips since boot
+     */
+    uint32_t trips() const { return _trips; }
+
+    /**
+     * @brief Worst trip latency since boot (ms)
+     */
+    uint16_t maxTripLatency() const { return _maxLatency; }
+};
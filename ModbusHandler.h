@@ -37,9 +37,48 @@
 
 #include "config.h"
 #include "ModbusItem.h"
+#include "Diagnostics.h"
+#include "RequestScheduler.h"
+
+#ifndef MODBUS_MAX_CLIENTS
+#error "config.h lacks MODBUS_MAX_CLIENTS (request scheduling, see config.example.h)"
+#endif
+#ifndef MODBUS_MAX_REQUESTS_PER_SCAN
+#error "config.h lacks MODBUS_MAX_REQUESTS_PER_SCAN (request scheduling, see config.example.h)"
+#endif
+#ifdef MODBUS_SNAPSHOT_PORT
+#include "SnapshotServer.h"
+#endif
+#ifdef MODBUS_MULTICAST_PORT
+#include "GroupCommandListener.h"
+#endif
+#ifdef MODBUS_REDUNDANCY_PORT
+#include "Redundancy.h"
+#endif
+#ifdef MODBUS_TLS_PORT
+#include "SecureModbus.h"
+#endif
+#ifdef MODBUS_HTTP_PORT
+#include "HttpServer.h"
+#endif
+#ifdef MODBUS_WS_PORT
+#include "WebSocketServer.h"
+#endif
+#ifdef MODBUS_OPCUA_PORT
+#include "OpcUaServer.h"
+#endif
 #include <ArduinoModbus.h>
 #include <Ethernet.h>
 
+/**
+ * @brief Reasons to hold the outputs in safe state; they leave it once all are gone.
+ */
+enum SafeStateSource : uint8_t {
+    SAFE_LINK      = 1 << 0,   ///< Ethernet link down
+    SAFE_HEARTBEAT = 1 << 1,   ///< Supervisor heartbeat lost
+    SAFE_GROUP     = 1 << 2    ///< Multicast group command
+};
+
 /**
  * @class ModbusHandler
  * @brief Manages Modbus TCP server, Ethernet link, LEDs, and IODevice synchronization.
@@ -63,11 +102,156 @@ private:
     const char*       _hostname = HOSTNAME;  ///< Hostname for DHCP
 
     ModbusTCPServer   _server;         ///< Modbus TCP server instance
-    EthernetClient    _ethClient;      ///< Active TCP client
+    EthernetClient    _ethClients[MODBUS_MAX_CLIENTS]; ///< Plain TCP connections
+#ifdef MODBUS_TLS_PORT
+    RequestScheduler<MODBUS_MAX_CLIENTS + 1> _scheduler; ///< Plain slots, then the TLS client
+#else
+    RequestScheduler<MODBUS_MAX_CLIENTS> _scheduler;     ///< One slot per plain connection
+#endif
+    const ClientWeight* _clientWeights = nullptr; ///< Weights by client address
+    size_t            _numClientWeights = 0;      ///< Number of weights
+    Client*           _polledClient = nullptr; ///< Client currently bound to the server
     int               _status = 0;     ///< Internal status code
     bool              _linkWasDown = false; ///< Tracks previous Ethernet link state
     bool              _isSafeState = false; ///< Safe-state active flag
-    bool              _wasSafeState = false;
+    uint8_t           _safeSources = 0;     ///< Active SafeStateSource bits
+    ChangeTracker     _changes;        ///< Change sequence shared by all items
+    Diagnostics       _diag;           ///< Cycle time and request counters
+    MeteredClient     _metered{_diag}; ///< Counts requests of the polled client
+    size_t            _coilCount = 0;     ///< Coils used by items
+    size_t            _discreteCount = 0; ///< Discrete inputs used by items
+    size_t            _holdingCount = 0;  ///< Holding registers used by items
+    size_t            _inputCount = 0;    ///< Input registers used by items
+    bool              _planned = false;   ///< Item addresses assigned
+#ifdef MODBUS_SNAPSHOT_PORT
+    SnapshotServer    _snapshot{_server}; ///< Bulk process image service
+#endif
+#ifdef MODBUS_MULTICAST_PORT
+    GroupCommandListener _groupCommands;          ///< Multicast group command receiver
+    const CommandGroup*  _commandGroups = nullptr; ///< Local command group bindings
+    size_t               _numCommandGroups = 0;    ///< Number of bindings
+#endif
+#ifdef MODBUS_REDUNDANCY_PORT
+    RedundancyLink    _redundancy;     ///< Hot-standby replication
+#endif
+#ifdef MODBUS_TLS_PORT
+    SecureModbusListener _tls;         ///< Modbus/TCP Security listener
+#endif
+#ifdef MODBUS_HTTP_PORT
+    HttpServer        _http{_server, _items, _numItems, _changes}; ///< JSON status endpoint
+    std::function<void(MetricsWriter&)> _metricsHook = nullptr;      ///< Application metrics
+#endif
+#ifdef MODBUS_WS_PORT
+    WebSocketServer   _ws{_server, _items, _numItems, _changes}; ///< Push endpoint for browser HMIs
+#endif
+#ifdef MODBUS_OPCUA_PORT
+    OpcUaServer       _opcua{_server, _items, _numItems, _changes}; ///< OPC UA subscriptions
+#endif
+#ifdef MODBUS_QUALITY_TRACKING
+    uint16_t          _itemsNotGood = 0;   ///< Items with any quality flag, last scan
+#endif
+#ifdef MODBUS_CHANGE_TRACKING
+    uint32_t          _publishedSeq = 0;   ///< Sequence last written to the change block
+    uint32_t          _publishedSince = 0; ///< Client "since" value last evaluated
+    uint32_t          _since[decltype(_scheduler)::SLOTS] = {}; ///< "since" of each connection
+    bool              _changesPublished = false; ///< Change block is up to date
+#endif
+
+    /**
+     * @brief Number of registers in the holding table
+     *
+     * Covers the item block and, if enabled, the change block.
+     */
+    size_t holdingTableSize() const {
+        size_t n = _holdingCount;
+        #ifdef MODBUS_CHANGE_TRACKING
+        if (MODBUS_CHANGE_BLOCK + 2 > n) n = MODBUS_CHANGE_BLOCK + 2;
+        #endif
+        return n;
+    }
+
+    /**
+     * @brief Number of registers in the input table
+     *
+     * Covers the item block and, if enabled, the change and quality blocks.
+     */
+    size_t inputTableSize() const {
+        size_t n = _inputCount;
+        #ifdef MODBUS_CHANGE_TRACKING
+        size_t changeEnd = MODBUS_CHANGE_BLOCK + 2 + changeBitmapWords();
+        if (changeEnd > n) n = changeEnd;
+        #endif
+        #ifdef MODBUS_QUALITY_TRACKING
+        size_t qualityEnd = MODBUS_QUALITY_BLOCK + 4 * qualityBitmapWords();
+        if (qualityEnd > n) n = qualityEnd;
+        #endif
+        return n;
+    }
+
+    /**
+     * @brief Print the read requests covering one table
+     *
+     * Splits the table into as few requests as the per-request limit allows.
+     */
+    static void printReadRequests(Print& out, const char* name, uint8_t function,
+                                  size_t offset, size_t count, size_t limit) {
+        for (size_t start = 0; start < count; start += limit) {
+            size_t n = (count - start < limit) ? count - start : limit;
+            out.print("  FC");
+            out.print(function);
+            out.print(" ");
+            out.print(name);
+            out.print(" address ");
+            out.print(offset + start);
+            out.print(" count ");
+            out.println(n);
+        }
+    }
+
+#ifdef MODBUS_CHANGE_TRACKING
+    /**
+     * @brief Number of 16-bit words in the changed-items bitmap
+     */
+    size_t changeBitmapWords() const { return (_numItems + 15) / 16; }
+#endif
+
+#ifdef MODBUS_QUALITY_TRACKING
+    /**
+     * @brief Number of 16-bit words in each quality bitmap
+     */
+    size_t qualityBitmapWords() const { return (_numItems + 15) / 16; }
+#endif
+
+    /**
+     * @brief True if [start, start + len) intersects [0, count) or [other, other + otherLen)
+     */
+    static bool overlaps(size_t start, size_t len, size_t count, size_t other = 0, size_t otherLen = 0) {
+        return start < count || (start < other + otherLen && other < start + len);
+    }
+
+    /**
+     * @brief Check that the change and quality blocks lie beyond the item registers
+     *
+     * With many items (or dense maps grown over time) the item block can reach
+     * MODBUS_CHANGE_BLOCK or MODBUS_QUALITY_BLOCK; the handler would then
+     * overwrite item registers, so the server is not started.
+     */
+    bool blocksClear() const {
+        bool clear = true;
+        #ifdef MODBUS_CHANGE_TRACKING
+        clear = clear && !overlaps(MODBUS_CHANGE_BLOCK, 2, _holdingCount)
+                      && !overlaps(MODBUS_CHANGE_BLOCK, 2 + changeBitmapWords(), _inputCount);
+        #endif
+        #ifdef MODBUS_QUALITY_TRACKING
+        size_t changeLen = 0;   // input registers of the change block, if enabled
+        #ifdef MODBUS_CHANGE_TRACKING
+        changeLen = 2 + changeBitmapWords();
+        #endif
+        clear = clear && !overlaps(MODBUS_QUALITY_BLOCK, 4 * qualityBitmapWords(), _inputCount,
+                                   MODBUS_CHANGE_BLOCK, changeLen);
+        #endif
+        return clear;
+    }
 
 public:
     /**
@@ -83,6 +267,18 @@ public:
         : _items(items), _numItems(numItems),
           _ethServer(port), ledGreenPin(greenPin), ledRedPin(redPin) {}
 
+    /**
+     * @brief Replace the item list (e.g. one built by DeviceConfig)
+     *
+     * Must be called before begin(); the services bound to the list see the
+     * new one as well.
+     */
+    void setItems(ModbusItem* items, size_t numItems) {
+        _items = items;
+        _numItems = numItems;
+        _planned = false;
+    }
+
     /**
      * @brief Initialize Ethernet, LEDs, and Modbus TCP server.
      * @return true on success
@@ -128,6 +324,34 @@ public:
         delay(1000);
 
         _ethServer.begin();
+        #ifdef MODBUS_SNAPSHOT_PORT
+        _snapshot.begin();
+        #endif
+        #ifdef MODBUS_MULTICAST_PORT
+        _groupCommands.begin();
+        #endif
+        #ifdef MODBUS_HTTP_PORT
+        _http.setMetricsSource([this](size_t section, MetricsWriter& out) {
+            return renderMetrics(section, out);
+        });
+        _http.begin();
+        #endif
+        #ifdef MODBUS_WS_PORT
+        _ws.begin();
+        #endif
+        #ifdef MODBUS_OPCUA_PORT
+        _opcua.begin();
+        #endif
+        #ifdef MODBUS_REDUNDANCY_PORT
+        _redundancy.begin();
+        #endif
+        #ifdef MODBUS_TLS_PORT
+        if (!_tls.begin()) {
+            #ifdef IDEBUG
+            Serial.println("Modbus/TCP Security listener not started (credentials?)");
+            #endif
+        }
+        #endif
         return startModbusServer();
     }
 
@@ -145,32 +369,166 @@ public:
             return false;
         }
 
-        _server.configureCoils(MODBUS_COIL_OFFSET, _numItems);
-        _server.configureHoldingRegisters(MODBUS_HOLDING_OFFSET, _numItems);
-        _server.configureInputRegisters(MODBUS_INPUT_OFFSET, _numItems);
-        _server.configureDiscreteInputs(MODBUS_DISCRETE_OFFSET, _numItems);
+        planAddresses();
+        if (!blocksClear()) {
+            #ifdef IDEBUG
+            Serial.println("Change/quality block overlaps the item registers (MODBUS_CHANGE_BLOCK, MODBUS_QUALITY_BLOCK)!");
+            #endif
+            digitalWrite(ledGreenPin, LOW);
+            digitalWrite(ledRedPin, HIGH);
+            return false;
+        }
+        const size_t holding = holdingTableSize();
+        const size_t input = inputTableSize();
+
+        _server.configureCoils(MODBUS_COIL_OFFSET, _coilCount);
+        _server.configureHoldingRegisters(MODBUS_HOLDING_OFFSET, holding);
+        _server.configureInputRegisters(MODBUS_INPUT_OFFSET, input);
+        _server.configureDiscreteInputs(MODBUS_DISCRETE_OFFSET, _discreteCount);
 
         // Clear all registers
-        for (size_t i = MODBUS_COIL_OFFSET; i < MODBUS_COIL_OFFSET + _numItems; i++)
+        for (size_t i = MODBUS_COIL_OFFSET; i < MODBUS_COIL_OFFSET + _coilCount; i++)
             _server.coilWrite(i, false);
-        for (size_t i = MODBUS_HOLDING_OFFSET; i < MODBUS_HOLDING_OFFSET + _numItems; i++)
+        for (size_t i = MODBUS_HOLDING_OFFSET; i < MODBUS_HOLDING_OFFSET + holding; i++)
             _server.holdingRegisterWrite(i, 0);
-        for (size_t i = MODBUS_INPUT_OFFSET; i < MODBUS_INPUT_OFFSET + _numItems; i++)
+        for (size_t i = MODBUS_INPUT_OFFSET; i < MODBUS_INPUT_OFFSET + input; i++)
             _server.inputRegisterWrite(i, 0);
-        for (size_t i = MODBUS_DISCRETE_OFFSET; i < MODBUS_DISCRETE_OFFSET + _numItems; i++)
+        for (size_t i = MODBUS_DISCRETE_OFFSET; i < MODBUS_DISCRETE_OFFSET + _discreteCount; i++)
             _server.discreteInputWrite(i, false);
 
+        #ifdef MODBUS_CHANGE_TRACKING
+        _changesPublished = false;
+        #endif
+        #ifdef MODBUS_SNAPSHOT_PORT
+        _snapshot.setTableSizes(_coilCount, _discreteCount, _holdingCount, _inputCount);
+        #endif
+
         digitalWrite(ledRedPin, LOW);
         digitalWrite(ledGreenPin, HIGH);
         return true;
     }
 
+    /**
+     * @brief Assign Modbus addresses to all items
+     *
+     * By default the array index is the address in every table. With
+     * MODBUS_DENSE_ADDRESSING each table is packed without gaps, ordered by
+     * poll group and then by declaration order, so items polled together are
+     * contiguous. Extended-data holding registers are packed with the holding
+     * table. If every item has compile-time addresses (ModbusItem::of), only
+     * the table sizes are derived. Runs once; later calls are no-ops.
+     */
+    void planAddresses() {
+        if (_planned) return;
+        _planned = true;
+
+        // Generated maps (ModbusItem::of) bring their own addresses
+        bool fixed = _numItems > 0;
+        for (size_t i = 0; i < _numItems; ++i) fixed = fixed && _items[i].isAddressed();
+        if (fixed) {
+            _coilCount = _discreteCount = _holdingCount = _inputCount = 0;
+            for (size_t i = 0; i < _numItems; ++i) {
+                const ModbusItem& item = _items[i];
+                const size_t end = item.address() + 1;
+                switch (item.type()) {
+                    case ModbusType::Coil:            if (end > _coilCount) _coilCount = end; break;
+                    case ModbusType::DiscreteInput:   if (end > _discreteCount) _discreteCount = end; break;
+                    case ModbusType::HoldingRegister: if (end > _holdingCount) _holdingCount = end; break;
+                    case ModbusType::InputRegister:   if (end > _inputCount) _inputCount = end; break;
+                    default: break;
+                }
+                if (item.hasExtendedData() && item.auxAddress() + 1u > _holdingCount) _holdingCount = item.auxAddress() + 1;
+            }
+            return;
+        }
+
+        #ifdef MODBUS_DENSE_ADDRESSING
+        uint16_t coil = 0, discrete = 0, holding = 0, input = 0;
+        int group = -1;
+
+        while (true) {
+            // Next poll group in ascending order
+            int nextGroup = 256;
+            for (size_t i = 0; i < _numItems; ++i) {
+                int g = _items[i].pollGroup();
+                if (g > group && g < nextGroup) nextGroup = g;
+            }
+            if (nextGroup == 256) break;
+            group = nextGroup;
+
+            for (size_t i = 0; i < _numItems; ++i) {
+                ModbusItem& item = _items[i];
+                if (item.pollGroup() != group) continue;
+
+                uint16_t base = 0;
+                switch (item.type()) {
+                    case ModbusType::Coil:            base = coil++; break;
+                    case ModbusType::DiscreteInput:   base = discrete++; break;
+                    case ModbusType::HoldingRegister: base = holding++; break;
+                    case ModbusType::InputRegister:   base = input++; break;
+                    default: break;
+                }
+                uint16_t aux = item.hasExtendedData() ? holding++ : 0;
+                item.assignAddress(base, aux);
+            }
+        }
+
+        _coilCount = coil;
+        _discreteCount = discrete;
+        _holdingCount = holding;
+        _inputCount = input;
+        #else
+        for (size_t i = 0; i < _numItems; ++i) {
+            _items[i].assignAddress(i, i);
+        }
+        _coilCount = _discreteCount = _holdingCount = _inputCount = _numItems;
+        #endif
+    }
+
+    /**
+     * @brief Print the address map and the read requests a client needs
+     * @param out Output stream (e.g. Serial)
+     */
+    void printAddressMap(Print& out) {
+        planAddresses();
+
+        out.println("Modbus address map (item -> address):");
+        for (size_t i = 0; i < _numItems; ++i) {
+            ModbusItem& item = _items[i];
+            out.print("  item ");
+            out.print(i);
+            switch (item.type()) {
+                case ModbusType::Coil:            out.print(" coil     "); out.print(MODBUS_COIL_OFFSET + item.address()); break;
+                case ModbusType::DiscreteInput:   out.print(" discrete "); out.print(MODBUS_DISCRETE_OFFSET + item.address()); break;
+                case ModbusType::HoldingRegister: out.print(" holding  "); out.print(MODBUS_HOLDING_OFFSET + item.address()); break;
+                case ModbusType::InputRegister:   out.print(" input    "); out.print(MODBUS_INPUT_OFFSET + item.address()); break;
+                default:                          out.print(" unmapped"); break;
+            }
+            if (item.hasExtendedData()) {
+                out.print(", extended holding ");
+                out.print(MODBUS_HOLDING_OFFSET + item.auxAddress());
+            }
+            if (item.pollGroup()) {
+                out.print(", poll group ");
+                out.print(item.pollGroup());
+            }
+            out.println();
+        }
+
+        out.println("Read requests:");
+        printReadRequests(out, "coils",    1, MODBUS_COIL_OFFSET,     _coilCount,     2000);
+        printReadRequests(out, "discrete", 2, MODBUS_DISCRETE_OFFSET, _discreteCount, 2000);
+        printReadRequests(out, "holding",  3, MODBUS_HOLDING_OFFSET,  _holdingCount,  125);
+        printReadRequests(out, "input",    4, MODBUS_INPUT_OFFSET,    _inputCount,    125);
+    }
+
     /**
      * @brief Initialize all mapped Modbus items
      */
     void setupItems() {
+        planAddresses();
         for (size_t i = 0; i < _numItems; ++i) {
-            _items[i].setup(i);
+            _items[i].setup(&_changes);
         }
     }
 
@@ -190,7 +548,7 @@ public:
             static bool toggle = false;
             toggle = !toggle;
             digitalWrite(ledRedPin, toggle);
-            enterSafeState();
+            enterSafeState(SAFE_LINK);
             return;
         }
 
@@ -201,7 +559,7 @@ public:
                 digitalWrite(ledRedPin, LOW);
                 
                 if (_linkWasDown) {
-                    exitSafeState();
+                    exitSafeState(SAFE_LINK);
                     _linkWasDown = false;
                 }
                 break;
@@ -216,7 +574,7 @@ public:
                         _ethServer.begin();
                         startModbusServer();
                         _linkWasDown = false;
-                        exitSafeState();   
+                        exitSafeState(SAFE_LINK);
                     }
                     digitalWrite(ledGreenPin, HIGH);
                     digitalWrite(ledRedPin, LOW);
@@ -229,24 +587,146 @@ public:
      * @brief Main update: handle client connections and refresh items
      */
     void update() {
+        const unsigned long cycleStart = micros();
 
         checkEthernet();
 
-        if (!_ethClient || !_ethClient.connected()) {
+        uint8_t active = acceptClients();
+
+        #ifdef MODBUS_TLS_PORT
+        _tls.update();
+        Client* secure = _tls.ready();
+        RequestSlot& tlsSlot = _scheduler.slot(MODBUS_MAX_CLIENTS);
+        if (tlsSlot.connection() != secure) {
+            tlsSlot.bind(secure, secure ? clientWeight(_tls.remoteIP()) : 1);
+            #ifdef MODBUS_CHANGE_TRACKING
+            _since[MODBUS_MAX_CLIENTS] = 0;
+            #endif
+            if (_polledClient == &tlsSlot) _polledClient = nullptr;
+            if (secure) ++_diag.connectionsAccepted;
+        }
+        if (secure) ++active;
+        #endif
+        serveRequests();
+        _diag.connectionsActive = active;
+
+        #ifdef MODBUS_MULTICAST_PORT
+        handleGroupCommands();
+        #endif
+
+        #ifdef MODBUS_REDUNDANCY_PORT
+        // Standby: serve the replicated image, the outputs stay with the partner
+        if (!_redundancy.standby(_items, _numItems, _server)) {
+            updateItems();
+            applySafeState();   // requests raised while standby, after a takeover
+            _redundancy.replicate(_items, _numItems, _server);
+        } else {
+            _isSafeState = false;   // outputs released (yield) or never driven
+        }
+        #else
+        updateItems();
+        #endif
+
+        #ifdef MODBUS_MULTICAST_PORT
+        _groupCommands.persist();   // after the commands of this cycle were applied
+        #endif
+
+        #ifdef MODBUS_SNAPSHOT_PORT
+        _snapshot.update(_changes.sequence());
+        #endif
+        #ifdef MODBUS_HTTP_PORT
+        _http.update();
+        #endif
+        #ifdef MODBUS_WS_PORT
+        _ws.update();
+        #endif
+        #ifdef MODBUS_OPCUA_PORT
+        _opcua.update();
+        #endif
+
+        _diag.cycle.record(micros() - cycleStart);
+    }
+
+    /**
+     * @brief Drop closed connections and accept new ones into free slots
+     * @return Number of open plain connections
+     */
+    uint8_t acceptClients() {
+        uint8_t active = 0;
+        bool accepting = true;
+        for (size_t i = 0; i < MODBUS_MAX_CLIENTS; ++i) {
+            EthernetClient& client = _ethClients[i];
+            RequestSlot& slot = _scheduler.slot(i);
+            if (client && client.connected()) {
+                ++active;
+                continue;
+            }
+            if (slot.connection()) {
+                client.stop();
+                slot.bind(nullptr);
+            }
+            if (!accepting) continue;
+
             EthernetClient newClient = _ethServer.accept();
-            if (newClient) {
-                _ethClient = newClient;
-                _server.accept(_ethClient);
+            if (!newClient) {
+                accepting = false;
+                continue;
             }
+            client = newClient;
+            slot.bind(&client, clientWeight(client.remoteIP()));
+            #ifdef MODBUS_CHANGE_TRACKING
+            _since[i] = 0;
+            #endif
+            if (_polledClient == &slot) _polledClient = nullptr;   // re-bind on the next poll
+            ++_diag.connectionsAccepted;
+            ++active;
         }
+        return active;
+    }
 
-        if (_ethClient && _ethClient.connected()) {
-            _server.poll();
-        } else {
-            _ethClient.stop();
+    /**
+     * @brief Scheduling weight of a client address (1 if not listed)
+     */
+    uint8_t clientWeight(const IPAddress& address) const {
+        for (size_t i = 0; i < _numClientWeights; ++i) {
+            if (_clientWeights[i].address == address) return _clientWeights[i].weight;
         }
+        return 1;
+    }
 
-        updateItems();
+    /**
+     * @brief Serve up to MODBUS_MAX_REQUESTS_PER_SCAN requests, writes first
+     */
+    void serveRequests() {
+        for (size_t n = 0; n < MODBUS_MAX_REQUESTS_PER_SCAN; ++n) {
+            RequestSlot* slot = _scheduler.next(micros());
+            if (!slot) return;
+            #ifdef MODBUS_CHANGE_TRACKING
+            const size_t index = slot - &_scheduler.slot(0);
+            loadSince(_since[index]);
+            pollClient(*slot);
+            _since[index] = readSince();
+            #else
+            pollClient(*slot);
+            #endif
+            slot->release();
+        }
+        _scheduler.endScan();
+    }
+
+    /**
+     * @brief Serve the buffered request of one client
+     *
+     * The server reads through the metering wrapper, which is re-bound only
+     * when switching between clients.
+     */
+    void pollClient(Client& client) {
+        if (_polledClient != &client) {
+            _metered.attach(&client);
+            _server.accept(_metered);
+            _polledClient = &client;
+        }
+        _server.poll();
     }
 
     /**
@@ -256,13 +736,204 @@ public:
         for (size_t i = 0; i < _numItems; ++i) {
             _items[i].update(_server);
         }
+        commitWriteGroups();
+        #ifdef MODBUS_CHANGE_TRACKING
+        publishChanges();
+        #endif
+        #ifdef MODBUS_QUALITY_TRACKING
+        publishQuality();
+        #endif
+    }
+
+    /**
+     * @brief Apply staged values of all write groups with a pending commit
+     *
+     * All members of a group are applied in this cycle before the group's
+     * generation is advanced, so the devices never see a partial set.
+     */
+    void commitWriteGroups() {
+        for (size_t i = 0; i < _numItems; ++i) {
+            WriteGroup* group = _items[i].group();
+            if (group && group->isCommitPending()) _items[i].applyStaged(_server);
+        }
+        for (size_t i = 0; i < _numItems; ++i) {
+            WriteGroup* group = _items[i].group();
+            if (group) group->commit();
+        }
+    }
+
+#ifdef MODBUS_CHANGE_TRACKING
+    /**
+     * @brief Refresh the change block for delta polling
+     *
+     * Holding registers at MODBUS_CHANGE_BLOCK hold the client's "since"
+     * sequence (high word first). Input registers at MODBUS_CHANGE_BLOCK hold
+     * the current sequence (high word first) followed by a bitmap with one bit
+     * per item (item i = bit i % 16 of word i / 16) set if the item changed
+     * after "since". The bitmap is only recomputed when either value moved.
+     *
+     * "since" belongs to the connection: serveRequests() swaps each
+     * connection's value into the holding registers (and refreshes the
+     * bitmap for it) before serving its request and saves it afterwards, so
+     * clients delta-polling concurrently do not overwrite each other.
+     */
+    void publishChanges() {
+        const uint32_t seq = _changes.sequence();
+        const uint32_t since = readSince();
+
+        if (_changesPublished && seq == _publishedSeq && since == _publishedSince) return;
+
+        const size_t base = MODBUS_INPUT_OFFSET + MODBUS_CHANGE_BLOCK;
+        _server.inputRegisterWrite(base,     static_cast<uint16_t>(seq >> 16));
+        _server.inputRegisterWrite(base + 1, static_cast<uint16_t>(seq & 0xFFFF));
+
+        for (size_t w = 0; w < changeBitmapWords(); ++w) {
+            uint16_t bits = 0;
+            for (size_t b = 0; b < 16 && w * 16 + b < _numItems; ++b) {
+                if (_items[w * 16 + b].changeSequence() > since) bits |= (1u << b);
+            }
+            _server.inputRegisterWrite(base + 2 + w, bits);
+        }
+
+        _publishedSeq = seq;
+        _publishedSince = since;
+        _changesPublished = true;
+    }
+
+    /**
+     * @brief "since" value currently in the holding registers
+     */
+    uint32_t readSince() {
+        return (static_cast<uint32_t>(_server.holdingRegisterRead(MODBUS_HOLDING_OFFSET + MODBUS_CHANGE_BLOCK)) << 16) |
+                static_cast<uint32_t>(_server.holdingRegisterRead(MODBUS_HOLDING_OFFSET + MODBUS_CHANGE_BLOCK + 1));
+    }
+
+    /**
+     * @brief Put a connection's "since" into the holding registers and refresh the bitmap for it
+     */
+    void loadSince(uint32_t since) {
+        _server.holdingRegisterWrite(MODBUS_HOLDING_OFFSET + MODBUS_CHANGE_BLOCK, static_cast<uint16_t>(since >> 16));
+        _server.holdingRegisterWrite(MODBUS_HOLDING_OFFSET + MODBUS_CHANGE_BLOCK + 1, static_cast<uint16_t>(since & 0xFFFF));
+        publishChanges();
+    }
+#endif
+
+#ifdef MODBUS_QUALITY_TRACKING
+    /**
+     * @brief Refresh the quality block
+     *
+     * Input registers at MODBUS_QUALITY_BLOCK hold four bitmaps of
+     * qualityBitmapWords() words with one bit per item (item i = bit i % 16
+     * of word i / 16): good, stale, backend missing, out of range. Only
+     * words that changed are written.
+     */
+    void publishQuality() {
+        const size_t words = qualityBitmapWords();
+        const size_t base = MODBUS_INPUT_OFFSET + MODBUS_QUALITY_BLOCK;
+        uint16_t notGood = 0;
+
+        for (size_t w = 0; w < words; ++w) {
+            uint16_t maps[4] = { 0, 0, 0, 0 };
+            for (size_t b = 0; b < 16 && w * 16 + b < _numItems; ++b) {
+                const uint8_t q = _items[w * 16 + b].quality();
+                if (q == QUALITY_GOOD) maps[0] |= (1u << b);
+                else ++notGood;
+                if (q & QUALITY_STALE)           maps[1] |= (1u << b);
+                if (q & QUALITY_BACKEND_MISSING) maps[2] |= (1u << b);
+                if (q & QUALITY_OUT_OF_RANGE)    maps[3] |= (1u << b);
+            }
+            for (size_t m = 0; m < 4; ++m) {
+                const size_t addr = base + m * words + w;
+                if (_server.inputRegisterRead(addr) != maps[m]) _server.inputRegisterWrite(addr, maps[m]);
+            }
+        }
+        _itemsNotGood = notGood;
+    }
+#endif
+
+    /**
+     * @brief Current change sequence number
+     */
+    uint32_t changeSequence() const { return _changes.sequence(); }
+
+    /**
+     * @brief Set scheduling weights of known client addresses
+     *
+     * A client with weight 4 is served four requests for every one of a
+     * weight 1 client while both have requests of the same class pending.
+     * Applies to connections accepted afterwards.
+     * @param weights Array of weights (must outlive the handler)
+     * @param numWeights Number of weights
+     */
+    void setClientWeights(const ClientWeight* weights, size_t numWeights) {
+        _clientWeights = weights;
+        _numClientWeights = numWeights;
+    }
+
+#ifdef MODBUS_MULTICAST_PORT
+    /**
+     * @brief Bind command group ids to local devices
+     * @param groups Array of bindings (must outlive the handler)
+     * @param numGroups Number of bindings
+     */
+    void setCommandGroups(const CommandGroup* groups, size_t numGroups) {
+        _commandGroups = groups;
+        _numCommandGroups = numGroups;
+    }
+
+    /**
+     * @brief Apply all pending multicast group commands
+     *
+     * Switch and set commands are written into the server tables, so the
+     * regular ModbusItem path applies them in this cycle like a client write.
+     */
+    void handleGroupCommands() {
+        GroupCommand cmd;
+        while (_groupCommands.receive(cmd)) {
+            if (cmd.type == GroupCommandType::SafeState) {
+                if (cmd.value) enterSafeState(SAFE_GROUP);
+                else exitSafeState(SAFE_GROUP);
+                continue;
+            }
+
+            for (size_t g = 0; g < _numCommandGroups; ++g) {
+                if (_commandGroups[g].id != cmd.group) continue;
+
+                for (size_t i = 0; i < _numItems; ++i) {
+                    ModbusItem& item = _items[i];
+                    if (item.device() != _commandGroups[g].device) continue;
+
+                    if (cmd.type == GroupCommandType::SwitchGroup && item.type() == ModbusType::Coil) {
+                        _server.coilWrite(MODBUS_COIL_OFFSET + item.address(), cmd.value != 0);
+                    } else if (cmd.type == GroupCommandType::SetValue && item.type() == ModbusType::HoldingRegister) {
+                        _server.holdingRegisterWrite(MODBUS_HOLDING_OFFSET + item.address(), cmd.value);
+                    }
+                }
+            }
+        }
     }
+#endif
 
     /**
      * @brief Enter safe state on all devices
+     * @param source SafeStateSource requesting it
+     */
+    void enterSafeState(uint8_t source) {
+        _safeSources |= source;
+        applySafeState();
+    }
+
+    /**
+     * @brief Put the devices into safe state if a source requests it
+     *
+     * A standby controller only records the sources; they are applied when
+     * it takes over.
      */
-    void enterSafeState() {
-        if (_isSafeState) return;
+    void applySafeState() {
+        if (_isSafeState || !_safeSources) return;
+        #ifdef MODBUS_REDUNDANCY_PORT
+        if (!_redundancy.isActive()) return;   // standby does not drive outputs
+        #endif
         _isSafeState = true;
         for (size_t i = 0; i < _numItems; ++i) {
             _items[i].enterSafeState();
@@ -270,16 +941,198 @@ public:
     }
 
     /**
-     * @brief Exit safe state on all devices
+     * @brief Withdraw a safe-state request; devices leave it once no source remains
+     * @param source SafeStateSource withdrawing its request
      */
-    void exitSafeState() {
-        if (!_isSafeState) return;
+    void exitSafeState(uint8_t source) {
+        _safeSources &= ~source;
+        if (!_isSafeState || _safeSources) return;
         _isSafeState = false;
         for (size_t i = 0; i < _numItems; ++i) {
             _items[i].exitSafeState();
         }
     }
 
+    /**
+     * @brief Cycle time, request and connection counters
+     */
+    const Diagnostics& diagnostics() const { return _diag; }
+
+#ifdef MODBUS_HTTP_PORT
+    /**
+     * @brief Add application metrics (e.g. error bits) to GET /metrics
+     * @param hook Called once per scrape, after the controller metrics
+     */
+    void setMetricsHook(std::function<void(MetricsWriter&)> hook) { _metricsHook = hook; }
+
+    /**
+     * @brief Receive PUT requests on the HTTP port (e.g. DeviceConfig::upload)
+     */
+    void setUploadHandler(HttpServer::UploadHandler handler) { _http.setUploadHandler(handler); }
+
+    /**
+     * @brief Throttle PUT requests to the upload receiver (e.g. FirmwareUpdate::ready)
+     */
+    void setUploadReady(HttpServer::UploadReady ready) { _http.setUploadReady(ready); }
+
+    /**
+     * @brief Render one section of the controller metrics
+     *
+     * Sections: 0 cycle time, 1 requests per function code, 2 connections,
+     * 3 request scheduling per client slot, 4 TLS, WebSocket and OPC UA
+     * endpoints, 5.. relay switch counts (16 items each), then the
+     * application hook.
+     * @return false once all sections are rendered
+     */
+    bool renderMetrics(size_t section, MetricsWriter& out) {
+        constexpr size_t ITEMS_PER_SECTION = 16;
+        const size_t itemSections = (_numItems + ITEMS_PER_SECTION - 1) / ITEMS_PER_SECTION;
+        char labels[32];
+
+        if (section == 0) {
+            const CycleStats& c = _diag.cycle;
+            out.family("opta_cycle_seconds", "histogram", "Duration of the Modbus update cycle");
+            unsigned long long cumulative = 0;
+            for (size_t b = 0; b < CYCLE_BUCKET_COUNT; ++b) {
+                cumulative += c.buckets[b];
+                out.printf("opta_cycle_seconds_bucket{le=\"%lu.%06lu\"} %llu\n",
+                           static_cast<unsigned long>(CYCLE_BUCKETS_US[b] / 1000000UL),
+                           static_cast<unsigned long>(CYCLE_BUCKETS_US[b] % 1000000UL), cumulative);
+            }
+            out.printf("opta_cycle_seconds_bucket{le=\"+Inf\"} %lu\n", static_cast<unsigned long>(c.count));
+            out.printf("opta_cycle_seconds_sum %llu.%06llu\n", c.totalUs / 1000000ULL, c.totalUs % 1000000ULL);
+            out.printf("opta_cycle_seconds_count %lu\n", static_cast<unsigned long>(c.count));
+            out.metric("opta_cycle_last_microseconds", "gauge", "Duration of the last cycle", c.lastUs);
+            out.metric("opta_cycle_max_microseconds", "gauge", "Longest cycle since boot", c.maxUs);
+            return true;
+        }
+
+        if (section == 1) {
+            out.family("opta_modbus_requests_total", "counter", "Modbus requests received per function code");
+            for (size_t fc = 0; fc < 128; ++fc) {
+                if (!_diag.requests[fc]) continue;
+                snprintf(labels, sizeof(labels), "fc=\"%u\"", static_cast<unsigned>(fc));
+                out.sample("opta_modbus_requests_total", labels, _diag.requests[fc]);
+            }
+            return true;
+        }
+
+        if (section == 2) {
+            out.metric("opta_modbus_connections_total", "counter", "Modbus client connections accepted", _diag.connectionsAccepted);
+            out.metric("opta_modbus_connections", "gauge", "Modbus client connections open", _diag.connectionsActive);
+            out.metric("opta_change_sequence", "counter", "Item change sequence", _changes.sequence());
+            out.metric("opta_safe_state", "gauge", "Outputs in safe state", _isSafeState ? 1 : 0);
+            out.metric("opta_safe_state_sources", "gauge", "Active safe-state sources (1 link, 2 heartbeat, 4 group command)", _safeSources);
+            #ifdef MODBUS_QUALITY_TRACKING
+            out.metric("opta_items_not_good", "gauge", "Items with a quality flag set", _itemsNotGood);
+            #endif
+            return true;
+        }
+
+        if (section == 3) {
+            out.metric("opta_modbus_deferred_scans_total", "counter", "Scans ending at the request cap with requests pending", _scheduler.deferred());
+            out.family("opta_modbus_served_total", "counter", "Requests served per client slot");
+            for (size_t i = 0; i < _scheduler.SLOTS; ++i) {
+                snprintf(labels, sizeof(labels), "slot=\"%u\"", static_cast<unsigned>(i));
+                out.sample("opta_modbus_served_total", labels, _scheduler.slot(i).stats().served);
+            }
+            out.family("opta_modbus_served_writes_total", "counter", "Write requests served per client slot");
+            for (size_t i = 0; i < _scheduler.SLOTS; ++i) {
+                snprintf(labels, sizeof(labels), "slot=\"%u\"", static_cast<unsigned>(i));
+                out.sample("opta_modbus_served_writes_total", labels, _scheduler.slot(i).stats().writes);
+            }
+            out.family("opta_modbus_dispatch_delay_microseconds_total", "counter", "Summed delay between reading a request in the scan and serving it per client slot");
+            for (size_t i = 0; i < _scheduler.SLOTS; ++i) {
+                snprintf(labels, sizeof(labels), "slot=\"%u\"", static_cast<unsigned>(i));
+                out.sample("opta_modbus_dispatch_delay_microseconds_total", labels, _scheduler.slot(i).stats().totalUs);
+            }
+            out.family("opta_modbus_dispatch_delay_max_microseconds", "gauge", "Longest delay between reading a request in the scan and serving it per client slot");
+            for (size_t i = 0; i < _scheduler.SLOTS; ++i) {
+                snprintf(labels, sizeof(labels), "slot=\"%u\"", static_cast<unsigned>(i));
+                out.sample("opta_modbus_dispatch_delay_max_microseconds", labels, _scheduler.slot(i).stats().maxUs);
+            }
+            return true;
+        }
+
+        if (section == 4) {
+            #ifdef MODBUS_TLS_PORT
+            const TlsStats& tls = _tls.stats();
+            out.metric("opta_tls_handshakes_total", "counter", "Completed TLS handshakes", tls.handshakes);
+            out.metric("opta_tls_resumed_total", "counter", "TLS handshakes resumed from a ticket", tls.resumed);
+            out.metric("opta_tls_failed_total", "counter", "Failed TLS handshakes", tls.failed);
+            out.metric("opta_tls_write_stalls_total", "counter", "TLS clients dropped on a stalled write", tls.writeStalls);
+            out.metric("opta_tls_handshake_microseconds", "gauge", "Duration of the last completed TLS handshake", tls.handshakeUs);
+            out.metric("opta_tls_handshake_max_microseconds", "gauge", "Longest completed TLS handshake", tls.handshakeUsMax);
+            out.metric("opta_tls_slice_max_microseconds", "gauge", "Longest TLS handshake slice within a cycle", tls.sliceUsMax);
+            out.metric("opta_tls_records_in_total", "counter", "TLS application records read", tls.recordsIn);
+            out.metric("opta_tls_records_out_total", "counter", "TLS application records written", tls.recordsOut);
+            out.metric("opta_tls_record_microseconds_total", "counter", "Time spent encrypting and decrypting TLS records", tls.recordUsTotal);
+            #endif
+            #ifdef MODBUS_WS_PORT
+            const WebSocketStats& ws = _ws.stats();
+            out.metric("opta_ws_connections_total", "counter", "WebSocket handshakes", ws.connections);
+            out.metric("opta_ws_frames_total", "counter", "WebSocket delta frames sent", ws.frames);
+            out.metric("opta_ws_coalesced_total", "counter", "Item changes coalesced before sending", ws.coalesced);
+            out.metric("opta_ws_dropped_total", "counter", "WebSocket clients dropped", ws.dropped);
+            #endif
+            #ifdef MODBUS_OPCUA_PORT
+            const OpcUaStats& ua = _opcua.stats();
+            out.metric("opta_opcua_requests_total", "counter", "OPC UA service requests", ua.messages);
+            out.metric("opta_opcua_publishes_total", "counter", "OPC UA publish responses with data", ua.publishes);
+            out.metric("opta_opcua_notifications_total", "counter", "OPC UA item values published", ua.notifications);
+            out.metric("opta_opcua_update_max_microseconds", "gauge", "Longest OPC UA update", ua.updateUsMax);
+            out.metric("opta_opcua_memory_bytes", "gauge", "OPC UA server static memory", _opcua.memoryUsage());
+            #endif
+            return true;
+        }
+
+        if (section < 5 + itemSections) {
+            const size_t first = (section - 5) * ITEMS_PER_SECTION;
+            if (first == 0) out.family("opta_relay_switches_total", "counter", "Relay off-to-on transitions");
+            for (size_t i = first; i < _numItems && i < first + ITEMS_PER_SECTION; ++i) {
+                if (_items[i].type() != ModbusType::Coil) continue;
+                snprintf(labels, sizeof(labels), "item=\"%u\"", static_cast<unsigned>(i));
+                out.sample("opta_relay_switches_total", labels, _items[i].device()->switchCount());
+            }
+            return true;
+        }
+
+        if (section == 5 + itemSections && _metricsHook) {
+            _metricsHook(out);
+            return true;
+        }
+        return false;
+    }
+#endif
+
+#ifdef MODBUS_TLS_PORT
+    /**
+     * @brief TLS handshake and record cost counters
+     */
+    const TlsStats& tlsStats() const { return _tls.stats(); }
+#endif
+
+#ifdef MODBUS_WS_PORT
+    /**
+     * @brief WebSocket push counters
+     */
+    const WebSocketStats& webSocketStats() const { return _ws.stats(); }
+#endif
+
+#ifdef MODBUS_OPCUA_PORT
+    /**
+     * @brief OPC UA server (stats and memory usage)
+     */
+    const OpcUaServer& opcua() const { return _opcua; }
+#endif
+
+#ifdef MODBUS_REDUNDANCY_PORT
+    /**
+     * @brief Hot-standby replication state
+     */
+    const RedundancyLink& redundancy() const { return _redundancy; }
+#endif
+
     /**
      * @brief Get pointer to Modbus TCP server
      * @return ModbusTCPServer*
@@ -32,37 +32,168 @@
  */
 #pragma once
 #include "IODevice.h"
+#include "WriteGroup.h"
+#include "ChangeTracker.h"
 #include <ArduinoModbus.h>
 
+
 /**
  * @brief Represents a single Modbus-mapped device or variable.
  * 
  * This class handles synchronization between a physical or virtual IODevice
  * and the Modbus registers (coils, discrete inputs, holding registers, input registers).
+ *
+ * The synchronization routines are specialized per ModbusType and bound once
+ * in setup(), so each cycle only touches the server tables the mapping needs.
+ * The holding register carrying extended data (e.g. SafeRelay on-time) is
+ * only synchronized for devices that opt in via IODevice::hasExtendedData().
+ *
+ * Items belonging to a WriteGroup leave client writes staged in the server
+ * tables until the group is committed (see applyStaged()).
  */
 class ModbusItem {
 private:
+    using SyncFn = void (ModbusItem::*)(ModbusTCPServer&);
+
     uint16_t _baseAddress = 0;        /**< Base Modbus address for the device */
+    uint16_t _auxAddress = 0;     /**< Holding register address for extended data */
     IODevice* _device;            /**< Pointer to the underlying physical device or variable */
     uint16_t _registerCount = 1;  /**< Number of registers used (default: 1) */
     uint16_t _lastValue = 0;      /**< Cached last value to prevent redundant writes */
     uint16_t _lastValue2 = 0;     /**< Optional second cache for devices using multiple registers */
+    SyncFn _fromModbus = nullptr; /**< Bound Modbus → device routine */
+    SyncFn _toModbus = nullptr;   /**< Bound device → Modbus routine */
+    WriteGroup* _group = nullptr; /**< Optional transactional write group */
+    uint8_t _pollGroup = 0;       /**< Items with equal poll group are laid out together */
+    ChangeTracker* _tracker = nullptr; /**< Change sequence source (set in setup) */
+    uint32_t _changeSeq = 0;      /**< Sequence number of the last detected change */
+    bool _bound = false;          /**< Sync routines fixed at compile time (of()) */
+    bool _addressed = false;      /**< Addresses fixed at compile time (of()) */
+
+    /**
+     * @brief Stamp the item with the next change sequence number
+     */
+    void markChanged() {
+        if (_tracker) _changeSeq = _tracker->next();
+    }
+
+    /**
+     * @brief Modbus → device synchronization for mapping type T.
+     *
+     * The primary template is a no-op for read-only mappings.
+     */
+    template<ModbusType T>
+    void syncFrom(ModbusTCPServer& /*server*/) {}
+
+    /**
+     * @brief Device → Modbus synchronization for mapping type T.
+     */
+    template<ModbusType T>
+    void syncTo(ModbusTCPServer& /*server*/) {}
+
+    /**
+     * @brief Mapping type T plus the extended-data holding register.
+     */
+    template<ModbusType T>
+    void syncFromExtended(ModbusTCPServer& server) {
+        syncFrom<T>(server);
+        syncFromAux(server);
+    }
+
+    template<ModbusType T>
+    void syncToExtended(ModbusTCPServer& server) {
+        syncTo<T>(server);
+        syncToAux(server);
+    }
+
+    /**
+     * @brief Holding register for extended data (e.g., relay on-time), client side
+     */
+    void syncFromAux(ModbusTCPServer& server) {
+        uint16_t val2 = server.holdingRegisterRead(_auxAddress + MODBUS_HOLDING_OFFSET);
+        if (val2 != _lastValue2) {
+            _device->setFromHolding(val2);
+            _lastValue2 = val2;
+            markChanged();
+            #ifdef IDEBUG_RELAY
+            Serial.print("Holding UpdateFromModbus: Address ");
+            Serial.print(_auxAddress);
+            Serial.print(", Value ");
+            Serial.println(val2);
+            #endif
+        }
+    }
+
+    /**
+     * @brief Holding register for extended data (e.g., relay on-time), device side
+     */
+    void syncToAux(ModbusTCPServer& server) {
+        uint16_t tmp = _device->getHoldingValue();
+        if (tmp != _lastValue2) {
+            _lastValue2 = tmp;
+            markChanged();
+            server.holdingRegisterWrite(_auxAddress + MODBUS_HOLDING_OFFSET, tmp);
+            #ifdef IDEBUG_RELAY
+            Serial.print("Holding UpdateToModbus: Value ");
+            Serial.println(tmp);
+            #endif
+        }
+    }
+
+    /**
+     * @brief Select the synchronization routines for the device's mapping type.
+     *
+     * Runs once from setup(); the per-cycle path only calls the bound routines.
+     */
+    void bind();
 
 public:
     /**
      * @brief Constructor
-     * @param baseAddress The base Modbus address of the device
      * @param device Pointer to the physical IODevice or variable
+     * @param group Optional write group; client writes are applied on its commit
+     * @param pollGroup Items of the same poll group are placed next to each other
+     *                  by the address planner (MODBUS_DENSE_ADDRESSING)
+     */
+    constexpr ModbusItem(IODevice* device, WriteGroup* group = nullptr, uint8_t pollGroup = 0)
+        : _device(device), _group(group), _pollGroup(pollGroup) {}
+
+    /**
+     * @brief Item with mapping type and addresses fixed at compile time
+     *
+     * Used by generated register maps (tools/generate_map.py): the sync
+     * routines are selected by the template arguments instead of by the
+     * device type in setup(), and the address planner keeps the addresses.
+     * @tparam T        Mapping type of the device
+     * @tparam Extended Device also uses an extended-data holding register
+     * @param device    Pointer to the physical IODevice or variable
+     * @param base      Address in the table of T
+     * @param aux       Holding register address for extended data
+     * @param group     Optional write group
+     * @param pollGroup Poll group (informational, the layout is fixed)
      */
-    ModbusItem(IODevice* device)
-        : _device(device) {}
+    template<ModbusType T, bool Extended = false>
+    static constexpr ModbusItem of(IODevice* device, uint16_t base, uint16_t aux = 0,
+                                   WriteGroup* group = nullptr, uint8_t pollGroup = 0);
 
     /**
-     * @brief Initialize the underlying IODevice
+     * @brief Assign the Modbus addresses (relative to the table offsets)
+     * @param baseAddress Address in the table of the device's mapping type
+     * @param auxAddress Holding register address for extended data
      */
-    void setup(uint16_t baseAddress) {
+    void assignAddress(uint16_t baseAddress, uint16_t auxAddress) {
         _baseAddress = baseAddress;
+        _auxAddress = auxAddress;
+    }
+
+    /**
+     * @brief Initialize the underlying IODevice and bind the sync routines
+     * @param tracker Optional change sequence shared by all items
+     */
+    void setup(ChangeTracker* tracker = nullptr) {
+        _tracker = tracker;
         if (_device) _device->setup();
+        if (!_bound) bind();
     }
 
     /**
@@ -79,6 +210,18 @@ public:
         if (_device) _device->leaveSafeState();
     }
 
+    /**
+     * @brief Release the device's outputs to a partner controller
+     *
+     * The coil cache follows the released device, so a later takeover
+     * applies the replicated image again like after boot.
+     */
+    void releaseOutputs() {
+        if (!_device) return;
+        _device->releaseOutputs();
+        if (type() == ModbusType::Coil) _lastValue = _device->getCoilValue();
+    }
+
 
 
     /**
@@ -93,139 +236,99 @@ public:
      * @param server Reference to the Modbus TCP server
      */
     void updateFromModbus(ModbusTCPServer& server) {
-        if (!_device) return;
+        if (_group) return;   // staged until the group commits
+        if (_fromModbus) (this->*_fromModbus)(server);
+    }
+
+    /**
+     * @brief Apply the value staged in the server tables to the device
+     *
+     * Used for write group members when their group is committed.
+     * @param server Reference to the Modbus TCP server
+     */
+    void applyStaged(ModbusTCPServer& server) {
+        if (_fromModbus) (this->*_fromModbus)(server);
+    }
 
-        switch (_device->getType()) {
-            case ModbusType::Coil: {
-                bool val = server.coilRead(_baseAddress + MODBUS_COIL_OFFSET);
-                if (val != static_cast<bool>(_lastValue)) {
-                    _device->setFromCoil(val);
-                    _lastValue = val;
-                    #ifdef IDEBUG_RELAY
-                    Serial.print("Coil UpdateFromModbus: Address ");
-                    Serial.print(_baseAddress + MODBUS_COIL_OFFSET);
-                    Serial.print(", Value ");
-                    Serial.println(val);
-                    #endif
-                }
-
-                // Optional: holding register for extended data (e.g., relay on-time)
-                uint16_t val2 = server.holdingRegisterRead(_baseAddress + MODBUS_HOLDING_OFFSET);
-                if (val2 != _lastValue2) {
-                    _device->setFromHolding(val2);
-                    _lastValue2 = val2;
-                    #ifdef IDEBUG_RELAY
-                    Serial.print("Holding UpdateFromModbus: Address ");
-                    Serial.print(_baseAddress);
-                    Serial.print(", Value ");
-                    Serial.println(val2);
-                    #endif
-                }
-                break;
-            }
-
-            case ModbusType::HoldingRegister: {
-                uint16_t val = server.holdingRegisterRead(_baseAddress + MODBUS_HOLDING_OFFSET);
-                if (val != _lastValue) {
-                    _device->setFromHolding(val);
-                    _lastValue = val;
-                    #ifdef IDEBUG_VARIABLE
-                    Serial.print("Holding UpdateFromModbus: Address ");
-                    Serial.print(_baseAddress);
-                    Serial.print(", Value ");
-                    Serial.println(val);
-                    #endif
-                }
-                break;
-            }
-
-            default:
-                break;
+    /**
+     * @brief Write group this item belongs to, or nullptr
+     */
+    WriteGroup* group() const { return _group; }
+
+    /**
+     * @brief Underlying device
+     */
+    IODevice* device() const { return _device; }
+
+    /**
+     * @brief Modbus mapping type of the device
+     */
+    ModbusType type() const { return _device ? _device->getType() : ModbusType::Undefined; }
+
+    /**
+     * @brief Whether the item also occupies a holding register for extended data
+     */
+    bool hasExtendedData() const { return _device && _device->hasExtendedData(); }
+
+    /**
+     * @brief Quality flags of the device value (QUALITY_BACKEND_MISSING without device)
+     */
+    uint8_t quality() const { return _device ? _device->quality() : QUALITY_BACKEND_MISSING; }
+
+    /**
+     * @brief Whether the addresses were fixed at compile time
+     */
+    bool isAddressed() const { return _addressed; }
+
+    /**
+     * @brief Assigned address in the table of the mapping type
+     */
+    uint16_t address() const { return _baseAddress; }
+
+    /**
+     * @brief Assigned holding register address for extended data
+     */
+    uint16_t auxAddress() const { return _auxAddress; }
+
+    /**
+     * @brief Poll group used by the address planner
+     */
+    uint8_t pollGroup() const { return _pollGroup; }
+
+    /**
+     * @brief Current value of the item in the server tables (process image)
+     * @param server Reference to the Modbus TCP server
+     */
+    uint16_t imageValue(ModbusTCPServer& server) const {
+        switch (type()) {
+            case ModbusType::Coil:            return server.coilRead(MODBUS_COIL_OFFSET + _baseAddress);
+            case ModbusType::DiscreteInput:   return server.discreteInputRead(MODBUS_DISCRETE_OFFSET + _baseAddress);
+            case ModbusType::HoldingRegister: return server.holdingRegisterRead(MODBUS_HOLDING_OFFSET + _baseAddress);
+            case ModbusType::InputRegister:   return server.inputRegisterRead(MODBUS_INPUT_OFFSET + _baseAddress);
+            default:                          return 0;
         }
     }
 
+    /**
+     * @brief Current extended-data holding register in the server tables (0 if none)
+     * @param server Reference to the Modbus TCP server
+     */
+    uint16_t auxImageValue(ModbusTCPServer& server) const {
+        if (!hasExtendedData()) return 0;
+        return server.holdingRegisterRead(MODBUS_HOLDING_OFFSET + _auxAddress);
+    }
+
+    /**
+     * @brief Change sequence number of the last value change (0 = never changed)
+     */
+    uint32_t changeSequence() const { return _changeSeq; }
+
     /**
      * @brief Synchronize device state to the Modbus server
      * @param server Reference to the Modbus TCP server
      */
     void updateToModbus(ModbusTCPServer& server) {
-        if (!_device) return;
-
-        switch (_device->getType()) {
-            case ModbusType::Coil: {
-                bool state = _device->getCoilValue();
-                if (state != static_cast<bool>(_lastValue)) {
-                    server.coilWrite(_baseAddress + MODBUS_COIL_OFFSET, state);
-                    _lastValue = state;
-                    #ifdef IDEBUG_RELAY
-                    Serial.print("Coil UpdateToModbus: Address ");
-                    Serial.print(_baseAddress + MODBUS_COIL_OFFSET);
-                    Serial.print(", State ");
-                    Serial.println(state);
-                    #endif
-                }
-
-                // Always export extended relay data
-                uint16_t tmp = _device->getHoldingValue();
-                if (tmp != _lastValue2) {
-                    _lastValue2 = tmp;
-                    server.holdingRegisterWrite(_baseAddress + MODBUS_HOLDING_OFFSET, tmp);
-                    #ifdef IDEBUG_RELAY
-                    Serial.print("Holding UpdateToModbus: Value ");
-                    Serial.println(tmp);
-                    #endif
-                }
-                break;
-            }
-
-            case ModbusType::DiscreteInput: {
-                bool state = _device->getDiscreteValue();
-                if (state != static_cast<bool>(_lastValue)) {
-                    server.discreteInputWrite(_baseAddress  + MODBUS_DISCRETE_OFFSET, state);
-                    _lastValue = state;
-                    #ifdef IDEBUG_INPUT
-                    Serial.print("DiscreteInput UpdateToModbus: Address ");
-                    Serial.print(_baseAddress + MODBUS_DISCRETE_OFFSET);
-                    Serial.print(", Value ");
-                    Serial.println(state);
-                    #endif
-                }
-                break;
-            }
-
-            case ModbusType::HoldingRegister: {
-                uint16_t state = _device->getHoldingValue();
-                if (state != _lastValue) {
-                    server.holdingRegisterWrite(_baseAddress + MODBUS_HOLDING_OFFSET, state);
-                    _lastValue = state;
-                    #ifdef IDEBUG_VARIABLE
-                    Serial.print("Holding UpdateToModbus: Address ");
-                    Serial.print(_baseAddress + MODBUS_HOLDING_OFFSET);
-                    Serial.print(", Value ");
-                    Serial.println(state);
-                    #endif
-                }
-                break;
-            }
-
-            case ModbusType::InputRegister: {
-                uint16_t state = _device->getInputValue();
-                if (state != _lastValue) {
-                    server.inputRegisterWrite(_baseAddress + MODBUS_INPUT_OFFSET, state);
-                    _lastValue = state;
-                    #ifdef IDEBUG_INPUT
-                    Serial.print("InputRegister UpdateToModbus: Address ");
-                    Serial.print(_baseAddress + MODBUS_INPUT_OFFSET);
-                    Serial.print(", Value ");
-                    Serial.println(state);
-                    #endif
-                }
-                break;
-            }
-
-            default:
-                break;
-        }
+        if (_toModbus) (this->*_toModbus)(server);
     }
 
     /**
@@ -240,4 +343,159 @@ public:
         updateFromModbus(server); // Modbus client → device
         updateToModbus(server);   // Device → Modbus client
     }
-};
\ No newline at end of file
+};
+
+// -----------------------------------------------------------------------------
+// Per-type synchronization
+// -----------------------------------------------------------------------------
+
+template<>
+inline void ModbusItem::syncFrom<ModbusType::Coil>(ModbusTCPServer& server) {
+    bool val = server.coilRead(_baseAddress + MODBUS_COIL_OFFSET);
+    if (val != static_cast<bool>(_lastValue)) {
+        _device->setFromCoil(val);
+        _lastValue = val;
+        markChanged();
+        #ifdef IDEBUG_RELAY
+        Serial.print("Coil UpdateFromModbus: Address ");
+        Serial.print(_baseAddress + MODBUS_COIL_OFFSET);
+        Serial.print(", Value ");
+        Serial.println(val);
+        #endif
+    }
+}
+
+template<>
+inline void ModbusItem::syncFrom<ModbusType::HoldingRegister>(ModbusTCPServer& server) {
+    uint16_t val = server.holdingRegisterRead(_baseAddress + MODBUS_HOLDING_OFFSET);
+    if (val != _lastValue) {
+        _device->setFromHolding(val);
+        _lastValue = val;
+        markChanged();
+        #ifdef IDEBUG_VARIABLE
+        Serial.print("Holding UpdateFromModbus: Address ");
+        Serial.print(_baseAddress);
+        Serial.print(", Value ");
+        Serial.println(val);
+        #endif
+    }
+}
+
+template<>
+inline void ModbusItem::syncTo<ModbusType::Coil>(ModbusTCPServer& server) {
+    bool state = _device->getCoilValue();
+    if (state != static_cast<bool>(_lastValue)) {
+        server.coilWrite(_baseAddress + MODBUS_COIL_OFFSET, state);
+        _lastValue = state;
+        markChanged();
+        #ifdef IDEBUG_RELAY
+        Serial.print("Coil UpdateToModbus: Address ");
+        Serial.print(_baseAddress + MODBUS_COIL_OFFSET);
+        Serial.print(", State ");
+        Serial.println(state);
+        #endif
+    }
+}
+
+template<>
+inline void ModbusItem::syncTo<ModbusType::DiscreteInput>(ModbusTCPServer& server) {
+    bool state = _device->getDiscreteValue();
+    if (state != static_cast<bool>(_lastValue)) {
+        server.discreteInputWrite(_baseAddress  + MODBUS_DISCRETE_OFFSET, state);
+        _lastValue = state;
+        markChanged();
+        #ifdef IDEBUG_INPUT
+        Serial.print("DiscreteInput UpdateToModbus: Address ");
+        Serial.print(_baseAddress + MODBUS_DISCRETE_OFFSET);
+        Serial.print(", Value ");
+        Serial.println(state);
+        #endif
+    }
+}
+
+template<>
+inline void ModbusItem::syncTo<ModbusType::HoldingRegister>(ModbusTCPServer& server) {
+    uint16_t state = _device->getHoldingValue();
+    if (state != _lastValue) {
+        server.holdingRegisterWrite(_baseAddress + MODBUS_HOLDING_OFFSET, state);
+        _lastValue = state;
+        markChanged();
+        #ifdef IDEBUG_VARIABLE
+        Serial.print("Holding UpdateToModbus: Address ");
+        Serial.print(_baseAddress + MODBUS_HOLDING_OFFSET);
+        Serial.print(", Value ");
+        Serial.println(state);
+        #endif
+    }
+}
+
+template<>
+inline void ModbusItem::syncTo<ModbusType::InputRegister>(ModbusTCPServer& server) {
+    uint16_t state = _device->getInputValue();
+    if (state != _lastValue) {
+        server.inputRegisterWrite(_baseAddress + MODBUS_INPUT_OFFSET, state);
+        _lastValue = state;
+        markChanged();
+        #ifdef IDEBUG_INPUT
+        Serial.print("InputRegister UpdateToModbus: Address ");
+        Serial.print(_baseAddress + MODBUS_INPUT_OFFSET);
+        Serial.print(", Value ");
+        Serial.println(state);
+        #endif
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Binding
+// -----------------------------------------------------------------------------
+
+inline void ModbusItem::bind() {
+    _fromModbus = nullptr;
+    _toModbus = nullptr;
+    if (!_device) return;
+
+    const bool ext = _device->hasExtendedData();
+
+    switch (_device->getType()) {
+        case ModbusType::Coil:
+            _fromModbus = ext ? &ModbusItem::syncFromExtended<ModbusType::Coil>
+                              : &ModbusItem::syncFrom<ModbusType::Coil>;
+            _toModbus   = ext ? &ModbusItem::syncToExtended<ModbusType::Coil>
+                              : &ModbusItem::syncTo<ModbusType::Coil>;
+            break;
+
+        case ModbusType::DiscreteInput:
+            _toModbus = &ModbusItem::syncTo<ModbusType::DiscreteInput>;
+            break;
+
+        case ModbusType::HoldingRegister:
+            _fromModbus = &ModbusItem::syncFrom<ModbusType::HoldingRegister>;
+            _toModbus   = &ModbusItem::syncTo<ModbusType::HoldingRegister>;
+            break;
+
+        case ModbusType::InputRegister:
+            _toModbus = &ModbusItem::syncTo<ModbusType::InputRegister>;
+            break;
+
+        default:
+            break;
+    }
+}
+
+template<ModbusType T, bool Extended>
+constexpr ModbusItem ModbusItem::of(IODevice* device, uint16_t base, uint16_t aux,
+                                    WriteGroup* group, uint8_t pollGroup) {
+    constexpr bool writable = T == ModbusType::Coil || T == ModbusType::HoldingRegister;
+
+    ModbusItem item(device, group, pollGroup);
+    item._baseAddress = base;
+    item._auxAddress = aux;
+    item._fromModbus = !writable ? nullptr
+                     : Extended  ? &ModbusItem::syncFromExtended<T>
+                                 : &ModbusItem::syncFrom<T>;
+    item._toModbus   = Extended  ? &ModbusItem::syncToExtended<T>
+                                 : &ModbusItem::syncTo<T>;
+    item._bound = true;
+    item._addressed = true;
+    return item;
+}
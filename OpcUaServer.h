@@ -0,0 +1,1310 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: OpcUaServer.h
+ * Description:
+ * Minimal OPC UA server (binary TCP, SecurityPolicy None) exposing the
+ * Modbus items as variable nodes with monitored-item subscriptions.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <time.h>
+#include "config.h"
+#include "ModbusItem.h"
+#include "ChangeTracker.h"
+#include <ArduinoModbus.h>
+#include <Ethernet.h>
+
+/**
+ * @brief OPC UA server counters
+ */
+struct OpcUaStats {
+    uint32_t connections = 0;    ///< Accepted connections
+    uint32_t messages = 0;       ///< Service requests processed
+    uint32_t faults = 0;         ///< Service faults returned
+    uint32_t publishes = 0;      ///< Publish responses with data changes
+    uint32_t keepAlives = 0;     ///< Publish responses without data
+    uint32_t notifications = 0;  ///< Item values sent in publish responses
+    uint32_t updateUs = 0;       ///< Duration of the last update()
+    uint32_t updateUsMax = 0;    ///< Longest update()
+};
+
+
+/**
+ * @class UaWriter
+ * @brief OPC UA binary encoder into a fixed buffer (little-endian).
+ */
+class UaWriter {
+private:
+    uint8_t* _buf;
+    size_t   _size;
+    size_t   _pos = 0;
+    bool     _overflow = false;
+
+public:
+    UaWriter(uint8_t* buf, size_t size) : _buf(buf), _size(size) {}
+
+    void reset() { _pos = 0; _overflow = false; }
+    size_t pos() const { return _pos; }
+    bool overflow() const { return _overflow; }
+    const uint8_t* data() const { return _buf; }
+
+    void bytes(const void* data, size_t len) {
+        if (_overflow || _pos + len > _size) { _overflow = true; return; }
+        memcpy(&_buf[_pos], data, len);
+        _pos += len;
+    }
+    void u8(uint8_t v) { bytes(&v, 1); }
+    void boolean(bool v) { u8(v ? 1 : 0); }
+    void u16(uint16_t v) { uint8_t b[2] = { uint8_t(v), uint8_t(v >> 8) }; bytes(b, 2); }
+    void u32(uint32_t v) { uint8_t b[4] = { uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24) }; bytes(b, 4); }
+    void i32(int32_t v) { u32(static_cast<uint32_t>(v)); }
+    void u64(uint64_t v) { u32(static_cast<uint32_t>(v)); u32(static_cast<uint32_t>(v >> 32)); }
+    void i64(int64_t v) { u64(static_cast<uint64_t>(v)); }
+    void f64(double v) { uint64_t b; memcpy(&b, &v, 8); u64(b); }
+
+    void patchU32(size_t at, uint32_t v) {
+        if (at + 4 > _pos) return;
+        for (size_t i = 0; i < 4; ++i) _buf[at + i] = uint8_t(v >> (8 * i));
+    }
+
+    /** @brief String; nullptr encodes the null string */
+    void string(const char* s) {
+        if (!s) { i32(-1); return; }
+        size_t n = strlen(s);
+        i32(n);
+        bytes(s, n);
+    }
+
+    /** @brief ByteString; len < 0 encodes null */
+    void byteString(const uint8_t* data, int32_t len) {
+        i32(len);
+        if (len > 0) bytes(data, len);
+    }
+
+    /** @brief Numeric NodeId in the most compact form */
+    void nodeId(uint16_t ns, uint32_t id) {
+        if (ns == 0 && id <= 0xFF) { u8(0x00); u8(id); }
+        else if (ns <= 0xFF && id <= 0xFFFF) { u8(0x01); u8(ns); u16(id); }
+        else { u8(0x02); u16(ns); u32(id); }
+    }
+
+    void qualifiedName(uint16_t ns, const char* name) { u16(ns); string(name); }
+    void localizedText(const char* text) { u8(0x02); string(text); }
+    void emptyExtensionObject() { nodeId(0, 0); u8(0x00); }
+};
+
+
+/**
+ * @class UaReader
+ * @brief OPC UA binary decoder with bounds checking.
+ *
+ * Reads past the end set error() and return zero values.
+ */
+class UaReader {
+private:
+    const uint8_t* _buf;
+    size_t         _len;
+    size_t         _pos = 0;
+    bool           _error = false;
+
+    bool need(size_t n) {
+        if (_error || _pos + n > _len) { _error = true; return false; }
+        return true;
+    }
+
+public:
+    UaReader(const uint8_t* buf, size_t len) : _buf(buf), _len(len) {}
+
+    bool error() const { return _error; }
+    size_t remaining() const { return _error ? 0 : _len - _pos; }
+    const uint8_t* current() const { return &_buf[_pos]; }
+
+    void skip(size_t n) { if (need(n)) _pos += n; }
+    uint8_t u8() { return need(1) ? _buf[_pos++] : 0; }
+    bool boolean() { return u8() != 0; }
+    uint16_t u16() {
+        if (!need(2)) return 0;
+        uint16_t v = _buf[_pos] | (_buf[_pos + 1] << 8);
+        _pos += 2;
+        return v;
+    }
+    uint32_t u32() {
+        if (!need(4)) return 0;
+        uint32_t v = 0;
+        for (size_t i = 0; i < 4; ++i) v |= static_cast<uint32_t>(_buf[_pos + i]) << (8 * i);
+        _pos += 4;
+        return v;
+    }
+    int32_t i32() { return static_cast<int32_t>(u32()); }
+    uint64_t u64() { uint64_t lo = u32(); return lo | (static_cast<uint64_t>(u32()) << 32); }
+    double f64() { uint64_t b = u64(); double v; memcpy(&v, &b, 8); return v; }
+
+    /** @brief Array length; negative (null) arrays read as 0 */
+    size_t arrayLength() {
+        int32_t n = i32();
+        if (n < 0) return 0;
+        if (static_cast<size_t>(n) > remaining()) { _error = true; return 0; }
+        return n;
+    }
+
+    /** @brief Skip a String or ByteString */
+    void skipString() {
+        int32_t n = i32();
+        if (n > 0) skip(n);
+    }
+
+    /**
+     * @brief Read a NodeId; non-numeric ids read as ns 0xFFFF, id 0xFFFFFFFF
+     * @param flags Encoding flags of an ExpandedNodeId are returned here
+     */
+    void nodeId(uint16_t& ns, uint32_t& id, uint8_t* flags = nullptr) {
+        uint8_t enc = u8();
+        if (flags) *flags = enc & 0xC0;
+        ns = 0xFFFF;
+        id = 0xFFFFFFFF;
+        switch (enc & 0x3F) {
+            case 0x00: ns = 0; id = u8(); break;
+            case 0x01: ns = u8(); id = u16(); break;
+            case 0x02: ns = u16(); id = u32(); break;
+            case 0x03: case 0x05: u16(); skipString(); break;
+            case 0x04: u16(); skip(16); break;
+            default: _error = true; break;
+        }
+    }
+
+    void skipNodeId() { uint16_t ns; uint32_t id; nodeId(ns, id); }
+
+    void skipExpandedNodeId() {
+        uint16_t ns; uint32_t id; uint8_t flags;
+        nodeId(ns, id, &flags);
+        if (flags & 0x80) skipString();
+        if (flags & 0x40) u32();
+    }
+
+    void skipQualifiedName() { u16(); skipString(); }
+
+    void skipLocalizedText() {
+        uint8_t mask = u8();
+        if (mask & 0x01) skipString();
+        if (mask & 0x02) skipString();
+    }
+
+    void skipExtensionObject() {
+        skipNodeId();
+        if (u8() != 0) skipString();
+    }
+};
+
+
+/**
+ * @class OpcUaServer
+ * @brief OPC UA nano/micro-profile server over opc.tcp.
+ *
+ * @details
+ *   Supports one connection with one secure channel (SecurityPolicy None,
+ *   single-chunk messages) and one anonymous session. Services:
+ *   GetEndpoints, FindServers, CreateSession, ActivateSession, CloseSession,
+ *   Browse, BrowseNext, Read, CreateSubscription, ModifySubscription,
+ *   SetPublishingMode, DeleteSubscriptions, CreateMonitoredItems,
+ *   DeleteMonitoredItems and Publish; others return BadServiceUnsupported.
+ *
+ *   Address space: Objects (ns=0;i=85) organizes one variable per item,
+ *   ns=1;i=<index + 1>, named "Item<index>". Coils and discrete inputs are
+ *   Boolean, registers UInt16; values are read from the server tables. The
+ *   namespace array, current time and server state nodes are readable.
+ *
+ *   Monitored items are marked from the item change sequence (queue size 1,
+ *   latest value wins) and sent when the subscription's publishing interval
+ *   expires and a Publish request is queued; otherwise keep-alives are sent.
+ *
+ *   Memory is fixed: two buffers of MODBUS_OPCUA_BUFFER bytes plus the
+ *   subscription, monitored-item and publish-request tables (memoryUsage()).
+ *   Per cycle at most one request is processed and one publish response
+ *   sent; the cost of update() is tracked in stats().
+ */
+class OpcUaServer {
+private:
+    static constexpr uint32_t STATUS_GOOD                       = 0x00000000;
+    static constexpr uint32_t BAD_DECODING_ERROR                = 0x80070000;
+    static constexpr uint32_t BAD_SERVICE_UNSUPPORTED           = 0x800B0000;
+    static constexpr uint32_t BAD_NOTHING_TO_DO                 = 0x800F0000;
+    static constexpr uint32_t BAD_TOO_MANY_OPERATIONS           = 0x80100000;
+    static constexpr uint32_t BAD_SECURE_CHANNEL_ID_INVALID     = 0x80220000;
+    static constexpr uint32_t BAD_SESSION_ID_INVALID            = 0x80250000;
+    static constexpr uint32_t BAD_SESSION_NOT_ACTIVATED         = 0x80270000;
+    static constexpr uint32_t BAD_SUBSCRIPTION_ID_INVALID       = 0x80280000;
+    static constexpr uint32_t BAD_NODE_ID_UNKNOWN               = 0x80340000;
+    static constexpr uint32_t BAD_ATTRIBUTE_ID_INVALID          = 0x80350000;
+    static constexpr uint32_t BAD_MONITORED_ITEM_ID_INVALID     = 0x80420000;
+    static constexpr uint32_t BAD_CONTINUATION_POINT_INVALID    = 0x804A0000;
+    static constexpr uint32_t BAD_SECURITY_POLICY_REJECTED      = 0x80550000;
+    static constexpr uint32_t BAD_TOO_MANY_SUBSCRIPTIONS        = 0x80770000;
+    static constexpr uint32_t BAD_TOO_MANY_PUBLISH_REQUESTS     = 0x80780000;
+    static constexpr uint32_t BAD_NO_SUBSCRIPTION               = 0x80790000;
+    static constexpr uint32_t BAD_TCP_MESSAGE_TYPE_INVALID      = 0x807E0000;
+    static constexpr uint32_t BAD_TCP_MESSAGE_TOO_LARGE         = 0x80800000;
+    static constexpr uint32_t BAD_RESPONSE_TOO_LARGE            = 0x80B90000;
+    static constexpr uint32_t BAD_TOO_MANY_MONITORED_ITEMS      = 0x80DB0000;
+
+    // Binary encoding ids of the services (request, response = request + 3)
+    static constexpr uint32_t SERVICE_FAULT           = 397;
+    static constexpr uint32_t FIND_SERVERS            = 422;
+    static constexpr uint32_t GET_ENDPOINTS           = 428;
+    static constexpr uint32_t OPEN_SECURE_CHANNEL     = 446;
+    static constexpr uint32_t CREATE_SESSION          = 461;
+    static constexpr uint32_t ACTIVATE_SESSION        = 467;
+    static constexpr uint32_t CLOSE_SESSION           = 473;
+    static constexpr uint32_t BROWSE                  = 527;
+    static constexpr uint32_t BROWSE_NEXT             = 533;
+    static constexpr uint32_t READ                    = 631;
+    static constexpr uint32_t CREATE_MONITORED_ITEMS  = 751;
+    static constexpr uint32_t DELETE_MONITORED_ITEMS  = 781;
+    static constexpr uint32_t CREATE_SUBSCRIPTION     = 787;
+    static constexpr uint32_t MODIFY_SUBSCRIPTION     = 793;
+    static constexpr uint32_t SET_PUBLISHING_MODE     = 799;
+    static constexpr uint32_t DATA_CHANGE_NOTIFICATION = 811;
+    static constexpr uint32_t PUBLISH                 = 826;
+    static constexpr uint32_t DELETE_SUBSCRIPTIONS    = 847;
+
+    static constexpr uint32_t ATTR_NODE_ID       = 1;
+    static constexpr uint32_t ATTR_NODE_CLASS    = 2;
+    static constexpr uint32_t ATTR_BROWSE_NAME   = 3;
+    static constexpr uint32_t ATTR_DISPLAY_NAME  = 4;
+    static constexpr uint32_t ATTR_WRITE_MASK    = 6;
+    static constexpr uint32_t ATTR_USER_WRITE_MASK = 7;
+    static constexpr uint32_t ATTR_EVENT_NOTIFIER = 12;
+    static constexpr uint32_t ATTR_VALUE         = 13;
+    static constexpr uint32_t ATTR_DATA_TYPE     = 14;
+    static constexpr uint32_t ATTR_VALUE_RANK    = 15;
+    static constexpr uint32_t ATTR_ACCESS_LEVEL  = 17;
+    static constexpr uint32_t ATTR_USER_ACCESS_LEVEL = 18;
+    static constexpr uint32_t ATTR_MIN_SAMPLING  = 19;
+    static constexpr uint32_t ATTR_HISTORIZING   = 20;
+
+    static constexpr size_t MAX_REFERENCES = 100;   ///< References per Browse result
+
+    static constexpr const char* POLICY_NONE = "http://opcfoundation.org/UA/SecurityPolicy#None";
+    static constexpr const char* TRANSPORT_PROFILE = "http://opcfoundation.org/UA-Profile/Transport/uatcp-uasc-uabinary";
+
+    enum class NodeKind { Unknown, Root, Objects, NamespaceArray, CurrentTime, ServerState, Item };
+
+    struct Subscription {
+        uint32_t      id = 0;                 ///< 0 = slot free
+        uint32_t      intervalMs = 0;         ///< Publishing interval
+        uint32_t      keepAliveCount = 0;     ///< Intervals between keep-alives
+        uint32_t      lifetimeCount = 0;      ///< Intervals without Publish request before deletion
+        uint32_t      maxNotifications = 0;   ///< Per publish; 0 = server limit
+        uint32_t      sequence = 1;           ///< Next notification sequence number
+        uint32_t      idleIntervals = 0;      ///< Intervals since the last response
+        uint32_t      starvedIntervals = 0;   ///< Intervals without a queued Publish request
+        unsigned long lastTick = 0;           ///< millis() of the last interval
+        bool          enabled = true;         ///< Publishing enabled
+    };
+
+    struct MonitoredItem {
+        uint32_t id = 0;             ///< 0 = slot free
+        uint32_t subscription = 0;   ///< Owning subscription id
+        uint32_t clientHandle = 0;   ///< Handle echoed in notifications
+        uint16_t item = 0;           ///< Item index
+        bool     dirty = false;      ///< Value to be sent
+    };
+
+    struct PublishRequest {
+        uint32_t requestId;
+        uint32_t requestHandle;
+        uint32_t acks;               ///< Acknowledgements to answer
+    };
+
+    struct RequestHeader {
+        uint16_t tokenNs = 0;
+        uint32_t token = 0;
+        uint32_t handle = 0;
+    };
+
+    EthernetServer   _listener;                 ///< opc.tcp port
+    EthernetClient   _client;                   ///< The connection
+    ModbusTCPServer& _server;                   ///< Source of the values
+    ModbusItem*&     _items;                    ///< Mapped items
+    size_t&          _numItems;                 ///< Number of items
+    ChangeTracker&   _changes;                  ///< Change sequence
+    uint32_t         _seenSeq = 0;              ///< Sequence up to which items are marked
+
+    uint8_t          _rx[MODBUS_OPCUA_BUFFER];  ///< Incoming message
+    size_t           _rxLen = 0;                ///< Bytes in _rx
+    uint8_t          _tx[MODBUS_OPCUA_BUFFER];  ///< Outgoing message
+    size_t           _sendLimit = MODBUS_OPCUA_BUFFER; ///< Client receive buffer size
+    char             _endpointUrl[96] = "";     ///< Endpoint URL from Hello
+
+    bool             _hello = false;            ///< Hello/Acknowledge done
+    uint32_t         _channelId = 0;            ///< Secure channel id (0 = not open)
+    uint32_t         _tokenId = 0;              ///< Security token id
+    uint32_t         _nextChannelId = 1;
+    uint32_t         _sendSeq = 1;              ///< Next outgoing sequence number
+
+    uint32_t         _sessionToken = 0;         ///< ns=1 authentication token (0 = no session)
+    uint32_t         _sessionCount = 0;
+    bool             _activated = false;        ///< Session activated
+    unsigned long    _lastRequest = 0;          ///< millis() of the last session request
+
+    Subscription     _subs[MODBUS_OPCUA_SUBSCRIPTIONS];
+    MonitoredItem    _monitored[MODBUS_OPCUA_MONITORED_ITEMS];
+    PublishRequest   _publishQueue[MODBUS_OPCUA_PUBLISH_QUEUE];
+    size_t           _publishCount = 0;
+    uint32_t         _nextId = 1;               ///< Subscription/monitored item ids
+
+    OpcUaStats       _stats;
+
+    // ---------------------------------------------------------------------
+    // Helpers
+    // ---------------------------------------------------------------------
+
+    /** @brief Current time as OPC UA DateTime (100 ns since 1601) */
+    static int64_t now() {
+        return (static_cast<int64_t>(time(nullptr)) + 11644473600LL) * 10000000LL;
+    }
+
+    NodeKind resolve(uint16_t ns, uint32_t id, size_t& item) const {
+        if (ns == 0) {
+            switch (id) {
+                case 84:   return NodeKind::Root;
+                case 85:   return NodeKind::Objects;
+                case 2255: return NodeKind::NamespaceArray;
+                case 2258: return NodeKind::CurrentTime;
+                case 2259: return NodeKind::ServerState;
+                default:   return NodeKind::Unknown;
+            }
+        }
+        if (ns == 1 && id >= 1 && id <= _numItems) {
+            item = id - 1;
+            return NodeKind::Item;
+        }
+        return NodeKind::Unknown;
+    }
+
+    static const char* nodeName(NodeKind kind, size_t item, char* buf, size_t size) {
+        switch (kind) {
+            case NodeKind::Root:           return "Root";
+            case NodeKind::Objects:        return "Objects";
+            case NodeKind::NamespaceArray: return "NamespaceArray";
+            case NodeKind::CurrentTime:    return "CurrentTime";
+            case NodeKind::ServerState:    return "State";
+            default:
+                snprintf(buf, size, "Item%u", static_cast<unsigned>(item));
+                return buf;
+        }
+    }
+
+    bool isBoolean(size_t item) const {
+        ModbusType t = _items[item].type();
+        return t == ModbusType::Coil || t == ModbusType::DiscreteInput;
+    }
+
+    /** @brief DataValue with the item's current value and source timestamp */
+    void itemValue(UaWriter& w, size_t item) {
+        w.u8(0x05);
+        uint16_t v = _items[item].imageValue(_server);
+        if (isBoolean(item)) { w.u8(1); w.boolean(v != 0); }
+        else { w.u8(5); w.u16(v); }
+        w.i64(now());
+    }
+
+    static void statusValue(UaWriter& w, uint32_t status) { w.u8(0x02); w.u32(status); }
+
+    /** @brief DataValue of one attribute */
+    void readAttribute(UaWriter& w, uint16_t ns, uint32_t id, uint32_t attr) {
+        size_t item = 0;
+        NodeKind kind = resolve(ns, id, item);
+        if (kind == NodeKind::Unknown) { statusValue(w, BAD_NODE_ID_UNKNOWN); return; }
+
+        const bool object = kind == NodeKind::Root || kind == NodeKind::Objects;
+        char name[16];
+
+        switch (attr) {
+            case ATTR_NODE_ID:      w.u8(0x01); w.u8(17); w.nodeId(ns, id); return;
+            case ATTR_NODE_CLASS:   w.u8(0x01); w.u8(6); w.i32(object ? 1 : 2); return;
+            case ATTR_BROWSE_NAME:  w.u8(0x01); w.u8(20); w.qualifiedName(ns, nodeName(kind, item, name, sizeof(name))); return;
+            case ATTR_DISPLAY_NAME: w.u8(0x01); w.u8(21); w.localizedText(nodeName(kind, item, name, sizeof(name))); return;
+            case ATTR_WRITE_MASK:
+            case ATTR_USER_WRITE_MASK: w.u8(0x01); w.u8(7); w.u32(0); return;
+            default: break;
+        }
+
+        if (object) {
+            if (attr == ATTR_EVENT_NOTIFIER) { w.u8(0x01); w.u8(3); w.u8(0); return; }
+            statusValue(w, BAD_ATTRIBUTE_ID_INVALID);
+            return;
+        }
+
+        switch (attr) {
+            case ATTR_VALUE:
+                switch (kind) {
+                    case NodeKind::Item:           itemValue(w, item); break;
+                    case NodeKind::CurrentTime:    w.u8(0x01); w.u8(13); w.i64(now()); break;
+                    case NodeKind::ServerState:    w.u8(0x01); w.u8(6); w.i32(0); break;   // Running
+                    default:
+                        w.u8(0x01); w.u8(12 | 0x80); w.i32(2);
+                        w.string("http://opcfoundation.org/UA/");
+                        w.string(MODBUS_OPCUA_APPLICATION_URI);
+                        break;
+                }
+                return;
+            case ATTR_DATA_TYPE: {
+                uint32_t type = 12;                                  // String
+                if (kind == NodeKind::Item) type = isBoolean(item) ? 1 : 5;
+                else if (kind == NodeKind::CurrentTime) type = 294;  // UtcTime
+                else if (kind == NodeKind::ServerState) type = 852;  // ServerState
+                w.u8(0x01); w.u8(17); w.nodeId(0, type);
+                return;
+            }
+            case ATTR_VALUE_RANK:   w.u8(0x01); w.u8(6); w.i32(kind == NodeKind::NamespaceArray ? 1 : -1); return;
+            case ATTR_ACCESS_LEVEL:
+            case ATTR_USER_ACCESS_LEVEL: w.u8(0x01); w.u8(3); w.u8(0x01); return;   // CurrentRead
+            case ATTR_MIN_SAMPLING: w.u8(0x01); w.u8(11); w.f64(MODBUS_OPCUA_MIN_INTERVAL); return;
+            case ATTR_HISTORIZING:  w.u8(0x01); w.u8(1); w.boolean(false); return;
+            default:                statusValue(w, BAD_ATTRIBUTE_ID_INVALID); return;
+        }
+    }
+
+    void applicationDescription(UaWriter& w) {
+        w.string(MODBUS_OPCUA_APPLICATION_URI);
+        w.string(MODBUS_OPCUA_APPLICATION_URI);
+        w.localizedText(HOSTNAME);
+        w.u32(0);                       // Server
+        w.string(nullptr);
+        w.string(nullptr);
+        w.i32(1);
+        w.string(_endpointUrl);
+    }
+
+    void endpointDescription(UaWriter& w) {
+        w.string(_endpointUrl);
+        applicationDescription(w);
+        w.byteString(nullptr, -1);
+        w.u32(1);                       // MessageSecurityMode None
+        w.string(POLICY_NONE);
+        w.i32(1);                       // UserTokenPolicy: anonymous
+        w.string("anonymous");
+        w.u32(0);
+        w.string(nullptr);
+        w.string(nullptr);
+        w.string(nullptr);
+        w.string(TRANSPORT_PROFILE);
+        w.u8(0);                        // Security level
+    }
+
+    // ---------------------------------------------------------------------
+    // Message framing
+    // ---------------------------------------------------------------------
+
+    void beginMessage(UaWriter& w, const char* type, uint32_t requestId) {
+        w.reset();
+        w.bytes(type, 3);
+        w.u8('F');
+        w.u32(0);                       // size, patched by transmit()
+        w.u32(_channelId);
+        if (type[0] == 'O') {
+            w.string(POLICY_NONE);
+            w.byteString(nullptr, -1);
+            w.byteString(nullptr, -1);
+        } else {
+            w.u32(_tokenId);
+        }
+        w.u32(_sendSeq);
+        w.u32(requestId);
+    }
+
+    /** @brief Message header, response type and ResponseHeader */
+    void respond(UaWriter& w, uint32_t requestId, uint32_t type, uint32_t handle, uint32_t status = STATUS_GOOD) {
+        beginMessage(w, "MSG", requestId);
+        w.nodeId(0, type);
+        w.i64(now());
+        w.u32(handle);
+        w.u32(status);
+        w.u8(0);                        // serviceDiagnostics
+        w.i32(0);                       // stringTable
+        w.emptyExtensionObject();
+    }
+
+    void fault(UaWriter& w, uint32_t requestId, uint32_t handle, uint32_t status) {
+        respond(w, requestId, SERVICE_FAULT, handle, status);
+        ++_stats.faults;
+    }
+
+    void transmit(UaWriter& w) {
+        w.patchU32(4, w.pos());
+        _client.write(w.data(), w.pos());
+        ++_sendSeq;
+    }
+
+    void sendError(uint32_t code, const char* reason) {
+        UaWriter w(_tx, sizeof(_tx));
+        w.bytes("ERRF", 4);
+        w.u32(0);
+        w.u32(code);
+        w.string(reason);
+        w.patchU32(4, w.pos());
+        _client.write(w.data(), w.pos());
+    }
+
+    // ---------------------------------------------------------------------
+    // Session and subscriptions
+    // ---------------------------------------------------------------------
+
+    Subscription* findSubscription(uint32_t id) {
+        for (auto& s : _subs) if (s.id && s.id == id) return &s;
+        return nullptr;
+    }
+
+    void deleteSubscription(Subscription& s) {
+        for (auto& m : _monitored) {
+            if (m.subscription != s.id) continue;
+            m.id = 0;
+            m.subscription = 0;
+        }
+        s.id = 0;
+    }
+
+    void closeSession() {
+        for (auto& s : _subs) if (s.id) deleteSubscription(s);
+        _publishCount = 0;
+        _sessionToken = 0;
+        _activated = false;
+    }
+
+    void disconnect() {
+        _client.stop();
+        closeSession();
+        _hello = false;
+        _channelId = 0;
+        _rxLen = 0;
+    }
+
+    static uint32_t reviseInterval(double requested) {
+        if (!(requested >= MODBUS_OPCUA_MIN_INTERVAL)) return MODBUS_OPCUA_MIN_INTERVAL;
+        if (requested > 3600000.0) return 3600000UL;
+        return static_cast<uint32_t>(requested);
+    }
+
+    static void reviseCounts(Subscription& s, uint32_t lifetime, uint32_t keepAlive) {
+        s.keepAliveCount = keepAlive ? keepAlive : 10;
+        s.lifetimeCount = lifetime >= 3 * s.keepAliveCount ? lifetime : 3 * s.keepAliveCount;
+    }
+
+    // ---------------------------------------------------------------------
+    // Services
+    // ---------------------------------------------------------------------
+
+    void browseReferences(UaWriter& w, NodeKind kind, size_t offset, size_t limit) {
+        if (kind == NodeKind::Root) {
+            w.u32(STATUS_GOOD);
+            w.byteString(nullptr, -1);
+            w.i32(1);
+            w.nodeId(0, 35);                        // Organizes
+            w.boolean(true);
+            w.nodeId(0, 85);
+            w.qualifiedName(0, "Objects");
+            w.localizedText("Objects");
+            w.u32(1);                               // Object
+            w.nodeId(0, 61);                        // FolderType
+            return;
+        }
+        if (kind != NodeKind::Objects) {
+            w.u32(kind == NodeKind::Unknown ? BAD_NODE_ID_UNKNOWN : STATUS_GOOD);
+            w.byteString(nullptr, -1);
+            w.i32(0);
+            return;
+        }
+
+        size_t end = offset + limit < _numItems ? offset + limit : _numItems;
+        w.u32(STATUS_GOOD);
+        if (end < _numItems) {
+            uint8_t cp[4] = { uint8_t(end), uint8_t(end >> 8), uint8_t(end >> 16), uint8_t(end >> 24) };
+            w.byteString(cp, 4);
+        } else {
+            w.byteString(nullptr, -1);
+        }
+        w.i32(end > offset ? end - offset : 0);
+        char name[16];
+        for (size_t i = offset; i < end; ++i) {
+            nodeName(NodeKind::Item, i, name, sizeof(name));
+            w.nodeId(0, 35);
+            w.boolean(true);
+            w.nodeId(1, i + 1);
+            w.qualifiedName(1, name);
+            w.localizedText(name);
+            w.u32(2);                               // Variable
+            w.nodeId(0, 63);                        // BaseDataVariableType
+        }
+    }
+
+    void browse(UaReader& r, UaWriter& w, uint32_t requestId, const RequestHeader& h) {
+        r.skipNodeId();                             // view
+        r.u64();
+        r.u32();
+        uint32_t maxRefs = r.u32();
+        size_t count = r.arrayLength();
+        if (count > MODBUS_OPCUA_MAX_OPERATIONS) { fault(w, requestId, h.handle, BAD_TOO_MANY_OPERATIONS); return; }
+        size_t limit = (maxRefs == 0 || maxRefs > MAX_REFERENCES) ? MAX_REFERENCES : maxRefs;
+
+        respond(w, requestId, BROWSE + 3, h.handle);
+        w.i32(count);
+        for (size_t n = 0; n < count; ++n) {
+            uint16_t ns; uint32_t id;
+            r.nodeId(ns, id);
+            uint32_t direction = r.u32();
+            r.skipNodeId();                         // referenceTypeId
+            r.boolean();
+            r.u32();                                // nodeClassMask
+            r.u32();                                // resultMask
+            size_t item = 0;
+            NodeKind kind = resolve(ns, id, item);
+            if (direction == 1 && kind != NodeKind::Unknown) kind = NodeKind::Item;   // no inverse references
+            browseReferences(w, kind, 0, limit);
+        }
+        w.i32(0);
+    }
+
+    void browseNext(UaReader& r, UaWriter& w, uint32_t requestId, const RequestHeader& h) {
+        bool release = r.boolean();
+        size_t count = r.arrayLength();
+        if (count > MODBUS_OPCUA_MAX_OPERATIONS) { fault(w, requestId, h.handle, BAD_TOO_MANY_OPERATIONS); return; }
+
+        respond(w, requestId, BROWSE_NEXT + 3, h.handle);
+        w.i32(count);
+        for (size_t n = 0; n < count; ++n) {
+            int32_t len = r.i32();
+            uint32_t offset = 0;
+            if (len == 4) offset = r.u32();
+            else if (len > 0) r.skip(len);
+
+            if (len != 4 || offset == 0 || offset >= _numItems) {
+                w.u32(BAD_CONTINUATION_POINT_INVALID);
+                w.byteString(nullptr, -1);
+                w.i32(0);
+            } else if (release) {
+                w.u32(STATUS_GOOD);
+                w.byteString(nullptr, -1);
+                w.i32(0);
+            } else {
+                browseReferences(w, NodeKind::Objects, offset, MAX_REFERENCES);
+            }
+        }
+        w.i32(0);
+    }
+
+    void read(UaReader& r, UaWriter& w, uint32_t requestId, const RequestHeader& h) {
+        r.f64();                                    // maxAge
+        r.u32();                                    // timestampsToReturn
+        size_t count = r.arrayLength();
+        if (count == 0) { fault(w, requestId, h.handle, BAD_NOTHING_TO_DO); return; }
+        if (count > MODBUS_OPCUA_MAX_OPERATIONS) { fault(w, requestId, h.handle, BAD_TOO_MANY_OPERATIONS); return; }
+
+        respond(w, requestId, READ + 3, h.handle);
+        w.i32(count);
+        for (size_t n = 0; n < count; ++n) {
+            uint16_t ns; uint32_t id;
+            r.nodeId(ns, id);
+            uint32_t attr = r.u32();
+            r.skipString();                         // indexRange
+            r.skipQualifiedName();                  // dataEncoding
+            readAttribute(w, ns, id, attr);
+        }
+        w.i32(0);
+    }
+
+    void createSubscription(UaReader& r, UaWriter& w, uint32_t requestId, const RequestHeader& h) {
+        double interval = r.f64();
+        uint32_t lifetime = r.u32();
+        uint32_t keepAlive = r.u32();
+        uint32_t maxNotifications = r.u32();
+        bool enabled = r.boolean();
+
+        Subscription* s = nullptr;
+        for (auto& slot : _subs) if (!slot.id) { s = &slot; break; }
+        if (!s) { fault(w, requestId, h.handle, BAD_TOO_MANY_SUBSCRIPTIONS); return; }
+
+        *s = Subscription();
+        s->id = _nextId++;
+        s->intervalMs = reviseInterval(interval);
+        reviseCounts(*s, lifetime, keepAlive);
+        s->maxNotifications = maxNotifications;
+        s->enabled = enabled;
+        s->lastTick = millis();
+
+        respond(w, requestId, CREATE_SUBSCRIPTION + 3, h.handle);
+        w.u32(s->id);
+        w.f64(s->intervalMs);
+        w.u32(s->lifetimeCount);
+        w.u32(s->keepAliveCount);
+    }
+
+    void modifySubscription(UaReader& r, UaWriter& w, uint32_t requestId, const RequestHeader& h) {
+        Subscription* s = findSubscription(r.u32());
+        double interval = r.f64();
+        uint32_t lifetime = r.u32();
+        uint32_t keepAlive = r.u32();
+        uint32_t maxNotifications = r.u32();
+        if (!s) { fault(w, requestId, h.handle, BAD_SUBSCRIPTION_ID_INVALID); return; }
+
+        s->intervalMs = reviseInterval(interval);
+        reviseCounts(*s, lifetime, keepAlive);
+        s->maxNotifications = maxNotifications;
+
+        respond(w, requestId, MODIFY_SUBSCRIPTION + 3, h.handle);
+        w.f64(s->intervalMs);
+        w.u32(s->lifetimeCount);
+        w.u32(s->keepAliveCount);
+    }
+
+    void setPublishingMode(UaReader& r, UaWriter& w, uint32_t requestId, const RequestHeader& h) {
+        bool enabled = r.boolean();
+        size_t count = r.arrayLength();
+        respond(w, requestId, SET_PUBLISHING_MODE + 3, h.handle);
+        w.i32(count);
+        for (size_t n = 0; n < count; ++n) {
+            Subscription* s = findSubscription(r.u32());
+            if (s) s->enabled = enabled;
+            w.u32(s ? STATUS_GOOD : BAD_SUBSCRIPTION_ID_INVALID);
+        }
+        w.i32(0);
+    }
+
+    void deleteSubscriptions(UaReader& r, UaWriter& w, uint32_t requestId, const RequestHeader& h) {
+        size_t count = r.arrayLength();
+        respond(w, requestId, DELETE_SUBSCRIPTIONS + 3, h.handle);
+        w.i32(count);
+        for (size_t n = 0; n < count; ++n) {
+            Subscription* s = findSubscription(r.u32());
+            if (s) deleteSubscription(*s);
+            w.u32(s ? STATUS_GOOD : BAD_SUBSCRIPTION_ID_INVALID);
+        }
+        w.i32(0);
+    }
+
+    void createMonitoredItems(UaReader& r, UaWriter& w, uint32_t requestId, const RequestHeader& h) {
+        Subscription* s = findSubscription(r.u32());
+        r.u32();                                    // timestampsToReturn
+        size_t count = r.arrayLength();
+        if (!s) { fault(w, requestId, h.handle, BAD_SUBSCRIPTION_ID_INVALID); return; }
+        if (count > MODBUS_OPCUA_MAX_OPERATIONS) { fault(w, requestId, h.handle, BAD_TOO_MANY_OPERATIONS); return; }
+
+        respond(w, requestId, CREATE_MONITORED_ITEMS + 3, h.handle);
+        w.i32(count);
+        for (size_t n = 0; n < count; ++n) {
+            uint16_t ns; uint32_t id;
+            r.nodeId(ns, id);
+            uint32_t attr = r.u32();
+            r.skipString();
+            r.skipQualifiedName();
+            r.u32();                                // monitoringMode
+            uint32_t clientHandle = r.u32();
+            r.f64();                                // samplingInterval
+            r.skipExtensionObject();                // filter
+            r.u32();                                // queueSize
+            r.boolean();                            // discardOldest
+
+            size_t item = 0;
+            uint32_t status = STATUS_GOOD;
+            MonitoredItem* m = nullptr;
+            if (resolve(ns, id, item) != NodeKind::Item) status = BAD_NODE_ID_UNKNOWN;
+            else if (attr != ATTR_VALUE) status = BAD_ATTRIBUTE_ID_INVALID;
+            else {
+                for (auto& slot : _monitored) if (!slot.id) { m = &slot; break; }
+                if (!m) status = BAD_TOO_MANY_MONITORED_ITEMS;
+            }
+
+            if (m) {
+                m->id = _nextId++;
+                m->subscription = s->id;
+                m->clientHandle = clientHandle;
+                m->item = item;
+                m->dirty = true;                    // initial value
+            }
+
+            w.u32(status);
+            w.u32(m ? m->id : 0);
+            w.f64(MODBUS_OPCUA_MIN_INTERVAL);
+            w.u32(1);                               // queue size: latest value wins
+            w.emptyExtensionObject();
+        }
+        w.i32(0);
+    }
+
+    void deleteMonitoredItems(UaReader& r, UaWriter& w, uint32_t requestId, const RequestHeader& h) {
+        uint32_t subscription = r.u32();
+        size_t count = r.arrayLength();
+        if (!findSubscription(subscription)) { fault(w, requestId, h.handle, BAD_SUBSCRIPTION_ID_INVALID); return; }
+
+        respond(w, requestId, DELETE_MONITORED_ITEMS + 3, h.handle);
+        w.i32(count);
+        for (size_t n = 0; n < count; ++n) {
+            uint32_t id = r.u32();
+            uint32_t status = BAD_MONITORED_ITEM_ID_INVALID;
+            for (auto& m : _monitored) {
+                if (m.id == id && m.subscription == subscription) {
+                    m.id = 0;
+                    m.subscription = 0;
+                    status = STATUS_GOOD;
+                }
+            }
+            w.u32(status);
+        }
+        w.i32(0);
+    }
+
+    /** @return true if a response was written; false if the request was queued */
+    bool publish(UaReader& r, UaWriter& w, uint32_t requestId, const RequestHeader& h) {
+        size_t acks = r.arrayLength();
+        r.skip(acks * 8);
+
+        bool anySubscription = false;
+        for (auto& s : _subs) if (s.id) anySubscription = true;
+        if (!anySubscription) { fault(w, requestId, h.handle, BAD_NO_SUBSCRIPTION); return true; }
+        if (_publishCount >= MODBUS_OPCUA_PUBLISH_QUEUE) { fault(w, requestId, h.handle, BAD_TOO_MANY_PUBLISH_REQUESTS); return true; }
+
+        _publishQueue[_publishCount++] = { requestId, h.handle, static_cast<uint32_t>(acks) };
+        for (auto& s : _subs) s.starvedIntervals = 0;
+        return false;
+    }
+
+    /**
+     * @brief Answer the oldest queued Publish request for a subscription
+     * @param keepAlive Send no data, only the next sequence number
+     */
+    void sendPublish(Subscription& s, bool keepAlive) {
+        PublishRequest req = _publishQueue[0];
+        for (size_t i = 1; i < _publishCount; ++i) _publishQueue[i - 1] = _publishQueue[i];
+        --_publishCount;
+
+        UaWriter w(_tx, _sendLimit);
+        respond(w, req.requestId, PUBLISH + 3, req.requestHandle);
+        w.u32(s.id);
+        w.i32(0);                                   // availableSequenceNumbers: no retransmission queue
+        size_t moreAt = w.pos();
+        w.boolean(false);
+        w.u32(s.sequence);
+        w.i64(now());
+
+        if (keepAlive) {
+            w.i32(0);
+            ++_stats.keepAlives;
+        } else {
+            size_t limit = MODBUS_OPCUA_MAX_NOTIFICATIONS;
+            if (s.maxNotifications && s.maxNotifications < limit) limit = s.maxNotifications;
+
+            w.i32(1);
+            w.nodeId(0, DATA_CHANGE_NOTIFICATION);
+            w.u8(0x01);
+            size_t lengthAt = w.pos();
+            w.i32(0);
+            size_t countAt = w.pos();
+            w.i32(0);
+
+            size_t count = 0;
+            bool more = false;
+            for (auto& m : _monitored) {
+                if (!m.id || m.subscription != s.id || !m.dirty) continue;
+                if (count == limit) { more = true; break; }
+                w.u32(m.clientHandle);
+                itemValue(w, m.item);
+                m.dirty = false;
+                ++count;
+            }
+            w.i32(0);                               // diagnosticInfos
+            w.patchU32(lengthAt, w.pos() - countAt);
+            w.patchU32(countAt, count);
+            if (more) _tx[moreAt] = 1;
+
+            ++s.sequence;
+            ++_stats.publishes;
+            _stats.notifications += count;
+        }
+
+        w.i32(req.acks);
+        for (uint32_t i = 0; i < req.acks; ++i) w.u32(STATUS_GOOD);
+        w.i32(0);
+
+        if (w.overflow()) fault(w, req.requestId, req.requestHandle, BAD_RESPONSE_TOO_LARGE);
+        transmit(w);
+        s.idleIntervals = 0;
+    }
+
+    /**
+     * @brief Run the publishing timers; sends at most one response
+     */
+    void publishCycle() {
+        const unsigned long t = millis();
+        bool sent = false;
+
+        for (auto& s : _subs) {
+            if (!s.id || t - s.lastTick < s.intervalMs) continue;
+            s.lastTick = t;
+
+            if (_publishCount == 0) {
+                if (++s.starvedIntervals >= s.lifetimeCount) deleteSubscription(s);
+                continue;
+            }
+
+            bool pending = false;
+            if (s.enabled) {
+                for (const auto& m : _monitored) {
+                    if (m.id && m.subscription == s.id && m.dirty) { pending = true; break; }
+                }
+            }
+
+            ++s.idleIntervals;
+            if (sent) continue;   // next cycle
+            if (pending) { sendPublish(s, false); sent = true; }
+            else if (s.idleIntervals >= s.keepAliveCount) { sendPublish(s, true); sent = true; }
+        }
+    }
+
+    /**
+     * @brief Mark monitored items whose item changed
+     */
+    void markChanges() {
+        const uint32_t seq = _changes.sequence();
+        if (seq == _seenSeq) return;
+        for (auto& m : _monitored) {
+            if (m.id && _items[m.item].changeSequence() > _seenSeq) m.dirty = true;
+        }
+        _seenSeq = seq;
+    }
+
+    // ---------------------------------------------------------------------
+    // Message processing
+    // ---------------------------------------------------------------------
+
+    void hello(UaReader& r) {
+        r.u32();                                    // protocolVersion
+        uint32_t clientReceive = r.u32();
+        r.u32();                                    // sendBufferSize
+        r.u32();                                    // maxMessageSize
+        r.u32();                                    // maxChunkCount
+        int32_t len = r.i32();
+        if (r.error() || len < 0 || static_cast<size_t>(len) > r.remaining()) len = 0;
+        size_t n = static_cast<size_t>(len) < sizeof(_endpointUrl) - 1 ? len : sizeof(_endpointUrl) - 1;
+        memcpy(_endpointUrl, r.current(), n);
+        _endpointUrl[n] = '\0';
+
+        _sendLimit = clientReceive && clientReceive < sizeof(_tx) ? clientReceive : sizeof(_tx);
+        _hello = true;
+
+        UaWriter w(_tx, sizeof(_tx));
+        w.bytes("ACKF", 4);
+        w.u32(28);
+        w.u32(0);                                   // protocolVersion
+        w.u32(sizeof(_rx));                         // receiveBufferSize
+        w.u32(_sendLimit);                          // sendBufferSize
+        w.u32(sizeof(_rx));                         // maxMessageSize
+        w.u32(1);                                   // maxChunkCount
+        _client.write(w.data(), w.pos());
+    }
+
+    void openChannel(UaReader& r) {
+        r.u32();                                    // secureChannelId
+        int32_t policyLen = r.i32();
+        bool none = policyLen == static_cast<int32_t>(strlen(POLICY_NONE)) &&
+                    r.remaining() >= strlen(POLICY_NONE) &&
+                    memcmp(r.current(), POLICY_NONE, policyLen) == 0;
+        if (policyLen > 0) r.skip(policyLen);
+        r.skipString();                             // senderCertificate
+        r.skipString();                             // receiverCertificateThumbprint
+        r.u32();                                    // sequenceNumber
+        uint32_t requestId = r.u32();
+        r.skipNodeId();                             // OpenSecureChannelRequest
+        RequestHeader h;
+        readRequestHeader(r, h);
+        r.u32();                                    // clientProtocolVersion
+        uint32_t requestType = r.u32();
+        r.u32();                                    // securityMode
+        r.skipString();                             // clientNonce
+        uint32_t lifetime = r.u32();
+
+        if (r.error() || !none) {
+            sendError(none ? BAD_DECODING_ERROR : BAD_SECURITY_POLICY_REJECTED, "SecurityPolicy#None only");
+            disconnect();
+            return;
+        }
+
+        if (requestType == 0 || !_channelId) _channelId = _nextChannelId++;
+        ++_tokenId;
+
+        UaWriter w(_tx, _sendLimit);
+        beginMessage(w, "OPN", requestId);
+        w.nodeId(0, OPEN_SECURE_CHANNEL + 3);
+        w.i64(now());
+        w.u32(h.handle);
+        w.u32(STATUS_GOOD);
+        w.u8(0);
+        w.i32(0);
+        w.emptyExtensionObject();
+        w.u32(0);                                   // serverProtocolVersion
+        w.u32(_channelId);
+        w.u32(_tokenId);
+        w.i64(now());
+        w.u32(lifetime ? lifetime : 600000);
+        w.byteString(nullptr, 0);                   // serverNonce
+        transmit(w);
+    }
+
+    void readRequestHeader(UaReader& r, RequestHeader& h) {
+        r.nodeId(h.tokenNs, h.token);
+        r.u64();                                    // timestamp
+        h.handle = r.u32();
+        r.u32();                                    // returnDiagnostics
+        r.skipString();                             // auditEntryId
+        r.u32();                                    // timeoutHint
+        r.skipExtensionObject();
+    }
+
+    void message(UaReader& r) {
+        uint32_t channel = r.u32();
+        r.u32();                                    // tokenId
+        r.u32();                                    // sequenceNumber
+        uint32_t requestId = r.u32();
+        if (channel != _channelId || !_channelId) {
+            sendError(BAD_SECURE_CHANNEL_ID_INVALID, "unknown secure channel");
+            disconnect();
+            return;
+        }
+
+        uint16_t ns; uint32_t type;
+        r.nodeId(ns, type);
+        RequestHeader h;
+        readRequestHeader(r, h);
+
+        UaWriter w(_tx, _sendLimit);
+        ++_stats.messages;
+
+        const bool sessionless = type == GET_ENDPOINTS || type == FIND_SERVERS || type == CREATE_SESSION;
+        const bool tokenValid = _sessionToken && h.tokenNs == 1 && h.token == _sessionToken;
+        if (r.error()) {
+            fault(w, requestId, h.handle, BAD_DECODING_ERROR);
+            transmit(w);
+            return;
+        }
+        if (!sessionless && !tokenValid) {
+            fault(w, requestId, h.handle, BAD_SESSION_ID_INVALID);
+            transmit(w);
+            return;
+        }
+        if (!sessionless && type != ACTIVATE_SESSION && type != CLOSE_SESSION && !_activated) {
+            fault(w, requestId, h.handle, BAD_SESSION_NOT_ACTIVATED);
+            transmit(w);
+            return;
+        }
+        if (tokenValid) _lastRequest = millis();
+
+        switch (type) {
+            case GET_ENDPOINTS:
+                respond(w, requestId, GET_ENDPOINTS + 3, h.handle);
+                w.i32(1);
+                endpointDescription(w);
+                break;
+            case FIND_SERVERS:
+                respond(w, requestId, FIND_SERVERS + 3, h.handle);
+                w.i32(1);
+                applicationDescription(w);
+                break;
+            case CREATE_SESSION: {
+                closeSession();
+                _sessionToken = (micros() ^ (++_sessionCount << 20)) | 1;
+                _lastRequest = millis();
+                uint8_t nonce[32];
+                for (size_t i = 0; i < sizeof(nonce); ++i) nonce[i] = static_cast<uint8_t>(micros() >> (i % 4));
+                respond(w, requestId, CREATE_SESSION + 3, h.handle);
+                w.nodeId(1, 0x10000 + _sessionCount);   // sessionId
+                w.nodeId(1, _sessionToken);             // authenticationToken
+                w.f64(MODBUS_OPCUA_SESSION_TIMEOUT);
+                w.byteString(nonce, sizeof(nonce));
+                w.byteString(nullptr, -1);              // serverCertificate
+                w.i32(1);
+                endpointDescription(w);
+                w.i32(0);                               // serverSoftwareCertificates
+                w.string(nullptr);                      // serverSignature
+                w.byteString(nullptr, -1);
+                w.u32(sizeof(_rx));                     // maxRequestMessageSize
+                break;
+            }
+            case ACTIVATE_SESSION:
+                _activated = true;
+                respond(w, requestId, ACTIVATE_SESSION + 3, h.handle);
+                w.byteString(nullptr, 0);               // serverNonce
+                w.i32(0);
+                w.i32(0);
+                break;
+            case CLOSE_SESSION:
+                closeSession();
+                respond(w, requestId, CLOSE_SESSION + 3, h.handle);
+                break;
+            case BROWSE:                 browse(r, w, requestId, h); break;
+            case BROWSE_NEXT:            browseNext(r, w, requestId, h); break;
+            case READ:                   read(r, w, requestId, h); break;
+            case CREATE_SUBSCRIPTION:    createSubscription(r, w, requestId, h); break;
+            case MODIFY_SUBSCRIPTION:    modifySubscription(r, w, requestId, h); break;
+            case SET_PUBLISHING_MODE:    setPublishingMode(r, w, requestId, h); break;
+            case DELETE_SUBSCRIPTIONS:   deleteSubscriptions(r, w, requestId, h); break;
+            case CREATE_MONITORED_ITEMS: createMonitoredItems(r, w, requestId, h); break;
+            case DELETE_MONITORED_ITEMS: deleteMonitoredItems(r, w, requestId, h); break;
+            case PUBLISH:
+                if (!publish(r, w, requestId, h)) return;
+                break;
+            default:
+                fault(w, requestId, h.handle, BAD_SERVICE_UNSUPPORTED);
+                break;
+        }
+
+        if (r.error()) fault(w, requestId, h.handle, BAD_DECODING_ERROR);
+        else if (w.overflow()) fault(w, requestId, h.handle, BAD_RESPONSE_TOO_LARGE);
+        transmit(w);
+    }
+
+    /**
+     * @brief Dispatch one complete message in _rx
+     */
+    void process() {
+        UaReader r(_rx + 8, _rxLen - 8);
+        if (_rx[3] != 'F') {
+            sendError(BAD_TCP_MESSAGE_TOO_LARGE, "chunking not supported");
+            disconnect();
+        } else if (memcmp(_rx, "HEL", 3) == 0) {
+            hello(r);
+        } else if (!_hello) {
+            sendError(BAD_TCP_MESSAGE_TYPE_INVALID, "Hello expected");
+            disconnect();
+        } else if (memcmp(_rx, "OPN", 3) == 0) {
+            openChannel(r);
+        } else if (memcmp(_rx, "MSG", 3) == 0) {
+            message(r);
+        } else if (memcmp(_rx, "CLO", 3) == 0) {
+            disconnect();
+        } else {
+            sendError(BAD_TCP_MESSAGE_TYPE_INVALID, "unknown message type");
+            disconnect();
+        }
+    }
+
+    /**
+     * @brief Read available bytes; process at most one complete message
+     */
+    void receive() {
+        while (_client.available()) {
+            size_t want = 8 - _rxLen;
+            if (_rxLen >= 8) {
+                size_t size = _rx[4] | (_rx[5] << 8) | (_rx[6] << 16) | (static_cast<size_t>(_rx[7]) << 24);
+                want = size - _rxLen;
+            }
+            int n = _client.read(&_rx[_rxLen], want);
+            if (n <= 0) return;
+            _rxLen += n;
+
+            if (_rxLen < 8) continue;
+            size_t size = _rx[4] | (_rx[5] << 8) | (_rx[6] << 16) | (static_cast<size_t>(_rx[7]) << 24);
+            if (size < 8 || size > sizeof(_rx)) {
+                sendError(BAD_TCP_MESSAGE_TOO_LARGE, "message exceeds buffer");
+                disconnect();
+                return;
+            }
+            if (_rxLen == size) {
+                process();
+                _rxLen = 0;
+                return;
+            }
+        }
+    }
+
+public:
+    /**
+     * @brief Constructor
+     * @param server   Modbus server holding the process image
+     * @param items    Mapped items
+     * @param numItems Number of items
+     * @param changes  Change sequence shared by all items
+     * @param port     opc.tcp port
+     */
+    OpcUaServer(ModbusTCPServer& server, ModbusItem*& items, size_t& numItems,
+                ChangeTracker& changes, uint16_t port = MODBUS_OPCUA_PORT)
+        : _listener(port), _server(server), _items(items), _numItems(numItems), _changes(changes) {}
+
+    /**
+     * @brief Start listening
+     */
+    void begin() {
+        _listener.begin();
+        _seenSeq = _changes.sequence();
+        #ifdef IDEBUG
+        Serial.print("OPC UA server memory: ");
+        Serial.print(memoryUsage());
+        Serial.println(" bytes");
+        #endif
+    }
+
+    /**
+     * @brief Serve the connection and run the publishing timers (non-blocking)
+     *
+     * Call after the items were updated in this cycle.
+     */
+    void update() {
+        const unsigned long start = micros();
+
+        EthernetClient incoming = _listener.accept();
+        if (incoming) {
+            if (_client && _client.connected()) {
+                incoming.stop();                    // one connection at a time
+            } else {
+                disconnect();
+                _client = incoming;
+                ++_stats.connections;
+            }
+        }
+
+        if (_client && _client.connected()) {
+            receive();
+            if (_sessionToken && millis() - _lastRequest > MODBUS_OPCUA_SESSION_TIMEOUT) closeSession();
+            markChanges();
+            if (_client.connected()) publishCycle();
+        } else if (_hello) {
+            disconnect();
+        }
+
+        _stats.updateUs = micros() - start;
+        if (_stats.updateUs > _stats.updateUsMax) _stats.updateUsMax = _stats.updateUs;
+    }
+
+    /**
+     * @brief Statically allocated bytes (buffers and tables)
+     */
+    size_t memoryUsage() const { return sizeof(*this); }
+
+    /**
+     * @brief Message, publish and timing counters
+     */
+    const OpcUaStats& stats() const { return _stats; }
+};
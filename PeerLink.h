@@ -0,0 +1,329 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: PeerLink.h
+ * Description:
+ * Lightweight publish/subscribe of selected values between controllers over UDP.
+ * Subscribed values appear as read-only SharedVariable devices with staleness detection.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+#include "IODevice.h"
+#include <Ethernet.h>
+
+#if !defined(MODBUS_PEER_SAMPLE_MS) || !defined(MODBUS_PEER_MIN_INTERVAL)
+#error "config.h lacks MODBUS_PEER_SAMPLE_MS / MODBUS_PEER_MIN_INTERVAL (publish rate limits, see config.example.h)"
+#endif
+
+/**
+ * @brief A local value published to peer controllers under a topic id.
+ */
+struct PeerPublication {
+    uint16_t  topic;          ///< Topic id, unique per publishing node
+    IODevice* device;         ///< Device whose Modbus value is published
+    uint16_t  deadband = 0;   ///< Change needed to publish early (0 = any change)
+};
+
+/**
+ * @class SharedVariable
+ * @brief Read-only value received from a peer controller.
+ *
+ * Maps to a Modbus Holding Register like a read-only Variable. When no update
+ * arrived within MODBUS_PEER_TIMEOUT, the value is stale and the register
+ * reads INVALID_VALUE; local logic can check isStale() before using value().
+ */
+class SharedVariable : public IODevice {
+private:
+    uint8_t       _node;              ///< Publishing node id
+    uint16_t      _topic;             ///< Topic id at the publishing node
+    uint16_t      _value = 0;         ///< Last received value
+    unsigned long _lastUpdate = 0;    ///< millis() of the last update
+    bool          _received = false;  ///< Any value received since boot
+
+public:
+    /**
+     * @brief Constructor
+     * @param node  Node id of the publishing controller
+     * @param topic Topic id at that controller
+     */
+    SharedVariable(uint8_t node, uint16_t topic)
+        : _node(node), _topic(topic) {
+        setType(ModbusType::HoldingRegister);
+    }
+
+    uint8_t node() const { return _node; }
+    uint16_t topic() const { return _topic; }
+
+    /**
+     * @brief Store a value received from the peer
+     */
+    void receive(uint16_t value) {
+        _value = value;
+        _lastUpdate = millis();
+        _received = true;
+    }
+
+    /**
+     * @brief True if no value arrived within MODBUS_PEER_TIMEOUT
+     */
+    bool isStale() const {
+        return !_received || (millis() - _lastUpdate > MODBUS_PEER_TIMEOUT);
+    }
+
+    /**
+     * @brief Last received value (regardless of staleness)
+     */
+    uint16_t value() const { return _value; }
+
+    /**
+     * @brief Milliseconds since the last update
+     */
+    unsigned long age() const { return millis() - _lastUpdate; }
+
+    /**
+     * @brief Read the value for Modbus, INVALID_VALUE while stale
+     */
+    uint16_t getHoldingValue() const override {
+        return isStale() ? INVALID_VALUE : _value;
+    }
+
+    uint8_t quality() const override { return isStale() ? QUALITY_STALE : QUALITY_GOOD; }
+};
+
+
+/**
+ * @class PeerLink
+ * @brief Publishes local values and feeds SharedVariables from peers.
+ *
+ * @details
+ *   Publications are sent as one datagram to MODBUS_PEER_ADDRESS whenever a
+ *   value moves by more than its deadband and at least every
+ *   MODBUS_PEER_PERIOD ms. update() should be called on every loop()
+ *   iteration (not only on the Modbus update interval): every
+ *   MODBUS_PEER_SAMPLE_MS it re-reads published inputs (IODevice::refresh())
+ *   itself, so an input change leaves within a few ms instead of one update
+ *   cycle, and received values are visible to local logic as soon as they
+ *   arrive. Change datagrams are at least MODBUS_PEER_MIN_INTERVAL ms apart;
+ *   a change during that time goes out with the next one, so a noisy input
+ *   cannot flood the group. The periodic datagram carries the current
+ *   values, deadband or not.
+ *
+ *   Datagram layout (big-endian):
+ *     0 'O' 'P' | 2 version (1) | 3 node id | 4 sequence (u32) | 8 count |
+ *     9 reserved | 10 count * { topic (u16), value (u16) }
+ *
+ *   Datagrams older than the last one seen from a node are dropped. A lower
+ *   sequence is accepted once the node has timed out (publisher restart).
+ */
+class PeerLink {
+private:
+    static constexpr size_t HEADER_SIZE = 10;
+    static constexpr size_t MAX_ENTRIES = 64;
+
+    /**
+     * @brief Receive state per peer node
+     */
+    struct PeerState {
+        uint8_t       node;
+        uint32_t      sequence;
+        unsigned long lastSeen;
+    };
+
+    EthernetUDP _udp;                                  ///< Multicast socket
+    const PeerPublication* _pubs = nullptr;            ///< Local publications
+    size_t      _numPubs = 0;                          ///< Number of publications
+    uint16_t    _published[MAX_ENTRIES];               ///< Last published values
+    uint16_t    _current[MAX_ENTRIES];                 ///< Last sampled values
+    bool        _pending = false;                      ///< Change beyond a deadband not yet sent
+    SharedVariable* const* _subs = nullptr;            ///< Subscribed variables
+    size_t      _numSubs = 0;                          ///< Number of subscriptions
+    PeerState   _peers[MODBUS_PEER_MAX_NODES];         ///< Known publishers
+    size_t      _numPeers = 0;                         ///< Entries used in _peers
+    uint32_t    _sequence = 0;                         ///< Sequence of the last sent datagram
+    unsigned long _lastSend = 0;                       ///< millis() of the last send
+    unsigned long _lastSample = 0;                     ///< millis() of the last input sample
+    uint32_t    _dropped = 0;                          ///< Out-of-order or duplicate datagrams
+    uint32_t    _lost = 0;                             ///< Gaps detected in peer sequences
+
+    /**
+     * @brief Current Modbus value of a device according to its mapping type
+     */
+    static uint16_t sample(const IODevice* device) {
+        switch (device->getType()) {
+            case ModbusType::Coil:            return device->getCoilValue();
+            case ModbusType::DiscreteInput:   return device->getDiscreteValue();
+            case ModbusType::HoldingRegister: return device->getHoldingValue();
+            case ModbusType::InputRegister:   return device->getInputValue();
+            default:                          return INVALID_VALUE;
+        }
+    }
+
+    /**
+     * @brief Whether a sample differs from the published value by more than the deadband
+     */
+    static bool beyond(uint16_t value, uint16_t published, uint16_t deadband) {
+        if (value == INVALID_VALUE || published == INVALID_VALUE) return value != published;
+        return (value > published ? value - published : published - value) > deadband;
+    }
+
+    /**
+     * @brief Find or create the receive state of a node
+     */
+    PeerState* peer(uint8_t node) {
+        for (size_t i = 0; i < _numPeers; ++i) {
+            if (_peers[i].node == node) return &_peers[i];
+        }
+        if (_numPeers == MODBUS_PEER_MAX_NODES) return nullptr;
+        PeerState& p = _peers[_numPeers++];
+        p.node = node;
+        p.sequence = 0;
+        p.lastSeen = 0;
+        return &p;
+    }
+
+    void publish() {
+        uint8_t packet[HEADER_SIZE + MAX_ENTRIES * 4];
+        packet[0] = 'O';
+        packet[1] = 'P';
+        packet[2] = 1;
+        packet[3] = MODBUS_PEER_NODE;
+        ++_sequence;
+        packet[4] = _sequence >> 24;
+        packet[5] = _sequence >> 16;
+        packet[6] = _sequence >> 8;
+        packet[7] = _sequence;
+        packet[8] = static_cast<uint8_t>(_numPubs);
+        packet[9] = 0;
+
+        uint8_t* p = &packet[HEADER_SIZE];
+        for (size_t i = 0; i < _numPubs; ++i) {
+            _published[i] = _current[i];
+            *p++ = _pubs[i].topic >> 8;
+            *p++ = _pubs[i].topic & 0xFF;
+            *p++ = _published[i] >> 8;
+            *p++ = _published[i] & 0xFF;
+        }
+
+        _udp.beginPacket(IPAddress(MODBUS_PEER_ADDRESS), MODBUS_PEER_PORT);
+        _udp.write(packet, p - packet);
+        _udp.endPacket();
+        _lastSend = millis();
+        _pending = false;
+    }
+
+    void receive() {
+        uint8_t packet[HEADER_SIZE + MAX_ENTRIES * 4];
+
+        while (_udp.parsePacket() > 0) {
+            int len = _udp.read(packet, sizeof(packet));
+            if (len < static_cast<int>(HEADER_SIZE)) continue;
+            if (packet[0] != 'O' || packet[1] != 'P' || packet[2] != 1) continue;
+            if (packet[3] == MODBUS_PEER_NODE) continue;      // own datagram looped back
+
+            size_t count = packet[8];
+            if (HEADER_SIZE + count * 4 > static_cast<size_t>(len)) continue;
+
+            PeerState* state = peer(packet[3]);
+            if (!state) continue;
+
+            uint32_t seq = (static_cast<uint32_t>(packet[4]) << 24) | (static_cast<uint32_t>(packet[5]) << 16) |
+                           (static_cast<uint32_t>(packet[6]) << 8)  |  static_cast<uint32_t>(packet[7]);
+            bool timedOut = state->lastSeen == 0 || (millis() - state->lastSeen > MODBUS_PEER_TIMEOUT);
+            if (!timedOut && static_cast<int32_t>(seq - state->sequence) <= 0) {
+                ++_dropped;
+                continue;
+            }
+            if (!timedOut && seq != state->sequence + 1) _lost += seq - state->sequence - 1;
+            state->sequence = seq;
+            state->lastSeen = millis();
+
+            const uint8_t* e = &packet[HEADER_SIZE];
+            for (size_t i = 0; i < count; ++i, e += 4) {
+                uint16_t topic = (static_cast<uint16_t>(e[0]) << 8) | e[1];
+                uint16_t value = (static_cast<uint16_t>(e[2]) << 8) | e[3];
+                for (size_t s = 0; s < _numSubs; ++s) {
+                    if (_subs[s]->node() == packet[3] && _subs[s]->topic() == topic) {
+                        _subs[s]->receive(value);
+                    }
+                }
+            }
+        }
+    }
+
+public:
+    /**
+     * @brief Constructor
+     * @param pubs    Local publications (may be nullptr), must outlive the link
+     * @param numPubs Number of publications (at most 64)
+     * @param subs    Subscribed variables (may be nullptr), must outlive the link
+     * @param numSubs Number of subscriptions
+     */
+    PeerLink(const PeerPublication* pubs, size_t numPubs,
+             SharedVariable* const* subs, size_t numSubs)
+        : _pubs(pubs), _numPubs(numPubs < MAX_ENTRIES ? numPubs : MAX_ENTRIES),
+          _subs(subs), _numSubs(numSubs) {}
+
+    /**
+     * @brief Join the peer multicast group
+     */
+    void begin() {
+        _udp.beginMulticast(IPAddress(MODBUS_PEER_ADDRESS), MODBUS_PEER_PORT);
+        for (size_t i = 0; i < _numPubs; ++i) _current[i] = sample(_pubs[i].device);
+        if (_numPubs) publish();
+    }
+
+    /**
+     * @brief Sample, publish on change or period and process received datagrams
+     */
+    void update() {
+        const unsigned long now = millis();
+        if (_numPubs && now - _lastSample >= MODBUS_PEER_SAMPLE_MS) {
+            _lastSample = now;
+            for (size_t i = 0; i < _numPubs; ++i) {
+                _pubs[i].device->refresh();
+                _current[i] = sample(_pubs[i].device);
+                if (beyond(_current[i], _published[i], _pubs[i].deadband)) _pending = true;
+            }
+        }
+        if (_numPubs && ((_pending && now - _lastSend >= MODBUS_PEER_MIN_INTERVAL) ||
+                         now - _lastSend >= MODBUS_PEER_PERIOD)) publish();
+
+        receive();
+    }
+
+    /**
+     * @brief Datagrams dropped as duplicates or out of order
+     */
+    uint32_t dropped() const { return _dropped; }
+
+    /**
+     * @brief Datagrams missing according to peer sequence numbers
+     */
+    uint32_t lost() const { return _lost; }
+};
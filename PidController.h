@@ -0,0 +1,282 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: PidController.h
+ * Description:
+ * PID controller device running in the scan.
+ * Reads a process value from an AnalogInput or Variable and drives a relay
+ * (time-proportional) or an analog output; parameters and output are
+ * exposed as holding registers.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <Arduino.h>
+#include <algorithm>
+#include <functional>
+#include "IODevice.h"
+#include "Relay.h"
+#include "Variable.h"
+
+/**
+ * @brief Operating mode of a PidController (mode register)
+ */
+enum class PidMode : uint16_t {
+    Manual = 0,   ///< Output register is written by the client
+    Automatic = 1 ///< Output computed every sample period
+};
+
+
+/**
+ * @class PidController
+ * @brief PID loop evaluated locally, independent of the network.
+ *
+ * @details
+ *   The controller itself maps to a holding register carrying the setpoint
+ *   (same units as the process value). The other registers are members that
+ *   are listed after it in the item list:
+ *
+ *     { &pid }, { &pid.mode }, { &pid.output }, { &pid.kp }, { &pid.ki },
+ *     { &pid.kd }, { &pid.period }, { &pid.execTime }
+ *
+ *   - mode     : 0 manual, 1 automatic (PidMode)
+ *   - output   : 0..1000 ‰; written by the client in manual mode
+ *   - kp/ki/kd : signed gains x100 in ‰ per unit, ‰ per unit and second,
+ *                ‰ per unit per second; negative gains give direct action
+ *                (cooling), positive reverse action (heating)
+ *   - period   : sample period in ms
+ *   - execTime : execution time of the last computation in µs (read-only)
+ *
+ *   Computation is single-precision. The integral term is kept in output
+ *   units and only integrated while the output is not saturated in the
+ *   direction of the error (anti-windup). Switching from manual to
+ *   automatic and changing kp preset the integral so the output does not
+ *   jump (bumpless transfer); the derivative acts on the process value only.
+ *
+ *   A relay output is switched time-proportionally: on for output ‰ of
+ *   every window. The relay is left alone while its safe action is active.
+ *   List the controller after its process value so it uses this scan's sample.
+ */
+class PidController : public IODevice {
+private:
+    static constexpr float OUTPUT_MAX = 1000.0f;  ///< Output range 0..1000 ‰
+
+    IODevice* _pv;                            ///< Process value source
+    Relay* _relay = nullptr;                  ///< Time-proportional output
+    std::function<void(uint16_t)> _analog;    ///< Analog output (‰)
+    uint16_t _analogSent = INVALID_VALUE;     ///< Last value passed to _analog
+    unsigned long _window = 0;                ///< Time-proportioning window (ms)
+    unsigned long _windowStart = 0;           ///< Start of the current window
+    unsigned long _lastSample = 0;            ///< millis() of the last computation
+
+    uint16_t _setpoint = 0;
+    PidMode _mode = PidMode::Manual;
+    int16_t _kp = 0, _ki = 0, _kd = 0;
+    uint16_t _period = 1000;
+    uint16_t _output = 0;                     ///< Current output (‰)
+    uint16_t _execUs = 0;                     ///< Last computation time (µs)
+    uint16_t _execMaxUs = 0;                  ///< Worst computation time since boot (µs)
+
+    float _integral = 0.0f;                   ///< Integral term in output units
+    float _lastPv = 0.0f;                     ///< Process value of the previous sample
+    bool _primed = false;                     ///< _lastPv and _integral are valid
+
+    /**
+     * @brief Limit the integral term; negative values let the integral offset a large p
+     */
+    static float clampIntegral(float v) { return std::min(std::max(v, -OUTPUT_MAX), OUTPUT_MAX); }
+
+    /**
+     * @brief Current process value, or INVALID_VALUE
+     */
+    uint16_t processValue() const {
+        if (!_pv) return INVALID_VALUE;
+        return _pv->getType() == ModbusType::InputRegister ? _pv->getInputValue()
+                                                           : _pv->getHoldingValue();
+    }
+
+    /**
+     * @brief Preset the integral so the next output equals the current one
+     */
+    void track(float pv) {
+        _integral = clampIntegral(_output - (_kp / 100.0f) * (_setpoint - pv));
+        _lastPv = pv;
+        _primed = true;
+    }
+
+    /**
+     * @brief One PID step with the sample period dt (s)
+     */
+    void compute(float pv, float dt) {
+        float error = _setpoint - pv;
+        float p = (_kp / 100.0f) * error;
+        float d = -(_kd / 100.0f) * (pv - _lastPv) / dt;
+        float di = (_ki / 100.0f) * error * dt;
+        float u = p + _integral + di + d;
+
+        if (u > OUTPUT_MAX) {
+            u = OUTPUT_MAX;
+            if (di < 0) _integral += di;      // only integrate away from the limit
+        } else if (u < 0.0f) {
+            u = 0.0f;
+            if (di > 0) _integral += di;
+        } else {
+            _integral += di;
+        }
+        _integral = clampIntegral(_integral);
+        _lastPv = pv;
+        _output = static_cast<uint16_t>(u + 0.5f);
+    }
+
+    /**
+     * @brief Drive the relay for the current position in the window
+     */
+    void driveRelay(unsigned long now) {
+        if (!_relay || _relay->inSafeState()) return;
+        if (now - _windowStart >= _window) _windowStart = now;
+        bool on = (now - _windowStart) < (unsigned long)((uint64_t)_window * _output / 1000U);
+        if (on != _relay->getCoilValue()) on ? _relay->on() : _relay->off();
+    }
+
+    void setMode(uint16_t value) {
+        PidMode mode = value ? PidMode::Automatic : PidMode::Manual;
+        if (mode == PidMode::Automatic && _mode == PidMode::Manual) _primed = false;
+        _mode = mode;
+    }
+
+    void setKp(int16_t value) {
+        // Keep p + i constant for the current error
+        if (_primed) {
+            float error = _setpoint - _lastPv;
+            _integral = clampIntegral(_integral + ((_kp - value) / 100.0f) * error);
+        }
+        _kp = value;
+    }
+
+    void setOutput(uint16_t value) {
+        if (_mode == PidMode::Manual) _output = std::min<uint16_t>(value, 1000);
+    }
+
+public:
+    Variable<uint16_t> mode     { [this]() { return static_cast<uint16_t>(_mode); },
+                                  [this](uint16_t v) { setMode(v); } };
+    Variable<uint16_t> output   { [this]() { return _output; },
+                                  [this](uint16_t v) { setOutput(v); } };
+    Variable<int16_t>  kp       { [this]() { return _kp; }, [this](int16_t v) { setKp(v); } };
+    Variable<int16_t>  ki       { [this]() { return _ki; }, [this](int16_t v) { _ki = v; } };
+    Variable<int16_t>  kd       { [this]() { return _kd; }, [this](int16_t v) { _kd = v; } };
+    Variable<uint16_t> period   { [this]() { return _period; },
+                                  [this](uint16_t v) { _period = std::max<uint16_t>(v, 10); } };
+    Variable<uint16_t> execTime { [this]() { return _execUs; } };
+
+    /**
+     * @brief Controller driving a relay time-proportionally
+     * @param pv     Process value (AnalogInput or Variable)
+     * @param relay  Output relay
+     * @param window Time-proportioning window in ms
+     */
+    PidController(IODevice* pv, Relay* relay, unsigned long window = 10000)
+        : _pv(pv), _relay(relay), _window(window) {
+        setType(ModbusType::HoldingRegister);
+    }
+
+    /**
+     * @brief Controller driving an analog output
+     * @param pv     Process value (AnalogInput or Variable)
+     * @param analog Called with the output (0..1000 ‰) when it changes
+     */
+    PidController(IODevice* pv, std::function<void(uint16_t)> analog)
+        : _pv(pv), _analog(analog) {
+        setType(ModbusType::HoldingRegister);
+    }
+
+    PidController(const PidController&) = delete;             // members capture this
+    PidController& operator=(const PidController&) = delete;
+
+    /**
+     * @brief Set the parameters at startup (before setupItems())
+     */
+    void configure(uint16_t setpoint, int16_t kpValue, int16_t kiValue, int16_t kdValue,
+                   uint16_t periodMs = 1000, PidMode initialMode = PidMode::Automatic) {
+        _setpoint = setpoint;
+        _kp = kpValue; _ki = kiValue; _kd = kdValue;
+        _period = std::max<uint16_t>(periodMs, 10);
+        _mode = initialMode;
+        _primed = false;
+    }
+
+    void setup() override {
+        _lastSample = _windowStart = millis();
+    }
+
+    void update() override {
+        unsigned long now = millis();
+
+        if (now - _lastSample >= _period) {
+            float dt = (now - _lastSample) / 1000.0f;
+            _lastSample = now;
+            uint16_t raw = processValue();
+
+            if (_mode == PidMode::Automatic && raw != INVALID_VALUE) {
+                uint32_t start = micros();
+                float pv = raw;
+                if (!_primed) track(pv);
+                else compute(pv, dt);
+                uint32_t us = micros() - start;
+                _execUs = us > 0xFFFF ? 0xFFFF : us;
+                if (_execUs > _execMaxUs) _execMaxUs = _execUs;
+
+                #ifdef IDEBUG_PID
+                Serial.print("PID pv ");
+                Serial.print(raw);
+                Serial.print(" sp ");
+                Serial.print(_setpoint);
+                Serial.print(" out ");
+                Serial.print(_output);
+                Serial.print(" us ");
+                Serial.println(_execUs);
+                #endif
+            } else {
+                _primed = false;   // re-track when automatic control resumes
+            }
+        }
+        if (_analog && _output != _analogSent) _analog(_analogSent = _output);
+        driveRelay(now);
+    }
+
+    // Setpoint register
+    uint16_t getHoldingValue() const override { return _setpoint; }
+    void setFromHolding(uint16_t value) override { _setpoint = value; }
+
+    /**
+     * @brief Current output (‰)
+     */
+    uint16_t outputValue() const { return _output; }
+
+    /**
+     * @brief Worst execution time of one computation since boot (µs)
+     */
+    uint16_t maxExecTime() const { return _execMaxUs; }
+};
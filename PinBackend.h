@@ -47,6 +47,8 @@ public:
     virtual void updateDigitalOutputs() = 0;
     virtual int digitalRead(pin_size_t pin) = 0;
     virtual int analogRead(pin_size_t pin) { return 0; }
+    virtual uint32_t transactions() const { return 0; }  ///< Bus transactions since boot
+    virtual bool present() const { return true; }         ///< Hardware attached and responding
     virtual ~PinBackend() = default;
 };
 
@@ -72,6 +74,7 @@ public:
 class ExpansionPinBackend : public PinBackend {
 private:
     DigitalExpansion* _exp;
+    uint32_t _transactions = 0;  ///< Expansion bus transfers issued
 
 public:
     explicit ExpansionPinBackend(DigitalExpansion* exp) : _exp(exp) {}
@@ -81,13 +84,25 @@ public:
         (void)pin; (void)mode;
     }
 
-    void updateDigitalOutputs() override { _exp->updateDigitalOutputs(); }
+    void updateDigitalOutputs() override {
+        _exp->updateDigitalOutputs();
+        ++_transactions;
+    }
     void digitalWrite(pin_size_t pin, PinStatus val) override {
         _exp->digitalWrite(pin, val);
         _exp->updateDigitalOutputs();
+        ++_transactions;
     }
 
-    int digitalRead(pin_size_t pin) override { return _exp->digitalRead(pin); }
+    int digitalRead(pin_size_t pin) override {
+        ++_transactions;
+        return _exp->digitalRead(pin);
+    }
+
+    uint32_t transactions() const override { return _transactions; }
+
+    // The controller pulls the detect line low while no expansion is attached
+    bool present() const override { return ::digitalRead(OPTA_CONTROLLER_DETECT_PIN) != LOW; }
 
     int analogRead(pin_size_t pin) override {
         // Expansion modules may not support analog input
@@ -107,4 +122,5 @@ public:
     void updateDigitalOutputs() override {}
     int digitalRead(pin_size_t pin) override { return 0; }
     int analogRead(pin_size_t pin) override { return 0; }
+    bool present() const override { return false; }
 };
\ No newline at end of file
@@ -0,0 +1,300 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: Redundancy.h
+ * Description:
+ * Hot-standby controller pair: the active controller replicates its process image,
+ * relay states and timer states to the standby, which takes over on sync loss.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+#include "ModbusItem.h"
+#include <ArduinoModbus.h>
+#include <Ethernet.h>
+
+/**
+ * @class RedundancyLink
+ * @brief Process image replication between a hot-standby controller pair.
+ *
+ * @details
+ *   Both controllers run the same item list. The active controller sends one
+ *   sync frame per update cycle to MODBUS_REDUNDANCY_PARTNER containing the
+ *   items whose value or internal state (IODevice::saveState()) changed since
+ *   they were last sent, plus a rotating slice of MODBUS_REDUNDANCY_REFRESH
+ *   unchanged items so a standby that missed frames converges.
+ *
+ *   The standby does not update its devices and therefore does not drive
+ *   outputs; it writes the received values into its server tables, so clients
+ *   can read it. After MODBUS_REDUNDANCY_TAKEOVER_SCANS cycles without a sync
+ *   frame it becomes active: the normal item path applies the replicated image
+ *   to the devices and the saved timer states are restored afterwards.
+ *   Both controllers start as standby; the one configured as
+ *   MODBUS_REDUNDANCY_PRIMARY waits half as long, so it wins when both boot.
+ *
+ *   An active controller keeps listening: if the link was down and both took
+ *   over, the one that sees the other's frames and loses the tie-break
+ *   (primary wins; between equals the lower IP address wins) returns to
+ *   standby and counts the yield, so the pair never stays split. Yielding
+ *   releases every output (IODevice::releaseOutputs(): relays off, safe
+ *   state dropped), so only the winner drives them.
+ *
+ *   Frame layout (big-endian):
+ *     0 'O' 'R' | 2 version (1) | 3 flags (bit 0 primary) | 4 frame sequence (u32) |
+ *     8 count (u16) | 10 count * { item (u16), value (u16), aux (u16), state (u32) }
+ */
+class RedundancyLink {
+private:
+    static constexpr size_t HEADER_SIZE = 10;
+    static constexpr size_t ENTRY_SIZE = 10;
+    static constexpr size_t MAX_ENTRIES = 100;
+    static constexpr uint8_t FLAG_PRIMARY = 0x01;
+
+#ifdef MODBUS_REDUNDANCY_PRIMARY
+    static constexpr bool PRIMARY = true;
+#else
+    static constexpr bool PRIMARY = false;
+#endif
+
+    EthernetUDP _udp;                                     ///< Sync socket
+    bool        _active = false;                          ///< This controller drives the outputs
+    bool        _restorePending = false;                  ///< Restore timer states after takeover
+    uint32_t    _frameSeq = 0;                            ///< Last sent/received frame sequence
+    uint32_t    _sentSeq[MODBUS_REDUNDANCY_MAX_ITEMS];    ///< Change sequence last sent per item
+    uint32_t    _state[MODBUS_REDUNDANCY_MAX_ITEMS];      ///< State last sent/received per item
+    size_t      _refreshCursor = 0;                       ///< Next item of the rotating refresh
+    uint16_t    _silentScans = 0;                         ///< Standby cycles without sync frame
+    unsigned long _lastFrame = 0;                         ///< millis() of the last received frame
+    unsigned long _takeoverLatency = 0;                   ///< ms from last frame to takeover
+    uint32_t    _lostFrames = 0;                          ///< Gaps in received frame sequence
+    uint32_t    _yields = 0;                              ///< Returns to standby after a split
+    uint8_t     _frame[HEADER_SIZE + MAX_ENTRIES * ENTRY_SIZE]; ///< Frame buffer
+
+    static void put16(uint8_t* p, uint16_t v) { p[0] = v >> 8; p[1] = v & 0xFF; }
+    static void put32(uint8_t* p, uint32_t v) { put16(p, v >> 16); put16(p + 2, v & 0xFFFF); }
+    static uint16_t get16(const uint8_t* p) { return (static_cast<uint16_t>(p[0]) << 8) | p[1]; }
+    static uint32_t get32(const uint8_t* p) { return (static_cast<uint32_t>(get16(p)) << 16) | get16(p + 2); }
+
+    /**
+     * @brief Store a replicated value in the server tables
+     */
+    static void writeImage(const ModbusItem& item, ModbusTCPServer& server, uint16_t value, uint16_t aux) {
+        switch (item.type()) {
+            case ModbusType::Coil:            server.coilWrite(MODBUS_COIL_OFFSET + item.address(), value != 0); break;
+            case ModbusType::DiscreteInput:   server.discreteInputWrite(MODBUS_DISCRETE_OFFSET + item.address(), value != 0); break;
+            case ModbusType::HoldingRegister: server.holdingRegisterWrite(MODBUS_HOLDING_OFFSET + item.address(), value); break;
+            case ModbusType::InputRegister:   server.inputRegisterWrite(MODBUS_INPUT_OFFSET + item.address(), value); break;
+            default: break;
+        }
+        if (item.hasExtendedData()) server.holdingRegisterWrite(MODBUS_HOLDING_OFFSET + item.auxAddress(), aux);
+    }
+
+    /**
+     * @brief Append one item to the frame
+     */
+    static uint8_t* appendEntry(uint8_t* p, size_t index, const ModbusItem& item,
+                                ModbusTCPServer& server, uint32_t state) {
+        put16(p, static_cast<uint16_t>(index));
+        put16(p + 2, item.imageValue(server));
+        put16(p + 4, item.auxImageValue(server));
+        put32(p + 6, state);
+        return p + ENTRY_SIZE;
+    }
+
+    static uint32_t ipValue(const IPAddress& ip) {
+        return (static_cast<uint32_t>(ip[0]) << 24) | (static_cast<uint32_t>(ip[1]) << 16) |
+               (static_cast<uint32_t>(ip[2]) << 8) | ip[3];
+    }
+
+    /**
+     * @brief Tie-break between two active controllers
+     * @return true if the sender of the current frame stays active
+     */
+    bool partnerWins(uint8_t flags) {
+        const bool partnerPrimary = flags & FLAG_PRIMARY;
+        if (partnerPrimary != PRIMARY) return partnerPrimary;
+        return ipValue(_udp.remoteIP()) < ipValue(Ethernet.localIP());
+    }
+
+    /**
+     * @brief Apply received sync frames to the server tables
+     *
+     * While active, frames of a partner losing the tie-break are dropped;
+     * a frame of a winning partner makes this controller yield.
+     * @return true if at least one frame of an active partner was applied
+     */
+    bool receive(ModbusItem* items, size_t numItems, ModbusTCPServer& server) {
+        bool any = false;
+
+        while (_udp.parsePacket() > 0) {
+            int len = _udp.read(_frame, sizeof(_frame));
+            if (len < static_cast<int>(HEADER_SIZE)) continue;
+            if (_frame[0] != 'O' || _frame[1] != 'R' || _frame[2] != 1) continue;
+            if (!(_udp.remoteIP() == IPAddress(MODBUS_REDUNDANCY_PARTNER))) continue;
+
+            size_t count = get16(&_frame[8]);
+            if (HEADER_SIZE + count * ENTRY_SIZE > static_cast<size_t>(len)) continue;
+
+            uint32_t seq = get32(&_frame[4]);
+            if (_active) {
+                if (!partnerWins(_frame[3])) continue;
+                _active = false;
+                _restorePending = false;
+                ++_yields;
+                for (size_t i = 0; i < numItems; ++i) items[i].releaseOutputs();
+
+                #ifdef IDEBUG
+                Serial.println("Redundancy: partner active, returning to standby");
+                #endif
+            } else if (_lastFrame && seq != _frameSeq + 1) {
+                ++_lostFrames;
+            }
+            _frameSeq = seq;
+
+            const uint8_t* e = &_frame[HEADER_SIZE];
+            for (size_t i = 0; i < count; ++i, e += ENTRY_SIZE) {
+                size_t index = get16(e);
+                if (index >= numItems || index >= MODBUS_REDUNDANCY_MAX_ITEMS) continue;
+                writeImage(items[index], server, get16(e + 2), get16(e + 4));
+                _state[index] = get32(e + 6);
+            }
+            any = true;
+        }
+        return any;
+    }
+
+public:
+    /**
+     * @brief Open the sync socket
+     */
+    void begin() {
+        _udp.begin(MODBUS_REDUNDANCY_PORT);
+        memset(_sentSeq, 0, sizeof(_sentSeq));
+        memset(_state, 0, sizeof(_state));
+    }
+
+    /**
+     * @brief True if this controller drives the outputs
+     */
+    bool isActive() const { return _active; }
+
+    /**
+     * @brief Milliseconds between the last sync frame and the takeover (0 = no takeover)
+     */
+    unsigned long takeoverLatency() const { return _takeoverLatency; }
+
+    /**
+     * @brief Sync frames missed while standby
+     */
+    uint32_t lostFrames() const { return _lostFrames; }
+
+    /**
+     * @brief Times this controller returned to standby after both were active
+     */
+    uint32_t yields() const { return _yields; }
+
+    /**
+     * @brief Standby cycle: apply sync frames and check for takeover
+     *
+     * Also called while active, to detect a partner that took over as well.
+     * @return true while this controller stays standby (items must not be updated)
+     */
+    bool standby(ModbusItem* items, size_t numItems, ModbusTCPServer& server) {
+        if (receive(items, numItems, server)) {
+            _silentScans = 0;
+            _lastFrame = millis();
+            return true;
+        }
+        if (_active) return false;
+
+        #ifdef MODBUS_REDUNDANCY_PRIMARY
+        const uint16_t limit = MODBUS_REDUNDANCY_TAKEOVER_SCANS;
+        #else
+        const uint16_t limit = MODBUS_REDUNDANCY_TAKEOVER_SCANS * 2;
+        #endif
+        if (++_silentScans < limit) return true;
+
+        _active = true;
+        _restorePending = true;
+        _takeoverLatency = _lastFrame ? millis() - _lastFrame : 0;
+
+        #ifdef IDEBUG
+        Serial.print("Redundancy: taking over, ms since last sync: ");
+        Serial.println(_takeoverLatency);
+        #endif
+        return false;
+    }
+
+    /**
+     * @brief Active cycle: send the sync frame (after the items were updated)
+     */
+    void replicate(ModbusItem* items, size_t numItems, ModbusTCPServer& server) {
+        if (!_active) return;
+        if (numItems > MODBUS_REDUNDANCY_MAX_ITEMS) numItems = MODBUS_REDUNDANCY_MAX_ITEMS;
+
+        if (_restorePending) {
+            // First cycle after takeover: the item path applied the image, now the timers
+            for (size_t i = 0; i < numItems; ++i) {
+                if (items[i].device() && _state[i]) items[i].device()->restoreState(_state[i]);
+            }
+            _restorePending = false;
+        }
+
+        uint8_t* p = &_frame[HEADER_SIZE];
+        size_t count = 0;
+
+        // Deltas: value or internal state changed since last sent
+        for (size_t i = 0; i < numItems && count < MAX_ENTRIES; ++i) {
+            uint32_t state = items[i].device() ? items[i].device()->saveState() : 0;
+            if (items[i].changeSequence() == _sentSeq[i] && state == _state[i]) continue;
+            p = appendEntry(p, i, items[i], server, state);
+            _sentSeq[i] = items[i].changeSequence();
+            _state[i] = state;
+            ++count;
+        }
+
+        // Rotating refresh of unchanged items
+        for (size_t n = 0; n < MODBUS_REDUNDANCY_REFRESH && n < numItems && count < MAX_ENTRIES; ++n) {
+            size_t i = _refreshCursor;
+            _refreshCursor = (_refreshCursor + 1) % numItems;
+            p = appendEntry(p, i, items[i], server, _state[i]);
+            ++count;
+        }
+
+        _frame[0] = 'O';
+        _frame[1] = 'R';
+        _frame[2] = 1;
+        _frame[3] = PRIMARY ? FLAG_PRIMARY : 0;
+        put32(&_frame[4], ++_frameSeq);
+        put16(&_frame[8], static_cast<uint16_t>(count));
+
+        _udp.beginPacket(IPAddress(MODBUS_REDUNDANCY_PARTNER), MODBUS_REDUNDANCY_PORT);
+        _udp.write(_frame, p - _frame);
+        _udp.endPacket();
+    }
+};
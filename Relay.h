@@ -51,7 +51,8 @@ protected:
     SafeAction _leaveSafeState;
     bool _stateBeforeSafeState = false;
     bool _inSafeState = false;
-
+    uint8_t _safeRequests = 0;   // Active safe-state sources (handler, limit monitors)
+    uint32_t _switchCount = 0;
 
     void triggerUpdate() {
         // Ensure backend flushes output changes
@@ -78,9 +79,6 @@ public:
     }
 
     void enterSafeState() override {
- // Already in safe state → do nothing
-        if (_inSafeState) return;
-
         #ifdef IDEBUG_RELAY
             Serial.print("Entering Safe State on pin: ");
             Serial.println(_pin);
@@ -93,6 +91,9 @@ public:
         // No safe mode → nothing to do
         if (_enterSafeState == IGNORE) return;
 
+        // Already in safe state (other source) → only count the request
+        if (_safeRequests++) return;
+
         // Mark safe state active
         _inSafeState = true;
 
@@ -108,8 +109,8 @@ public:
     }
 
     void leaveSafeState() override {
-        // Only act if safe state was previously active
-        if (!_inSafeState) return;
+        // Only act when the last source releases the safe state
+        if (!_safeRequests || --_safeRequests) return;
 
         _inSafeState = false;
 
@@ -134,6 +135,13 @@ public:
 
 
 
+    // Partner controller drives the outputs now: off, safe state forgotten
+    void releaseOutputs() override {
+        _safeRequests = 0;
+        _inSafeState = false;
+        off();
+    }
+
     // Must be implemented by derived classes
     virtual void on() = 0;
     virtual void off() = 0;
@@ -141,11 +149,30 @@ public:
     // Modbus coil read
     bool getCoilValue() const override { return _state; }
 
-    // Modbus coil write
+    // Modbus coil write; ignored while a safe action holds the relay, so a
+    // client cannot override a local trip (the coil reads back the real state)
     void setFromCoil(bool val) override {
+        if (_inSafeState) {
+            #ifdef IDEBUG_RELAY
+            Serial.print("Coil write ignored in safe state: Pin ");
+            Serial.println(_pin);
+            #endif
+            return;
+        }
         if (val) on();
         else off();
     }
+
+    // Off-to-on transitions since boot
+    uint32_t switchCount() const override { return _switchCount; }
+
+    // Output not driven while the backend is missing
+    uint8_t quality() const override {
+        return _backend && _backend->present() ? QUALITY_GOOD : QUALITY_BACKEND_MISSING;
+    }
+
+    // Safe action active; local control (e.g. PidController) must not switch
+    bool inSafeState() const { return _inSafeState; }
 };
 
 
@@ -175,6 +202,8 @@ public:
         triggerUpdate();
     }
 
+    bool hasExtendedData() const override { return true; }
+
     uint16_t getHoldingValue() const override {
         return static_cast<uint16_t>(_maxOnTime / 1000UL);
     }
@@ -183,10 +212,25 @@ public:
         _maxOnTime = static_cast<unsigned long>(val) * 1000UL;
     }
 
+    /**
+     * @brief Elapsed on-time in seconds + 1 while on, 0 while off
+     */
+    uint32_t saveState() const override {
+        return _state ? (millis() - _startTime) / 1000UL + 1 : 0;
+    }
+
+    /**
+     * @brief Continue the safety timeout where the partner controller left it
+     */
+    void restoreState(uint32_t state) override {
+        if (_state && state) _startTime = millis() - (state - 1) * 1000UL;
+    }
+
     void on() override {
         _backend->digitalWrite(_pin, HIGH);
         if (_ledPin) _backend->digitalWrite(_ledPin, HIGH);
 
+        if (!_state) ++_switchCount;
         _state = true;
         _startTime = millis();
         triggerUpdate();
@@ -236,6 +280,7 @@ public:
     void on() override {
         _backend->digitalWrite(_pin, HIGH);
         if (_ledPin) _backend->digitalWrite(_ledPin, HIGH);
+        if (!_state) ++_switchCount;
         _state = true;
         triggerUpdate();
     }
@@ -0,0 +1,278 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: RequestScheduler.h
+ * Description:
+ * Per-connection request framing, write-first weighted fair
+ * scheduling and dispatch delay statistics
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <Ethernet.h>
+#include <algorithm>
+
+/**
+ * @brief Largest Modbus/TCP ADU (MBAP header + 253 byte PDU).
+ */
+static constexpr size_t MODBUS_TCP_ADU_MAX = 260;
+
+/**
+ * @brief Scheduling weight of a client address.
+ */
+struct ClientWeight {
+    IPAddress address;  ///< Remote address of the client
+    uint8_t   weight;   ///< Relative share of the served requests (>= 1)
+};
+
+/**
+ * @brief Dispatch delay statistics of one client slot.
+ *
+ * Sockets are read once per scan, so the delay runs from the scan that
+ * read a request to its dispatch: it shows how long a request waits behind
+ * others of the same scan (and behind the per-scan cap), not the time it
+ * spent in the socket before that scan.
+ */
+struct DispatchStats {
+    uint32_t served = 0;    ///< Requests dispatched
+    uint32_t writes = 0;    ///< Of which write function codes
+    uint32_t lastUs = 0;    ///< Delay of the last request
+    uint32_t maxUs = 0;     ///< Longest delay
+    uint64_t totalUs = 0;   ///< Sum of all delays
+
+    /**
+     * @brief Record the delay between reading and dispatch of one request
+     */
+    void record(uint32_t us, bool write) {
+        ++served;
+        if (write) ++writes;
+        lastUs = us;
+        totalUs += us;
+        if (us > maxUs) maxUs = us;
+    }
+};
+
+/**
+ * @class RequestSlot
+ * @brief Client wrapper holding the next complete request of one connection.
+ *
+ * fill() reads at most one MBAP frame from the connection, so the function
+ * code is known before the request is served. ModbusTCPServer then reads
+ * the buffered frame through this wrapper; responses go straight to the
+ * connection. Further pipelined frames stay in the socket until the
+ * current one is released.
+ */
+class RequestSlot : public Client {
+private:
+    Client*       _conn = nullptr;           ///< Bound connection
+    uint8_t       _frame[MODBUS_TCP_ADU_MAX]; ///< Frame being received or served
+    size_t        _len = 0;                  ///< Bytes of _frame received
+    size_t        _end = 0;                  ///< Frame length once the header is known
+    size_t        _readPos = 0;              ///< Bytes handed to the server
+    unsigned long _readUs = 0;               ///< Scan time the first frame byte was read
+    uint8_t       _weight = 1;               ///< Scheduling weight
+    int32_t       _credit = 0;               ///< Weighted round robin credit
+    DispatchStats _stats;                    ///< Dispatch delay statistics
+
+    template<size_t> friend class RequestScheduler;
+
+    void reset() {
+        _len = 0;
+        _end = 0;
+        _readPos = 0;
+    }
+
+    // Discard a frame with an impossible length and whatever follows it
+    void resync() {
+        uint8_t scratch[32];
+        while (_conn->available() > 0) {
+            if (_conn->read(scratch, sizeof(scratch)) <= 0) break;
+        }
+        reset();
+    }
+
+public:
+    /**
+     * @brief Bind a connection (or nullptr) and drop any buffered frame
+     */
+    void bind(Client* conn, uint8_t weight = 1) {
+        _conn = conn;
+        _weight = weight ? weight : 1;
+        _credit = 0;
+        reset();
+    }
+
+    Client* connection() const { return _conn; }
+    uint8_t weight() const { return _weight; }
+    const DispatchStats& stats() const { return _stats; }
+
+    /**
+     * @brief Receive available bytes of the next frame
+     * @param now Scan time in micros(), recorded as read time of a new frame
+     * @return true once a complete frame is buffered
+     */
+    bool fill(unsigned long now) {
+        if (!_conn) return false;
+        while (!ready()) {
+            int avail = _conn->available();
+            if (avail <= 0) break;
+            const size_t want = _end ? _end - _len : 6 - _len;
+            int n = _conn->read(&_frame[_len], std::min(want, static_cast<size_t>(avail)));
+            if (n <= 0) break;
+            if (_len == 0) _readUs = now;
+            _len += n;
+            if (!_end && _len == 6) {
+                const size_t pdu = (static_cast<size_t>(_frame[4]) << 8) | _frame[5];
+                if (pdu < 2 || 6 + pdu > sizeof(_frame)) {
+                    resync();
+                    break;
+                }
+                _end = 6 + pdu;
+            }
+        }
+        return ready();
+    }
+
+    /**
+     * @brief A complete frame is buffered
+     */
+    bool ready() const { return _end && _len == _end; }
+
+    /**
+     * @brief Function code of the buffered frame
+     */
+    uint8_t functionCode() const { return _frame[7]; }
+
+    /**
+     * @brief The buffered frame changes server data
+     */
+    bool isWrite() const {
+        switch (functionCode()) {
+            case 5: case 6: case 15: case 16: case 22: case 23: return true;
+            default: return false;
+        }
+    }
+
+    /**
+     * @brief Record the dispatch delay of the frame about to be served
+     */
+    void dispatch(unsigned long now) {
+        _stats.record(now - _readUs, isWrite());
+    }
+
+    /**
+     * @brief Drop the served frame so the next one can be received
+     */
+    void release() { reset(); }
+
+    int connect(IPAddress ip, uint16_t port) override { return _conn ? _conn->connect(ip, port) : 0; }
+    int connect(const char* host, uint16_t port) override { return _conn ? _conn->connect(host, port) : 0; }
+    size_t write(uint8_t b) override { return _conn ? _conn->write(b) : 0; }
+    size_t write(const uint8_t* buf, size_t size) override { return _conn ? _conn->write(buf, size) : 0; }
+    int available() override { return ready() ? static_cast<int>(_len - _readPos) : 0; }
+
+    int read() override {
+        return ready() && _readPos < _len ? _frame[_readPos++] : -1;
+    }
+
+    int read(uint8_t* buf, size_t size) override {
+        if (!ready()) return -1;
+        size_t n = std::min(size, _len - _readPos);
+        memcpy(buf, &_frame[_readPos], n);
+        _readPos += n;
+        return static_cast<int>(n);
+    }
+
+    int peek() override { return ready() && _readPos < _len ? _frame[_readPos] : -1; }
+    void flush() override { if (_conn) _conn->flush(); }
+    void stop() override { if (_conn) _conn->stop(); }
+    uint8_t connected() override { return _conn ? _conn->connected() : 0; }
+    operator bool() override { return _conn && static_cast<bool>(*_conn); }
+};
+
+
+/**
+ * @class RequestScheduler
+ * @brief Picks the next request to serve across N client slots.
+ *
+ * Pending writes (FC 5, 6, 15, 16, 22, 23) are served before pending reads,
+ * so a coil write is not queued behind a historian's block reads. The
+ * priority is strict: while a client keeps a write pending in every scan,
+ * no read is served at all. Within
+ * one class, slots take turns in smooth weighted round robin: each
+ * candidate gains its weight in credit, the richest is served and pays the
+ * sum of the candidates' weights.
+ */
+template<size_t N>
+class RequestScheduler {
+private:
+    RequestSlot _slots[N];       ///< One slot per connection
+    uint32_t    _deferred = 0;   ///< Scans ending with requests still pending
+
+public:
+    static constexpr size_t SLOTS = N;
+
+    RequestSlot& slot(size_t i) { return _slots[i]; }
+    const RequestSlot& slot(size_t i) const { return _slots[i]; }
+
+    /**
+     * @brief Receive on all slots and pick the next request
+     * @param now Current micros()
+     * @return Slot holding the request (already dispatched), nullptr if idle
+     */
+    RequestSlot* next(unsigned long now) {
+        bool writes = false;
+        for (RequestSlot& s : _slots) {
+            if (s.fill(now) && s.isWrite()) writes = true;
+        }
+
+        RequestSlot* best = nullptr;
+        int32_t total = 0;
+        for (RequestSlot& s : _slots) {
+            if (!s.ready() || s.isWrite() != writes) continue;
+            s._credit += s._weight;
+            total += s._weight;
+            if (!best || s._credit > best->_credit) best = &s;
+        }
+        if (!best) return nullptr;
+
+        best->_credit -= total;
+        best->dispatch(now);
+        return best;
+    }
+
+    /**
+     * @brief Count a scan that hit the request cap with requests pending
+     */
+    void endScan() {
+        for (const RequestSlot& s : _slots) {
+            if (s.ready()) { ++_deferred; return; }
+        }
+    }
+
+    uint32_t deferred() const { return _deferred; }
+};
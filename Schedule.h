@@ -0,0 +1,410 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: Schedule.h
+ * Description:
+ * Real-time clock and weekly switching programs with exception days.
+ * Evaluates only at the next switching instant; the clock and the
+ * program table are exposed as holding registers.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <Arduino.h>
+#include <time.h>
+#include <platform/mbed_rtc_time.h>
+#include <kvstore_global_api.h>
+#include "config.h"
+#include "IODevice.h"
+#include "Relay.h"
+#include "Variable.h"
+
+/**
+ * @class RtcClock
+ * @brief Controller RTC, settable via Modbus.
+ *
+ * @details
+ *   The clock maps to a holding register carrying the offset of local time
+ *   to UTC in minutes (signed, no automatic daylight saving). UTC seconds
+ *   since 1970 are members listed after it:
+ *
+ *     { &clock }, { &clock.timeHigh }, { &clock.timeLow }
+ *
+ *   Write both time registers in one FC16 request; the RTC is set when the
+ *   low word is applied. Every change of time or offset advances
+ *   generation(), which makes schedules re-evaluate.
+ */
+class RtcClock : public IODevice {
+private:
+    int16_t _offset;              ///< Local time - UTC (minutes)
+    uint16_t _high = 0;           ///< Written high word, applied with the low word
+    bool _highWritten = false;    ///< _high holds a client value
+    uint16_t _generation = 0;     ///< Number of time/offset changes
+
+public:
+    Variable<uint16_t> timeHigh { [this]() { return static_cast<uint16_t>(utc() >> 16); },
+                                  [this](uint16_t v) { _high = v; _highWritten = true; } };
+    Variable<uint16_t> timeLow  { [this]() { return static_cast<uint16_t>(utc()); },
+                                  [this](uint16_t v) { setLow(v); } };
+
+    /**
+     * @brief Construct the clock
+     * @param offsetMinutes Local time - UTC in minutes
+     */
+    explicit RtcClock(int16_t offsetMinutes = 0) : _offset(offsetMinutes) {
+        setType(ModbusType::HoldingRegister);
+    }
+
+    RtcClock(const RtcClock&) = delete;             // members capture this
+    RtcClock& operator=(const RtcClock&) = delete;
+
+    /**
+     * @brief UTC seconds since 1970
+     */
+    uint32_t utc() const { return static_cast<uint32_t>(time(nullptr)); }
+
+    /**
+     * @brief Local seconds since 1970
+     */
+    uint32_t local() const { return utc() + _offset * 60L; }
+
+    /**
+     * @brief Whether the RTC has been set (later than 2020-01-01)
+     */
+    bool valid() const { return utc() >= 1577836800UL; }
+
+    /**
+     * @brief Set the RTC to UTC seconds since 1970
+     */
+    void set(uint32_t seconds) {
+        set_time(static_cast<time_t>(seconds));
+        ++_generation;
+
+        #ifdef IDEBUG
+        Serial.print("RTC set: ");
+        Serial.println(seconds);
+        #endif
+    }
+
+    /**
+     * @brief Incremented on every change of time or offset
+     */
+    uint16_t generation() const { return _generation; }
+
+    // Offset register
+    uint16_t getHoldingValue() const override { return static_cast<uint16_t>(_offset); }
+    void setFromHolding(uint16_t value) override {
+        _offset = static_cast<int16_t>(value);
+        ++_generation;
+    }
+
+private:
+    void setLow(uint16_t low) {
+        uint16_t high = _highWritten ? _high : static_cast<uint16_t>(utc() >> 16);
+        _highWritten = false;
+        set((static_cast<uint32_t>(high) << 16) | low);
+    }
+};
+
+
+/**
+ * @class ScheduleRegister
+ * @brief One holding register of a WeeklySchedule table.
+ */
+class ScheduleRegister : public IODevice {
+private:
+    uint16_t* _value = nullptr;   ///< Table entry
+    bool* _dirty = nullptr;       ///< Set on client writes
+
+public:
+    ScheduleRegister() {
+        setType(ModbusType::HoldingRegister);
+    }
+
+    void bind(uint16_t* value, bool* dirty) {
+        _value = value;
+        _dirty = dirty;
+    }
+
+    uint16_t getHoldingValue() const override { return *_value; }
+    void setFromHolding(uint16_t value) override {
+        *_value = value;
+        *_dirty = true;
+    }
+};
+
+
+/**
+ * @class WeeklySchedule
+ * @brief Weekly switching program for a relay with exception days.
+ *
+ * @details
+ *   The schedule maps to a holding register enabling it (0/1), followed by
+ *   its table of MODBUS_SCHEDULE_EVENTS events and MODBUS_SCHEDULE_EXCEPTIONS
+ *   exception days (two registers each) and the minutes until the next
+ *   switching instant (read-only, 0xFFFF if none):
+ *
+ *     { &s }, { &s.table[0], &group } ... { &s.table[N - 1], &group },
+ *     { &group }, { &s.nextSwitch }
+ *
+ *   - event     : minute of day (0..1439, 0xFFFF unused),
+ *                 weekdays (bit 0 Monday .. bit 6 Sunday) | state (bit 15)
+ *   - exception : local day number (days since 1970-01-01, 0xFFFF unused),
+ *                 mode (0 off all day, 1 on all day, 2..8 program of
+ *                 Monday..Sunday)
+ *
+ *   Listing the table in a WriteGroup makes an upload apply atomically: the
+ *   members are applied in one cycle and the schedule re-evaluates in the
+ *   next. The state at any instant is the last event at or before it
+ *   (looking back up to a week); on forced days the regular program
+ *   continues afterwards. Instead of checking the table every scan, the
+ *   next instant at which the state can change is computed after each
+ *   switch, table change and clock change, and the scan only compares it
+ *   with the clock. The relay is switched at those instants, so a manual
+ *   coil write holds until the next one; it is left alone while its safe
+ *   action is active or while the clock is not set.
+ *
+ *   With a key, the table and the enable flag are written to the KV store
+ *   in the cycle a client change is applied (once per upload when the table
+ *   is in a WriteGroup) and restored in setup(), replacing the events set
+ *   with setEvent(); a schedule uploaded once survives a power cycle.
+ */
+class WeeklySchedule : public IODevice {
+public:
+    static constexpr size_t TABLE_SIZE = 2 * (MODBUS_SCHEDULE_EVENTS + MODBUS_SCHEDULE_EXCEPTIONS);
+
+private:
+    static constexpr uint16_t UNUSED = 0xFFFF;
+    static constexpr uint32_t DAY = 86400UL;
+    static constexpr int FORCED_NONE = -1;
+
+    /**
+     * @brief Record in the KV store
+     */
+    struct Persisted {
+        uint16_t table[TABLE_SIZE];
+        bool enabled;
+    };
+
+    RtcClock& _clock;
+    Relay* _relay;
+    const char* _key;                 ///< KV store key, nullptr = not persisted
+    uint16_t _table[TABLE_SIZE];      ///< Events, then exceptions
+    bool _dirty = true;               ///< Table changed, re-evaluate
+    bool _written = false;            ///< Client changed table or enable, persist
+    bool _enabled = true;
+    uint16_t _clockGeneration = 0;    ///< Clock generation at the last evaluation
+    uint32_t _next = 0;               ///< Next local instant to evaluate, 0 = none
+
+    const uint16_t* event(size_t i) const { return &_table[2 * i]; }
+    const uint16_t* exception(size_t i) const { return &_table[2 * (MODBUS_SCHEDULE_EVENTS + i)]; }
+
+    /**
+     * @brief Weekday of a day number, 0 = Monday (1970-01-01 was a Thursday)
+     */
+    static int weekday(uint32_t day) { return (day + 3) % 7; }
+
+    /**
+     * @brief Program in effect on a day
+     * @param forced Set to the forced state (0/1), or FORCED_NONE
+     * @return Weekday whose program applies
+     */
+    int program(uint32_t day, int& forced) const {
+        forced = FORCED_NONE;
+        for (size_t i = 0; i < MODBUS_SCHEDULE_EXCEPTIONS; ++i) {
+            const uint16_t* x = exception(i);
+            if (x[0] == UNUSED || x[0] != day) continue;
+            if (x[1] <= 1) forced = x[1];
+            else if (x[1] <= 8) return x[1] - 2;
+            break;
+        }
+        return weekday(day);
+    }
+
+    /**
+     * @brief Last event of a weekday program at or before a minute
+     * @return Event state (0/1), or -1 if there is none
+     */
+    int lastEvent(int wd, uint16_t minute) const {
+        int state = -1;
+        uint16_t best = 0;
+        for (size_t i = 0; i < MODBUS_SCHEDULE_EVENTS; ++i) {
+            const uint16_t* e = event(i);
+            if (e[0] == UNUSED || e[0] > minute || !(e[1] & (1u << wd))) continue;
+            if (state < 0 || e[0] >= best) {
+                best = e[0];
+                state = (e[1] & 0x8000) ? 1 : 0;
+            }
+        }
+        return state;
+    }
+
+    /**
+     * @brief Scheduled state at a local instant (off if no event in a week)
+     */
+    bool stateAt(uint32_t t) const {
+        uint32_t day = t / DAY;
+        for (uint32_t back = 0; back <= 7 && back <= day; ++back) {
+            int forced;
+            int wd = program(day - back, forced);
+            if (back == 0 && forced != FORCED_NONE) return forced;
+            int state = lastEvent(wd, back == 0 ? (t % DAY) / 60 : 1439);
+            if (state >= 0) return state;
+        }
+        return false;
+    }
+
+    /**
+     * @brief First instant after t at which the state can change, 0 if none
+     */
+    uint32_t nextInstant(uint32_t t) const {
+        uint32_t day = t / DAY;
+        int forcedBefore;
+        program(day - 1, forcedBefore);
+
+        for (uint32_t ahead = 0; ahead <= 8; ++ahead) {
+            uint32_t d = day + ahead;
+            int forced;
+            int wd = program(d, forced);
+            uint32_t best = 0;
+
+            // Entering or leaving a forced day
+            if ((forced != FORCED_NONE || forcedBefore != FORCED_NONE) && d * DAY > t) best = d * DAY;
+
+            if (forced == FORCED_NONE) {
+                for (size_t i = 0; i < MODBUS_SCHEDULE_EVENTS; ++i) {
+                    const uint16_t* e = event(i);
+                    if (e[0] == UNUSED || e[0] >= 1440 || !(e[1] & (1u << wd))) continue;
+                    uint32_t at = d * DAY + e[0] * 60UL;
+                    if (at > t && (!best || at < best)) best = at;
+                }
+            }
+            if (best) return best;
+            forcedBefore = forced;
+        }
+        return 0;
+    }
+
+    void persist() {
+        if (!_key) return;
+        Persisted p;
+        memcpy(p.table, _table, sizeof(_table));
+        p.enabled = _enabled;
+        kv_set(_key, &p, sizeof(p), 0);
+    }
+
+    void apply(bool state) {
+        if (!_relay || _relay->inSafeState() || state == _relay->getCoilValue()) return;
+        state ? _relay->on() : _relay->off();
+
+        #ifdef IDEBUG_RELAY
+        Serial.print("Schedule switched ");
+        Serial.println(state ? "on" : "off");
+        #endif
+    }
+
+public:
+    ScheduleRegister table[TABLE_SIZE];
+    Variable<uint16_t> nextSwitch { [this]() { return minutesToNext(); } };
+
+    /**
+     * @brief Construct an empty schedule
+     * @param clock Clock providing local time
+     * @param relay Switched relay
+     * @param key   KV store key (e.g. "/kv/sched1"), nullptr to not persist
+     */
+    WeeklySchedule(RtcClock& clock, Relay* relay, const char* key = nullptr)
+        : _clock(clock), _relay(relay), _key(key) {
+        setType(ModbusType::HoldingRegister);
+        for (size_t i = 0; i < TABLE_SIZE; ++i) {
+            _table[i] = (i % 2 == 0) ? UNUSED : 0;
+            table[i].bind(&_table[i], &_written);
+        }
+    }
+
+    WeeklySchedule(const WeeklySchedule&) = delete;             // members capture this
+    WeeklySchedule& operator=(const WeeklySchedule&) = delete;
+
+    /**
+     * @brief Set an event at startup
+     * @param index  Event slot
+     * @param minute Minute of day
+     * @param days   Weekday mask (bit 0 Monday .. bit 6 Sunday)
+     * @param state  Switched state
+     */
+    void setEvent(size_t index, uint16_t minute, uint8_t days, bool state) {
+        if (index >= MODBUS_SCHEDULE_EVENTS) return;
+        _table[2 * index] = minute;
+        _table[2 * index + 1] = (days & 0x7F) | (state ? 0x8000 : 0);
+        _dirty = true;
+    }
+
+    /**
+     * @brief Minutes until the next switching instant, 0xFFFF if none or not evaluated
+     */
+    uint16_t minutesToNext() const {
+        if (!_enabled || !_next || !_clock.valid()) return 0xFFFF;
+        uint32_t now = _clock.local();
+        uint32_t minutes = _next > now ? (_next - now + 59) / 60 : 0;
+        return minutes < 0xFFFF ? minutes : 0xFFFE;
+    }
+
+    void setup() override {
+        Persisted p;
+        size_t len = 0;
+        if (_key && kv_get(_key, &p, sizeof(p), &len) == 0 && len == sizeof(p)) {
+            memcpy(_table, p.table, sizeof(_table));
+            _enabled = p.enabled;
+            _dirty = true;
+        }
+    }
+
+    void update() override {
+        if (_written) {
+            _written = false;
+            _dirty = true;
+            persist();
+        }
+        if (!_enabled || !_clock.valid()) return;
+        uint32_t now = _clock.local();
+
+        if (_dirty || _clockGeneration != _clock.generation()) {
+            _dirty = false;
+            _clockGeneration = _clock.generation();
+        } else if (!_next || now < _next) {
+            return;
+        }
+        apply(stateAt(now));
+        _next = nextInstant(now);
+    }
+
+    // Enable register
+    uint16_t getHoldingValue() const override { return _enabled ? 1 : 0; }
+    void setFromHolding(uint16_t value) override {
+        if (value && !_enabled) _dirty = true;
+        _enabled = value != 0;
+        _written = true;
+    }
+};
@@ -0,0 +1,393 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: SecureModbus.h
+ * Description:
+ * Modbus/TCP Security listener (TLS, port 802) using mbedTLS with session tickets.
+ * Handshakes run in time-bounded slices so they do not stall the update cycle.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+#include <Ethernet.h>
+#include "mbedtls/ssl.h"
+#include "mbedtls/ssl_ticket.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/pk.h"
+
+#ifndef MODBUS_TLS_WRITE_TIMEOUT_US
+#error "config.h lacks MODBUS_TLS_WRITE_TIMEOUT_US (stalled writer limit, see config.example.h)"
+#endif
+
+/**
+ * @brief Cost counters of the TLS listener.
+ */
+struct TlsStats {
+    uint32_t handshakes = 0;       ///< Completed handshakes (full and resumed)
+    uint32_t resumed = 0;          ///< Handshakes resumed from a session ticket
+    uint32_t failed = 0;           ///< Handshakes aborted with an error
+    uint32_t writeStalls = 0;      ///< Clients dropped because a write stalled
+    uint32_t handshakeUs = 0;      ///< Duration of the last completed handshake (sum of slices)
+    uint32_t handshakeUsMax = 0;   ///< Longest completed handshake
+    uint32_t sliceUsMax = 0;       ///< Longest single handshake slice (added cycle time)
+    uint32_t recordsIn = 0;        ///< Application records read
+    uint32_t recordsOut = 0;       ///< Application records written
+    uint32_t recordUsTotal = 0;    ///< Time spent on records read or written successfully
+};
+
+
+/**
+ * @class TlsClient
+ * @brief Arduino Client over a TLS session, so ModbusTCPServer can use it.
+ */
+class TlsClient : public Client {
+private:
+    EthernetClient      _tcp;                 ///< Underlying TCP connection
+    mbedtls_ssl_context _ssl;                 ///< TLS session
+    TlsStats*           _stats = nullptr;     ///< Shared cost counters
+    bool                _open = false;        ///< Session set up for _tcp
+    bool                _ready = false;       ///< Handshake completed
+    bool                _resumed = false;     ///< Peer presented a valid session ticket
+    uint32_t            _handshakeUs = 0;     ///< Accumulated handshake time
+    uint8_t             _rx[MODBUS_TLS_RX_BUFFER]; ///< Decrypted bytes not yet consumed
+    size_t              _rxPos = 0;           ///< Read position in _rx
+    size_t              _rxLen = 0;           ///< Valid bytes in _rx
+
+    static int bioSend(void* ctx, const unsigned char* buf, size_t len) {
+        EthernetClient* tcp = static_cast<EthernetClient*>(ctx);
+        if (!tcp->connected()) return MBEDTLS_ERR_SSL_INTERNAL_ERROR;
+        size_t n = tcp->write(buf, len);
+        return n ? static_cast<int>(n) : MBEDTLS_ERR_SSL_WANT_WRITE;
+    }
+
+    static int bioRecv(void* ctx, unsigned char* buf, size_t len) {
+        EthernetClient* tcp = static_cast<EthernetClient*>(ctx);
+        int avail = tcp->available();
+        if (avail <= 0) return tcp->connected() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_SSL_CONN_EOF;
+        if (static_cast<size_t>(avail) < len) len = avail;
+        return tcp->read(buf, len);
+    }
+
+    /**
+     * @brief Decrypt the next record into _rx if the buffer is empty
+     */
+    void fill() {
+        if (!_ready || _rxPos < _rxLen) return;
+        if (!_tcp.available() && !mbedtls_ssl_get_bytes_avail(&_ssl)) return;
+
+        unsigned long t0 = micros();
+        int ret = mbedtls_ssl_read(&_ssl, _rx, sizeof(_rx));
+
+        if (ret > 0) {
+            _stats->recordUsTotal += micros() - t0;
+            _rxPos = 0;
+            _rxLen = ret;
+            ++_stats->recordsIn;
+        } else if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            stop();
+        }
+    }
+
+public:
+    TlsClient() { mbedtls_ssl_init(&_ssl); }
+
+    /**
+     * @brief Prepare a freshly accepted connection for the handshake
+     * @return false if the session could not be set up
+     */
+    bool begin(const EthernetClient& tcp, const mbedtls_ssl_config* conf, TlsStats* stats) {
+        if (!_open) {
+            if (mbedtls_ssl_setup(&_ssl, conf) != 0) return false;
+        } else {
+            mbedtls_ssl_session_reset(&_ssl);
+        }
+        _open = true;
+        _tcp = tcp;
+        _stats = stats;
+        _ready = false;
+        _resumed = false;
+        _handshakeUs = 0;
+        _rxPos = _rxLen = 0;
+        mbedtls_ssl_set_bio(&_ssl, &_tcp, bioSend, bioRecv, nullptr);
+        return true;
+    }
+
+    /**
+     * @brief Advance the handshake for at most budgetUs microseconds
+     *
+     * A single handshake step (e.g. one signature) is not interruptible, so a
+     * slice can exceed the budget by one step; resumed sessions skip those steps.
+     */
+    void handshake(unsigned long budgetUs) {
+        if (_ready || !_tcp.connected()) return;
+
+        unsigned long start = micros();
+        int ret = 0;
+        while (_ssl.state != MBEDTLS_SSL_HANDSHAKE_OVER) {
+            ret = mbedtls_ssl_handshake_step(&_ssl);
+            if (ret != 0 || micros() - start >= budgetUs) break;
+        }
+
+        unsigned long slice = micros() - start;
+        _handshakeUs += slice;
+        if (slice > _stats->sliceUsMax) _stats->sliceUsMax = slice;
+
+        if (ret != 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            ++_stats->failed;
+            #ifdef IDEBUG
+            Serial.print("TLS handshake failed: -0x");
+            Serial.println(-ret, HEX);
+            #endif
+            stop();
+            return;
+        }
+
+        if (_ssl.state == MBEDTLS_SSL_HANDSHAKE_OVER) {
+            _ready = true;
+            ++_stats->handshakes;
+            if (_resumed) ++_stats->resumed;
+            _stats->handshakeUs = _handshakeUs;
+            if (_handshakeUs > _stats->handshakeUsMax) _stats->handshakeUsMax = _handshakeUs;
+        }
+    }
+
+    /**
+     * @brief Note that the pending handshake resumes a ticketed session
+     *
+     * Counted only when the handshake completes, so an aborted resumption
+     * does not show up as resumed.
+     */
+    void ticketAccepted() { _resumed = true; }
+
+    /**
+     * @brief True once the handshake completed and the connection is up
+     */
+    bool ready() { return _ready && _tcp.connected(); }
+
+    /**
+     * @brief Address of the connected peer
+     */
+    IPAddress remoteIP() { return _tcp.remoteIP(); }
+
+    // --- Client interface ---
+
+    int connect(IPAddress, uint16_t) override { return 0; }
+    int connect(const char*, uint16_t) override { return 0; }
+
+    size_t write(uint8_t b) override { return write(&b, 1); }
+
+    /**
+     * @brief Encrypt and send, retrying a full TCP buffer for at most MODBUS_TLS_WRITE_TIMEOUT_US
+     *
+     * A peer that stops reading is dropped instead of stalling the update
+     * cycle; the return value is the part that was actually written.
+     */
+    size_t write(const uint8_t* buf, size_t size) override {
+        if (!_ready) return 0;
+        size_t done = 0;
+        const unsigned long start = micros();
+        while (done < size) {
+            const unsigned long t0 = micros();
+            int ret = mbedtls_ssl_write(&_ssl, buf + done, size - done);
+            if (ret > 0) {
+                _stats->recordUsTotal += micros() - t0;
+                ++_stats->recordsOut;
+                done += ret;
+                continue;
+            }
+            if (ret != MBEDTLS_ERR_SSL_WANT_WRITE) { stop(); break; }
+            if (micros() - start >= MODBUS_TLS_WRITE_TIMEOUT_US) {
+                ++_stats->writeStalls;
+                stop();
+                break;
+            }
+        }
+        return done;
+    }
+
+    int available() override {
+        fill();
+        return static_cast<int>(_rxLen - _rxPos);
+    }
+
+    int read() override {
+        fill();
+        return (_rxPos < _rxLen) ? _rx[_rxPos++] : -1;
+    }
+
+    int read(uint8_t* buf, size_t size) override {
+        fill();
+        size_t n = _rxLen - _rxPos;
+        if (n > size) n = size;
+        memcpy(buf, &_rx[_rxPos], n);
+        _rxPos += n;
+        return static_cast<int>(n);
+    }
+
+    int peek() override {
+        fill();
+        return (_rxPos < _rxLen) ? _rx[_rxPos] : -1;
+    }
+
+    void flush() override {}
+
+    void stop() override {
+        if (_ready) mbedtls_ssl_close_notify(&_ssl);
+        _ready = false;
+        _rxPos = _rxLen = 0;
+        _tcp.stop();
+    }
+
+    uint8_t connected() override { return _tcp.connected(); }
+
+    operator bool() override { return static_cast<bool>(_tcp); }
+};
+
+
+/**
+ * @class SecureModbusListener
+ * @brief Accepts Modbus/TCP Security (TLS) connections on MODBUS_TLS_PORT.
+ *
+ * @details
+ *   Server credentials come from MODBUS_TLS_CERT_PEM / MODBUS_TLS_KEY_PEM.
+ *   If MODBUS_TLS_CA_PEM is defined, clients must present a certificate
+ *   issued by that CA (mutual authentication as required by the Modbus/TCP
+ *   Security specification). Session tickets let reconnecting clients skip
+ *   the public-key operations; TlsStats reports full vs. resumed handshakes.
+ */
+class SecureModbusListener {
+private:
+    EthernetServer             _listener{MODBUS_TLS_PORT}; ///< TLS port
+    TlsClient                  _client;       ///< Active secure client
+    TlsStats                   _stats;        ///< Cost counters
+    mbedtls_ssl_config         _conf;         ///< Server configuration
+    mbedtls_entropy_context    _entropy;      ///< Hardware entropy source
+    mbedtls_ctr_drbg_context   _drbg;         ///< Random generator
+    mbedtls_x509_crt           _cert;         ///< Server certificate chain
+    mbedtls_x509_crt           _ca;           ///< Trusted client CA
+    mbedtls_pk_context         _key;          ///< Server private key
+    mbedtls_ssl_ticket_context _ticket;       ///< Session ticket keys
+    bool                       _ok = false;   ///< Configuration succeeded
+
+    /**
+     * @brief Ticket parser counting successful resumptions
+     */
+    static int parseTicket(void* p, mbedtls_ssl_session* session, unsigned char* buf, size_t len) {
+        SecureModbusListener* self = static_cast<SecureModbusListener*>(p);
+        int ret = mbedtls_ssl_ticket_parse(&self->_ticket, session, buf, len);
+        if (ret == 0) self->_client.ticketAccepted();
+        return ret;
+    }
+
+    static int writeTicket(void* p, const mbedtls_ssl_session* session, unsigned char* start,
+                           const unsigned char* end, size_t* tlen, uint32_t* lifetime) {
+        SecureModbusListener* self = static_cast<SecureModbusListener*>(p);
+        return mbedtls_ssl_ticket_write(&self->_ticket, session, start, end, tlen, lifetime);
+    }
+
+    static int parsePem(mbedtls_x509_crt* crt, const char* pem) {
+        return mbedtls_x509_crt_parse(crt, reinterpret_cast<const unsigned char*>(pem), strlen(pem) + 1);
+    }
+
+public:
+    /**
+     * @brief Set up mbedTLS and start listening
+     * @return true on success
+     */
+    bool begin() {
+        mbedtls_ssl_config_init(&_conf);
+        mbedtls_entropy_init(&_entropy);
+        mbedtls_ctr_drbg_init(&_drbg);
+        mbedtls_x509_crt_init(&_cert);
+        mbedtls_x509_crt_init(&_ca);
+        mbedtls_pk_init(&_key);
+        mbedtls_ssl_ticket_init(&_ticket);
+
+        static const char personalization[] = HOSTNAME;
+        static const char keyPem[] = MODBUS_TLS_KEY_PEM;
+
+        _ok = mbedtls_ctr_drbg_seed(&_drbg, mbedtls_entropy_func, &_entropy,
+                                    reinterpret_cast<const unsigned char*>(personalization),
+                                    sizeof(personalization) - 1) == 0
+           && parsePem(&_cert, MODBUS_TLS_CERT_PEM) == 0
+           && mbedtls_pk_parse_key(&_key, reinterpret_cast<const unsigned char*>(keyPem),
+                                   sizeof(keyPem), nullptr, 0) == 0
+           && mbedtls_ssl_config_defaults(&_conf, MBEDTLS_SSL_IS_SERVER,
+                                          MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) == 0
+           && mbedtls_ssl_conf_own_cert(&_conf, &_cert, &_key) == 0
+           && mbedtls_ssl_ticket_setup(&_ticket, mbedtls_ctr_drbg_random, &_drbg,
+                                       MBEDTLS_CIPHER_AES_256_GCM, MODBUS_TLS_TICKET_LIFETIME) == 0;
+        if (!_ok) return false;
+
+        mbedtls_ssl_conf_rng(&_conf, mbedtls_ctr_drbg_random, &_drbg);
+        mbedtls_ssl_conf_session_tickets_cb(&_conf, writeTicket, parseTicket, this);
+
+        #ifdef MODBUS_TLS_CA_PEM
+        if (parsePem(&_ca, MODBUS_TLS_CA_PEM) != 0) { _ok = false; return false; }
+        mbedtls_ssl_conf_ca_chain(&_conf, &_ca, nullptr);
+        mbedtls_ssl_conf_authmode(&_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+        #else
+        mbedtls_ssl_conf_authmode(&_conf, MBEDTLS_SSL_VERIFY_NONE);
+        #endif
+
+        _listener.begin();
+        return true;
+    }
+
+    /**
+     * @brief Accept new connections and advance a pending handshake
+     */
+    void update() {
+        if (!_ok) return;
+
+        if (!_client.connected()) {
+            _client.stop();
+            EthernetClient tcp = _listener.accept();
+            if (tcp && !_client.begin(tcp, &_conf, &_stats)) tcp.stop();
+        }
+
+        _client.handshake(MODBUS_TLS_SLICE_US);
+    }
+
+    /**
+     * @brief Secure client ready for Modbus traffic, or nullptr
+     */
+    Client* ready() { return _client.ready() ? &_client : nullptr; }
+
+    /**
+     * @brief Address of the secure client
+     */
+    IPAddress remoteIP() { return _client.remoteIP(); }
+
+    /**
+     * @brief Handshake and record cost counters
+     */
+    const TlsStats& stats() const { return _stats; }
+};
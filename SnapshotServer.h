@@ -0,0 +1,284 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: SnapshotServer.h
+ * Description:
+ * Vendor-specific Modbus function code returning the whole process image
+ * (coils, discrete inputs, holding and input registers) in one response,
+ * optionally PackBits run-length encoded.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+
+#include "config.h"
+#include <ArduinoModbus.h>
+#include <Ethernet.h>
+
+/**
+ * @brief Function code of the snapshot request (user-defined range 65..72).
+ */
+static constexpr uint8_t SNAPSHOT_FUNCTION = 0x41;
+
+/**
+ * @brief Table selection bits of a snapshot request.
+ */
+enum SnapshotTable : uint8_t {
+    SNAPSHOT_COILS    = 1 << 0,
+    SNAPSHOT_DISCRETE = 1 << 1,
+    SNAPSHOT_HOLDING  = 1 << 2,
+    SNAPSHOT_INPUT    = 1 << 3,
+    SNAPSHOT_ALL      = 0x0F
+};
+
+/**
+ * @brief Flag bits of a snapshot request/response.
+ */
+static constexpr uint8_t SNAPSHOT_FLAG_RLE = 1 << 0;
+
+/**
+ * @class SnapshotServer
+ * @brief Serves the full process image in a single Modbus/TCP round trip.
+ *
+ * @details
+ *   ArduinoModbus rejects unknown function codes, and the response is larger
+ *   than the 253-byte Modbus PDU limit, so the snapshot function is served on
+ *   its own port (MODBUS_SNAPSHOT_PORT) using regular MBAP framing.
+ *
+ *   Request PDU:
+ *     0x41 | tables | flags | start (u16) | count (u16, 0xFFFF = all)
+ *
+ *   Response PDU:
+ *     0x41 | tables | flags | sequence (u32) | payload
+ *
+ *   The payload holds, for every selected table in the order coils, discrete
+ *   inputs, holding registers, input registers: the number of values (u16)
+ *   followed by the values (bits packed LSB first, registers big-endian).
+ *   If the client set SNAPSHOT_FLAG_RLE and compression makes the payload
+ *   smaller, the payload is PackBits encoded and the flag is echoed.
+ *   All multi-byte fields are big-endian. tools/snapshot_client.py is the
+ *   reference decoder.
+ */
+class SnapshotServer {
+private:
+    EthernetServer  _listener;                          ///< Snapshot TCP port
+    EthernetClient  _client;                            ///< Active snapshot client
+    ModbusTCPServer& _server;                           ///< Source of the process image
+    uint8_t  _rx[14];                                   ///< MBAP header + request PDU
+    size_t   _rxLen = 0;                                ///< Bytes received so far
+    uint8_t  _raw[MODBUS_SNAPSHOT_BUFFER];              ///< Uncompressed payload
+    uint8_t  _tx[MODBUS_SNAPSHOT_BUFFER];               ///< Response frame
+
+    size_t _coils = 0;       ///< Number of coils in the image
+    size_t _discrete = 0;    ///< Number of discrete inputs in the image
+    size_t _holding = 0;     ///< Number of holding registers in the image
+    size_t _input = 0;       ///< Number of input registers in the image
+
+    static void put16(uint8_t* p, uint16_t v) { p[0] = v >> 8; p[1] = v & 0xFF; }
+
+    /**
+     * @brief Append one table to the raw payload
+     * @return false if the payload buffer is too small
+     */
+    bool appendTable(size_t& pos, uint8_t table, size_t tableSize,
+                     uint16_t start, uint16_t count) {
+        size_t n = (start < tableSize) ? tableSize - start : 0;
+        if (count < n) n = count;
+
+        const bool bits = (table == SNAPSHOT_COILS || table == SNAPSHOT_DISCRETE);
+        const size_t bytes = bits ? (n + 7) / 8 : n * 2;
+        if (pos + 2 + bytes > sizeof(_raw)) return false;
+
+        put16(&_raw[pos], static_cast<uint16_t>(n));
+        pos += 2;
+
+        if (bits) {
+            memset(&_raw[pos], 0, bytes);
+            for (size_t i = 0; i < n; ++i) {
+                int v = (table == SNAPSHOT_COILS)
+                    ? _server.coilRead(MODBUS_COIL_OFFSET + start + i)
+                    : _server.discreteInputRead(MODBUS_DISCRETE_OFFSET + start + i);
+                if (v > 0) _raw[pos + i / 8] |= (1u << (i % 8));
+            }
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                long v = (table == SNAPSHOT_HOLDING)
+                    ? _server.holdingRegisterRead(MODBUS_HOLDING_OFFSET + start + i)
+                    : _server.inputRegisterRead(MODBUS_INPUT_OFFSET + start + i);
+                put16(&_raw[pos + i * 2], static_cast<uint16_t>(v));
+            }
+        }
+        pos += bytes;
+        return true;
+    }
+
+    /**
+     * @brief PackBits encode src into dst
+     * @return Encoded length, or 0 if it does not fit into dstSize
+     */
+    static size_t packBits(const uint8_t* src, size_t len, uint8_t* dst, size_t dstSize) {
+        size_t in = 0, out = 0;
+        while (in < len) {
+            // Length of the run starting at in
+            size_t run = 1;
+            while (in + run < len && run < 128 && src[in + run] == src[in]) ++run;
+
+            if (run >= 3) {
+                if (out + 2 > dstSize) return 0;
+                dst[out++] = static_cast<uint8_t>(257 - run);
+                dst[out++] = src[in];
+                in += run;
+                continue;
+            }
+
+            // Literal block up to the next run of three
+            size_t lit = 0;
+            while (in + lit < len && lit < 128) {
+                if (in + lit + 2 < len &&
+                    src[in + lit] == src[in + lit + 1] &&
+                    src[in + lit] == src[in + lit + 2]) break;
+                ++lit;
+            }
+            if (out + 1 + lit > dstSize) return 0;
+            dst[out++] = static_cast<uint8_t>(lit - 1);
+            memcpy(&dst[out], &src[in], lit);
+            out += lit;
+            in += lit;
+        }
+        return out;
+    }
+
+    /**
+     * @brief Send an exception response for the pending request
+     */
+    void sendException(uint8_t code) {
+        memcpy(_tx, _rx, 4);           // transaction + protocol id
+        put16(&_tx[4], 3);
+        _tx[6] = _rx[6];               // unit id
+        _tx[7] = SNAPSHOT_FUNCTION | 0x80;
+        _tx[8] = code;
+        _client.write(_tx, 9);
+    }
+
+    /**
+     * @brief Build and send the response for the request in _rx
+     */
+    void respond(uint32_t sequence) {
+        const uint8_t  tables = _rx[8] & SNAPSHOT_ALL;
+        const uint8_t  flags  = _rx[9];
+        const uint16_t start  = (static_cast<uint16_t>(_rx[10]) << 8) | _rx[11];
+        const uint16_t count  = (static_cast<uint16_t>(_rx[12]) << 8) | _rx[13];
+
+        size_t raw = 0;
+        bool ok = true;
+        if (tables & SNAPSHOT_COILS)    ok = ok && appendTable(raw, SNAPSHOT_COILS,    _coils,    start, count);
+        if (tables & SNAPSHOT_DISCRETE) ok = ok && appendTable(raw, SNAPSHOT_DISCRETE, _discrete, start, count);
+        if (tables & SNAPSHOT_HOLDING)  ok = ok && appendTable(raw, SNAPSHOT_HOLDING,  _holding,  start, count);
+        if (tables & SNAPSHOT_INPUT)    ok = ok && appendTable(raw, SNAPSHOT_INPUT,    _input,    start, count);
+        if (!ok) { sendException(0x04); return; }   // server device failure: image too large
+
+        const size_t header = 7 + 7;   // MBAP + fc/tables/flags/sequence
+        uint8_t outFlags = 0;
+        size_t payload = 0;
+
+        if (flags & SNAPSHOT_FLAG_RLE) {
+            payload = packBits(_raw, raw, &_tx[header], sizeof(_tx) - header);
+            if (payload && payload < raw) outFlags |= SNAPSHOT_FLAG_RLE;
+        }
+        if (!(outFlags & SNAPSHOT_FLAG_RLE)) {
+            if (header + raw > sizeof(_tx)) { sendException(0x04); return; }
+            memcpy(&_tx[header], _raw, raw);
+            payload = raw;
+        }
+
+        memcpy(_tx, _rx, 4);
+        put16(&_tx[4], static_cast<uint16_t>(1 + 7 + payload));
+        _tx[6]  = _rx[6];
+        _tx[7]  = SNAPSHOT_FUNCTION;
+        _tx[8]  = tables;
+        _tx[9]  = outFlags;
+        _tx[10] = sequence >> 24;
+        _tx[11] = sequence >> 16;
+        _tx[12] = sequence >> 8;
+        _tx[13] = sequence;
+        _client.write(_tx, header + payload);
+    }
+
+public:
+    /**
+     * @brief Constructor
+     * @param server Modbus server holding the process image
+     * @param port   TCP port of the snapshot service
+     */
+    SnapshotServer(ModbusTCPServer& server, uint16_t port = MODBUS_SNAPSHOT_PORT)
+        : _listener(port), _server(server) {}
+
+    /**
+     * @brief Start listening
+     */
+    void begin() { _listener.begin(); }
+
+    /**
+     * @brief Set the number of values per table exposed in the snapshot
+     */
+    void setTableSizes(size_t coils, size_t discrete, size_t holding, size_t input) {
+        _coils = coils;
+        _discrete = discrete;
+        _holding = holding;
+        _input = input;
+    }
+
+    /**
+     * @brief Accept clients and answer complete requests (non-blocking)
+     * @param sequence Current change sequence, echoed in the response
+     */
+    void update(uint32_t sequence) {
+        if (!_client || !_client.connected()) {
+            _client.stop();
+            _rxLen = 0;
+            EthernetClient newClient = _listener.accept();
+            if (!newClient) return;
+            _client = newClient;
+        }
+
+        while (_client.available() && _rxLen < sizeof(_rx)) {
+            _rx[_rxLen++] = static_cast<uint8_t>(_client.read());
+            if (_rxLen < 8) continue;
+
+            const size_t frameLen = 6 + ((static_cast<size_t>(_rx[4]) << 8) | _rx[5]);
+            if (_rx[7] != SNAPSHOT_FUNCTION || frameLen != sizeof(_rx)) {
+                // Not a snapshot request: answer illegal function and drop the connection
+                sendException(0x01);
+                _client.stop();
+                _rxLen = 0;
+                return;
+            }
+            if (_rxLen < sizeof(_rx)) continue;
+
+            respond(sequence);
+            _rxLen = 0;
+        }
+    }
+};
@@ -0,0 +1,166 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: TwoPointController.h
+ * Description:
+ * Two-point (hysteresis) controller device switching a relay from an
+ * analog process value, with minimum run/stop times and a manual
+ * override via holding registers.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <Arduino.h>
+#include "IODevice.h"
+#include "Relay.h"
+#include "Variable.h"
+
+/**
+ * @brief Override register of a TwoPointController
+ */
+enum class TwoPointOverride : uint16_t {
+    Automatic = 0,  ///< Switched by the thresholds
+    ForceOff  = 1,
+    ForceOn   = 2
+};
+
+
+/**
+ * @class TwoPointController
+ * @brief On/off control of a relay evaluated every scan.
+ *
+ * @details
+ *   The controller maps to a holding register carrying the override
+ *   (TwoPointOverride). The thresholds and minimum times are members listed
+ *   after it in the item list:
+ *
+ *     { &ctl }, { &ctl.onThreshold }, { &ctl.offThreshold },
+ *     { &ctl.minOnTime }, { &ctl.minOffTime }
+ *
+ *   Thresholds are in process value units. With onThreshold below
+ *   offThreshold the relay switches on below onThreshold and off above
+ *   offThreshold (heating); with onThreshold above offThreshold the
+ *   direction is reversed (cooling). Between the thresholds the state is
+ *   kept. Minimum times are in seconds and also delay overrides, so the
+ *   equipment is protected in every mode. An invalid process value keeps
+ *   the current state; the relay is left alone while its safe action is
+ *   active. Switch the relay only through this controller, not its coil.
+ */
+class TwoPointController : public IODevice {
+private:
+    IODevice* _pv;                    ///< Process value source
+    Relay* _relay;                    ///< Switched output
+    TwoPointOverride _override = TwoPointOverride::Automatic;
+    uint16_t _on;                     ///< Switch-on threshold
+    uint16_t _off;                    ///< Switch-off threshold
+    uint16_t _minOn;                  ///< Minimum run time (s)
+    uint16_t _minOff;                 ///< Minimum stop time (s)
+    bool _demand = false;             ///< State requested by thresholds/override
+    bool _lastState = false;          ///< Relay state at the last evaluation
+    unsigned long _lastSwitch = 0;    ///< millis() of the last relay transition
+
+    /**
+     * @brief Current process value, or INVALID_VALUE
+     */
+    uint16_t processValue() const {
+        return _pv->getType() == ModbusType::InputRegister ? _pv->getInputValue()
+                                                           : _pv->getHoldingValue();
+    }
+
+public:
+    Variable<uint16_t> onThreshold  { [this]() { return _on; },     [this](uint16_t v) { _on = v; } };
+    Variable<uint16_t> offThreshold { [this]() { return _off; },    [this](uint16_t v) { _off = v; } };
+    Variable<uint16_t> minOnTime    { [this]() { return _minOn; },  [this](uint16_t v) { _minOn = v; } };
+    Variable<uint16_t> minOffTime   { [this]() { return _minOff; }, [this](uint16_t v) { _minOff = v; } };
+
+    /**
+     * @brief Construct a two-point controller
+     * @param pv           Process value (AnalogInput or Variable)
+     * @param relay        Switched relay
+     * @param onThreshold  Switch-on threshold
+     * @param offThreshold Switch-off threshold
+     * @param minOn        Minimum run time in seconds
+     * @param minOff       Minimum stop time in seconds
+     */
+    TwoPointController(IODevice* pv, Relay* relay, uint16_t onThreshold, uint16_t offThreshold,
+                       uint16_t minOn = 0, uint16_t minOff = 0)
+        : _pv(pv), _relay(relay), _on(onThreshold), _off(offThreshold),
+          _minOn(minOn), _minOff(minOff) {
+        setType(ModbusType::HoldingRegister);
+    }
+
+    TwoPointController(const TwoPointController&) = delete;             // members capture this
+    TwoPointController& operator=(const TwoPointController&) = delete;
+
+    void setup() override {
+        _lastSwitch = millis();
+    }
+
+    void update() override {
+        unsigned long now = millis();
+        bool state = _relay->getCoilValue();
+        if (state != _lastState) {
+            _lastState = state;
+            _lastSwitch = now;
+        }
+
+        switch (_override) {
+            case TwoPointOverride::ForceOff: _demand = false; break;
+            case TwoPointOverride::ForceOn:  _demand = true;  break;
+            default: {
+                uint16_t pv = processValue();
+                if (pv == INVALID_VALUE) break;
+                bool heating = _on <= _off;
+                if (heating ? pv < _on : pv > _on) _demand = true;
+                else if (heating ? pv > _off : pv < _off) _demand = false;
+                break;
+            }
+        }
+
+        if (_demand == state || _relay->inSafeState()) return;
+        unsigned long minTime = (state ? _minOn : _minOff) * 1000UL;
+        if (now - _lastSwitch < minTime) return;
+
+        _demand ? _relay->on() : _relay->off();
+        _lastState = _demand;
+        _lastSwitch = now;
+
+        #ifdef IDEBUG_RELAY
+        Serial.print("TwoPointController switched ");
+        Serial.println(_demand ? "on" : "off");
+        #endif
+    }
+
+    // Override register
+    uint16_t getHoldingValue() const override { return static_cast<uint16_t>(_override); }
+    void setFromHolding(uint16_t value) override {
+        _override = value <= 2 ? static_cast<TwoPointOverride>(value) : TwoPointOverride::Automatic;
+    }
+
+    /**
+     * @brief State requested by the thresholds or the override
+     */
+    bool demand() const { return _demand; }
+};
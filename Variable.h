@@ -116,4 +116,37 @@ public:
         }
         #endif
     }
+};
+
+
+/**
+ * @brief Read-only value mapped to a Modbus Input Register.
+ *
+ * Counterpart of a Variable without setter for values a client must not
+ * write (measurements, statistics).
+ *
+ * @tparam T Type of the value
+ */
+template<typename T>
+class InputVariable : public IODevice {
+private:
+    std::function<T()> _getter;        /**< Function to read the current value */
+
+public:
+    /**
+     * @brief Constructor
+     * @param getter Function to read the current value
+     */
+    explicit InputVariable(std::function<T()> getter)
+        : _getter(getter) {
+        setType(ModbusType::InputRegister);
+    }
+
+    /**
+     * @brief Read the value for the Modbus Input Register
+     * @return The current value, cast to uint16_t. Returns INVALID_VALUE if getter is not set.
+     */
+    uint16_t getInputValue() const override {
+        return _getter ? static_cast<uint16_t>(_getter()) : INVALID_VALUE;
+    }
 };
\ No newline at end of file
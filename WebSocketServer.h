@@ -0,0 +1,387 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: WebSocketServer.h
+ * Description:
+ * WebSocket endpoint pushing item changes to browser HMIs as binary
+ * delta frames, with bounded, coalescing per-client queues.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+#include "ModbusItem.h"
+#include "ChangeTracker.h"
+#include <ArduinoModbus.h>
+#include <Ethernet.h>
+#include <mbedtls/md.h>
+#include <mbedtls/base64.h>
+
+/**
+ * @brief WebSocket push counters
+ */
+struct WebSocketStats {
+    uint32_t connections = 0;   ///< Completed handshakes
+    uint32_t frames = 0;        ///< Delta frames sent
+    uint32_t entries = 0;       ///< Item values sent
+    uint32_t coalesced = 0;     ///< Changes merged into a value not yet sent
+    uint32_t dropped = 0;       ///< Clients closed on a failed write or bad frame
+};
+
+
+/**
+ * @class WebSocketServer
+ * @brief Pushes item changes to subscribed WebSocket clients.
+ *
+ * @details
+ *   Any path on MODBUS_WS_PORT accepts the WebSocket upgrade. Clients send
+ *   binary commands (big-endian):
+ *
+ *     0x01 first (u16) count (u16)   subscribe items [first, first + count)
+ *     0x02 first (u16) count (u16)   unsubscribe
+ *
+ *   Subscribing sends the current values once. After that every item whose
+ *   change sequence moves is pushed in a binary frame:
+ *
+ *     0x01 | sequence (u32) | count (u16) | count * { item (u16), value (u16) }
+ *
+ *   Extended data is sent as a second entry with bit 15 of the item set.
+ *
+ *   Each client has a dirty bitmap instead of a queue: a change marks the
+ *   item, the value is read from the server tables when the frame is built,
+ *   so repeated changes coalesce (latest value wins) and memory per client
+ *   is fixed. At most one frame of MODBUS_WS_FRAME_ITEMS entries is written
+ *   per client and cycle; the rest stays marked for the next cycle. A client
+ *   whose socket refuses a frame is closed rather than stalling the scan.
+ */
+class WebSocketServer {
+private:
+    static constexpr size_t WORDS = (MODBUS_WS_MAX_ITEMS + 31) / 32;
+    static constexpr size_t RX_SIZE = 256;
+    static constexpr size_t FRAME_SIZE = 4 + 7 + 4 * MODBUS_WS_FRAME_ITEMS;
+
+    /**
+     * @brief State of one WebSocket connection
+     */
+    struct Connection {
+        EthernetClient client;              ///< TCP connection
+        bool           active = false;      ///< Slot in use
+        bool           open = false;        ///< Handshake completed
+        uint8_t        rx[RX_SIZE];         ///< Request headers, then client frames
+        size_t         len = 0;             ///< Bytes in rx
+        uint32_t       subscribed[WORDS];   ///< Subscribed items
+        uint32_t       dirty[WORDS];        ///< Items to send
+        size_t         cursor = 0;          ///< Round-robin start of the next frame
+    };
+
+    EthernetServer   _listener;                 ///< WebSocket port
+    ModbusTCPServer& _server;                   ///< Source of the values
+    ModbusItem*&     _items;                    ///< Mapped items
+    size_t&          _numItems;                 ///< Number of items
+    ChangeTracker&   _changes;                  ///< Change sequence
+    uint32_t         _seenSeq = 0;              ///< Sequence up to which changes are marked
+    Connection       _conn[MODBUS_WS_CLIENTS];  ///< Connection slots
+    uint8_t          _frame[FRAME_SIZE];        ///< Outgoing frame
+    WebSocketStats   _stats;                    ///< Counters
+
+    static bool test(const uint32_t* bits, size_t i) { return bits[i / 32] & (1UL << (i % 32)); }
+    static void set(uint32_t* bits, size_t i) { bits[i / 32] |= (1UL << (i % 32)); }
+    static void clear(uint32_t* bits, size_t i) { bits[i / 32] &= ~(1UL << (i % 32)); }
+
+    static void put16(uint8_t* p, uint16_t v) { p[0] = v >> 8; p[1] = v & 0xFF; }
+
+    /** @brief Items served, capped at MODBUS_WS_MAX_ITEMS */
+    size_t itemCount() const { return _numItems < MODBUS_WS_MAX_ITEMS ? _numItems : MODBUS_WS_MAX_ITEMS; }
+
+    void close(Connection& c) {
+        c.client.stop();
+        c.active = false;
+        c.open = false;
+        c.len = 0;
+    }
+
+    /**
+     * @brief Header value (case-insensitive name) copied into out, or false
+     */
+    static bool header(const char* request, const char* name, char* out, size_t size) {
+        size_t n = strlen(name);
+        for (const char* p = strstr(request, "\r\n"); p; p = strstr(p + 2, "\r\n")) {
+            if (strncasecmp(p + 2, name, n) != 0 || p[2 + n] != ':') continue;
+            const char* v = p + 3 + n;
+            while (*v == ' ') ++v;
+            size_t len = strcspn(v, "\r");
+            if (len >= size) return false;
+            memcpy(out, v, len);
+            out[len] = '\0';
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Answer the upgrade request (RFC 6455 section 4.2.2)
+     */
+    bool handshake(Connection& c) {
+        static const char GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+        static constexpr size_t KEY_LEN = 24;   // base64 of a 16 byte nonce
+        const char* request = reinterpret_cast<const char*>(c.rx);
+
+        char key[KEY_LEN + sizeof(GUID)];
+        if (strncmp(request, "GET ", 4) != 0 || !header(request, "Sec-WebSocket-Key", key, KEY_LEN + 1) ||
+            strlen(key) != KEY_LEN) {
+            static const char bad[] = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n";
+            c.client.write(reinterpret_cast<const uint8_t*>(bad), sizeof(bad) - 1);
+            return false;
+        }
+        memcpy(&key[KEY_LEN], GUID, sizeof(GUID));
+
+        unsigned char digest[20];
+        unsigned char accept[32];
+        size_t acceptLen = 0;
+        if (mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA1),
+                       reinterpret_cast<const unsigned char*>(key), KEY_LEN + sizeof(GUID) - 1, digest) != 0 ||
+            mbedtls_base64_encode(accept, sizeof(accept) - 1, &acceptLen, digest, sizeof(digest)) != 0) {
+            return false;
+        }
+        accept[acceptLen] = '\0';
+
+        char response[160];
+        int n = snprintf(response, sizeof(response),
+                         "HTTP/1.1 101 Switching Protocols\r\n"
+                         "Upgrade: websocket\r\n"
+                         "Connection: Upgrade\r\n"
+                         "Sec-WebSocket-Accept: %s\r\n\r\n",
+                         reinterpret_cast<const char*>(accept));
+        c.client.write(reinterpret_cast<const uint8_t*>(response), n);
+
+        memset(c.subscribed, 0, sizeof(c.subscribed));
+        memset(c.dirty, 0, sizeof(c.dirty));
+        c.cursor = 0;
+        c.len = 0;
+        c.open = true;
+        ++_stats.connections;
+        return true;
+    }
+
+    /**
+     * @brief Send a frame with the given opcode and payload
+     */
+    bool sendFrame(Connection& c, uint8_t opcode, const uint8_t* payload, size_t len) {
+        uint8_t head[4] = { static_cast<uint8_t>(0x80 | opcode) };
+        size_t headLen = 2;
+        if (len < 126) {
+            head[1] = len;
+        } else {
+            head[1] = 126;
+            put16(&head[2], len);
+            headLen = 4;
+        }
+        return c.client.write(head, headLen) == headLen &&
+               (len == 0 || c.client.write(payload, len) == len);
+    }
+
+    /**
+     * @brief Apply a subscribe/unsubscribe command
+     */
+    void command(Connection& c, const uint8_t* p, size_t len) {
+        if (len != 5 || (p[0] != 0x01 && p[0] != 0x02)) return;
+        size_t first = (p[1] << 8) | p[2];
+        size_t count = (p[3] << 8) | p[4];
+        for (size_t i = first; i < first + count && i < itemCount(); ++i) {
+            if (p[0] == 0x01) {
+                set(c.subscribed, i);
+                set(c.dirty, i);
+            } else {
+                clear(c.subscribed, i);
+                clear(c.dirty, i);
+            }
+        }
+    }
+
+    /**
+     * @brief Parse complete client frames in rx
+     * @return false if the connection must be closed
+     */
+    bool receiveFrames(Connection& c) {
+        while (c.len >= 2) {
+            const uint8_t opcode = c.rx[0] & 0x0F;
+            const bool masked = c.rx[1] & 0x80;
+            const size_t payloadLen = c.rx[1] & 0x7F;
+            if (!masked || payloadLen >= 126) return false;   // clients must mask; commands are short
+
+            const size_t frameLen = 2 + 4 + payloadLen;
+            if (c.len < frameLen) return true;
+
+            uint8_t* payload = &c.rx[6];
+            for (size_t i = 0; i < payloadLen; ++i) payload[i] ^= c.rx[2 + i % 4];
+
+            switch (opcode) {
+                case 0x2: command(c, payload, payloadLen); break;
+                case 0x8: sendFrame(c, 0x8, payload, payloadLen); return false;
+                case 0x9: if (!sendFrame(c, 0xA, payload, payloadLen)) return false; break;
+                default:  break;
+            }
+
+            memmove(c.rx, &c.rx[frameLen], c.len - frameLen);
+            c.len -= frameLen;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Read available bytes: handshake first, then client frames
+     * @return false if the connection must be closed
+     */
+    bool receive(Connection& c) {
+        while (c.client.available() && c.len < sizeof(c.rx) - 1) {
+            c.rx[c.len++] = static_cast<uint8_t>(c.client.read());
+            if (c.open) continue;
+            c.rx[c.len] = '\0';
+            if (c.len >= 4 && memcmp(&c.rx[c.len - 4], "\r\n\r\n", 4) == 0) {
+                if (!handshake(c)) return false;
+            }
+        }
+        if (!c.open) return c.len < sizeof(c.rx) - 1;
+        return receiveFrames(c);
+    }
+
+    /**
+     * @brief Mark items changed since the last cycle dirty for their subscribers
+     */
+    void markChanges(uint32_t seq) {
+        if (seq == _seenSeq) return;
+        for (size_t i = 0; i < itemCount(); ++i) {
+            if (_items[i].changeSequence() <= _seenSeq) continue;
+            for (auto& c : _conn) {
+                if (!c.open || !test(c.subscribed, i)) continue;
+                if (test(c.dirty, i)) ++_stats.coalesced;
+                set(c.dirty, i);
+            }
+        }
+        _seenSeq = seq;
+    }
+
+    /**
+     * @brief Send one frame with the client's dirty items, round-robin
+     * @return false if the socket refused the frame
+     */
+    bool push(Connection& c, uint32_t seq) {
+        uint8_t* p = _frame;
+        p[0] = 0x01;
+        p[1] = seq >> 24; p[2] = seq >> 16; p[3] = seq >> 8; p[4] = seq;
+        size_t count = 0;
+        size_t len = 7;
+
+        for (size_t n = 0; n < itemCount() && count + 2 <= MODBUS_WS_FRAME_ITEMS; ++n) {
+            size_t i = (c.cursor + n) % itemCount();
+            if (!test(c.dirty, i)) continue;
+            clear(c.dirty, i);
+
+            const ModbusItem& item = _items[i];
+            put16(&p[len], i);
+            put16(&p[len + 2], item.imageValue(_server));
+            len += 4;
+            ++count;
+            if (item.hasExtendedData()) {
+                put16(&p[len], i | 0x8000);
+                put16(&p[len + 2], item.auxImageValue(_server));
+                len += 4;
+                ++count;
+            }
+            c.cursor = (i + 1) % itemCount();
+        }
+
+        if (count == 0) return true;
+        put16(&p[5], count);
+        ++_stats.frames;
+        _stats.entries += count;
+        return sendFrame(c, 0x2, p, len);
+    }
+
+public:
+    /**
+     * @brief Constructor
+     * @param server   Modbus server holding the process image
+     * @param items    Mapped items
+     * @param numItems Number of items
+     * @param changes  Change sequence shared by all items
+     * @param port     WebSocket port
+     */
+    WebSocketServer(ModbusTCPServer& server, ModbusItem*& items, size_t& numItems,
+                    ChangeTracker& changes, uint16_t port = MODBUS_WS_PORT)
+        : _listener(port), _server(server), _items(items),
+          _numItems(numItems), _changes(changes) {}
+
+    /**
+     * @brief Start listening
+     */
+    void begin() {
+        _listener.begin();
+        _seenSeq = _changes.sequence();
+    }
+
+    /**
+     * @brief Accept clients, read commands and push pending changes (non-blocking)
+     *
+     * Call after the items were updated in this cycle.
+     */
+    void update() {
+        EthernetClient incoming = _listener.accept();
+        if (incoming) {
+            Connection* slot = nullptr;
+            for (auto& c : _conn) if (!c.active) { slot = &c; break; }
+            if (slot) {
+                slot->client = incoming;
+                slot->active = true;
+                slot->open = false;
+                slot->len = 0;
+            } else {
+                incoming.stop();
+            }
+        }
+
+        const uint32_t seq = _changes.sequence();
+        markChanges(seq);
+
+        for (auto& c : _conn) {
+            if (!c.active) continue;
+            if (!c.client.connected() || !receive(c)) {
+                close(c);
+                continue;
+            }
+            if (c.open && !push(c, seq)) {
+                ++_stats.dropped;
+                close(c);
+            }
+        }
+    }
+
+    /**
+     * @brief Connection and push counters
+     */
+    const WebSocketStats& stats() const { return _stats; }
+};
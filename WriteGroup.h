@@ -0,0 +1,102 @@
+/*
+ * ==========================================================
+ * Project: Arduino Modbus Controller
+ * File: WriteGroup.h
+ * Description:
+ * Commit register for transactional Modbus writes.
+ * Member items stage their values in the server tables until the group is committed.
+ * Author: Lukas Zuberbühler
+ * License: MIT License
+ * ==========================================================
+ *
+ * Copyright (c) 2025 Lukas Zuberbühler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include "IODevice.h"
+
+/**
+ * @brief Commit register for a group of Modbus items that must be applied together.
+ *
+ * Items constructed with a WriteGroup do not apply client writes as they appear.
+ * Their values stay staged in the server tables until a client writes the group's
+ * commit register; all members are then applied in the same update cycle.
+ *
+ * Reading the commit register returns the generation counter, which is incremented
+ * on every commit. A client commits by writing any value different from the current
+ * generation (typically generation + 1) and can read back the register to confirm.
+ * Members and the commit register can be sent in a single FC16 request when they
+ * are mapped to consecutive holding registers.
+ *
+ * @code
+ * WriteGroup schedule;
+ * ModbusItem modbusList[] = {
+ *     { &scheduleStart, &schedule },
+ *     { &scheduleStop,  &schedule },
+ *     { &scheduleDuty,  &schedule },
+ *     { &schedule }                  // commit register / generation
+ * };
+ * @endcode
+ */
+class WriteGroup : public IODevice {
+private:
+    uint16_t _generation = 0;      /**< Number of commits applied so far */
+    bool     _pending = false;     /**< Commit requested, members not yet applied */
+
+public:
+    /**
+     * @brief Constructor
+     */
+    WriteGroup() {
+        setType(ModbusType::HoldingRegister);
+    }
+
+    /**
+     * @brief True while a commit was requested but not yet applied.
+     */
+    bool isCommitPending() const { return _pending; }
+
+    /**
+     * @brief Mark the pending commit as applied and advance the generation.
+     *
+     * Called by ModbusHandler after all members were applied.
+     */
+    void commit() {
+        if (!_pending) return;
+        _pending = false;
+        ++_generation;
+
+        #ifdef IDEBUG_VARIABLE
+        Serial.print("WriteGroup committed, generation ");
+        Serial.println(_generation);
+        #endif
+    }
+
+    /**
+     * @brief Read the generation counter for the Modbus Holding Register
+     */
+    uint16_t getHoldingValue() const override { return _generation; }
+
+    /**
+     * @brief Client write to the commit register requests a commit
+     */
+    void setFromHolding(uint16_t /*val*/) override { _pending = true; }
+};
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+# ==========================================================
+# Project: Arduino Modbus Controller
+# File: tools/device_config.py
+# Description:
+#   Converts device descriptions between JSON and the binary
+#   format loaded by DeviceConfig.h, and uploads them.
+# Author: Lukas Zuberbühler
+# License: MIT License
+# ==========================================================
+"""Encode, decode, check and upload device configurations.
+
+JSON format:
+    {"devices": [
+        {"type": "safe_relay", "backend": "expansion", "pin": 3,
+         "enter": "switch_off", "leave": "ignore", "poll_group": 1},
+        {"type": "register", "value": 600}
+    ]}
+
+Examples:
+    device_config.py encode devices.json devices.bin
+    device_config.py decode devices.bin
+    device_config.py upload 192.168.1.100 devices.json
+"""
+
+import argparse
+import http.client
+import json
+import struct
+import sys
+
+VERSION = 1
+TYPES = {"stable_relay": 1, "safe_relay": 2, "discrete_input": 3, "analog_input": 4, "register": 5}
+BACKENDS = {"local": 0, "expansion": 1}
+ACTIONS = {"ignore": 0, "switch_on": 1, "switch_off": 2, "restore": 3}
+
+
+def crc16(data):
+    """CRC-16/Modbus."""
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def encode(config):
+    """Return the binary description of a JSON configuration."""
+    records = b""
+    for dev in config["devices"]:
+        records += struct.pack(">BBBBBBBBH",
+                               TYPES[dev["type"]],
+                               BACKENDS[dev.get("backend", "local")],
+                               dev.get("pin", 0),
+                               dev.get("led", 0),
+                               ACTIONS[dev.get("enter", "ignore")],
+                               ACTIONS[dev.get("leave", "ignore")],
+                               dev.get("poll_group", 0),
+                               0,
+                               dev.get("value", 0))
+    body = struct.pack(">2sBBH", b"OD", VERSION, 0, len(config["devices"])) + records
+    return body + struct.pack("<H", crc16(body))
+
+
+def decode(data):
+    """Return the JSON configuration of a binary description (raises ValueError)."""
+    if len(data) < 8 or data[:2] != b"OD" or data[2] != VERSION:
+        raise ValueError("not a version %d device description" % VERSION)
+    count = struct.unpack_from(">H", data, 4)[0]
+    if len(data) != 6 + count * 10 + 2:
+        raise ValueError("length does not match %d records" % count)
+    if crc16(data[:-2]) != struct.unpack_from("<H", data, len(data) - 2)[0]:
+        raise ValueError("CRC mismatch")
+
+    names = {v: k for k, v in TYPES.items()}
+    backends = {v: k for k, v in BACKENDS.items()}
+    actions = {v: k for k, v in ACTIONS.items()}
+    devices = []
+    for r in range(count):
+        kind, backend, pin, led, enter, leave, group, _, value = struct.unpack_from(">BBBBBBBBH", data, 6 + r * 10)
+        if kind not in names or backend not in backends or enter not in actions or leave not in actions:
+            raise ValueError("record %d invalid" % r)
+        dev = {"type": names[kind]}
+        if names[kind] == "register":
+            dev["value"] = value
+        else:
+            dev.update(backend=backends[backend], pin=pin)
+            if names[kind].endswith("relay"):
+                dev.update(led=led, enter=actions[enter], leave=actions[leave])
+        if group:
+            dev["poll_group"] = group
+        devices.append(dev)
+    return {"devices": devices}
+
+
+def load(path):
+    """Read a JSON or binary file and return the binary description."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:2] == b"OD":
+        decode(data)
+        return data
+    return encode(json.loads(data))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+    enc = sub.add_parser("encode", help="JSON -> binary")
+    enc.add_argument("input")
+    enc.add_argument("output")
+    dec = sub.add_parser("decode", help="binary -> JSON (stdout)")
+    dec.add_argument("input")
+    up = sub.add_parser("upload", help="PUT /config (applied at the next boot)")
+    up.add_argument("host")
+    up.add_argument("input", help="JSON or binary description")
+    up.add_argument("--port", type=int, default=80)
+    up.add_argument("--token", default="change-this-token", help="MODBUS_HTTP_UPLOAD_TOKEN")
+    opts = parser.parse_args()
+
+    if opts.command == "encode":
+        with open(opts.output, "wb") as f:
+            f.write(load(opts.input))
+    elif opts.command == "decode":
+        json.dump(decode(load(opts.input)), sys.stdout, indent=2)
+        print()
+    else:
+        conn = http.client.HTTPConnection(opts.host, opts.port, timeout=10)
+        conn.request("PUT", "/config", body=load(opts.input),
+                     headers={"Content-Type": "application/octet-stream",
+                              "Authorization": "Bearer " + opts.token})
+        resp = conn.getresponse()
+        print(resp.status, resp.reason)
+        sys.exit(0 if resp.status == 204 else 1)
+
+
+if __name__ == "__main__":
+    main()
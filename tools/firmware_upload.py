@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+# ==========================================================
+# Project: Arduino Modbus Controller
+# File: tools/firmware_upload.py
+# Description:
+#   Uploads a firmware image to FirmwareUpdate.h (PUT /firmware),
+#   waits for verification and commands the reboot over Modbus.
+# Author: Lukas Zuberbühler
+# License: MIT License
+# ==========================================================
+"""Update the firmware of one or more controllers.
+
+The image is sent with its CRC-32 appended. The controller writes and
+verifies it in idle time; progress is read from /metrics. With
+--reboot-register the reboot is commanded by writing the reboot value to
+the update state register (holding register address, offset included).
+The shipped sketch then sets the bootloader's update flag and resets, and
+the bootloader installs the image. Applications without an activation
+hook (opta_firmware_activation 0) refuse it; the image then stays staged.
+
+Usage:
+    firmware_upload.py IMAGE HOST [HOST ...] [--port 80] [--token TOKEN]
+                       [--reboot-register 40016] [--modbus-port 502]
+"""
+
+import argparse
+import http.client
+import socket
+import struct
+import sys
+import time
+import zlib
+
+STATES = {0: "idle", 1: "receiving", 2: "writing", 3: "verifying",
+          4: "verified", 5: "failed", 6: "rebooting"}
+REBOOT = 0xB007
+
+
+def metric(text, name):
+    """Return the value of an unlabelled metric, or None."""
+    for line in text.splitlines():
+        if line.startswith(name + " "):
+            return float(line.split()[1])
+    return None
+
+
+def upload(host, port, image, token):
+    """PUT the image with its CRC-32; True on 202 Accepted."""
+    body = image + struct.pack("<I", zlib.crc32(image) & 0xFFFFFFFF)
+    conn = http.client.HTTPConnection(host, port, timeout=60)
+    conn.request("PUT", "/firmware", body=body,
+                 headers={"Content-Type": "application/octet-stream",
+                          "Authorization": "Bearer " + token})
+    resp = conn.getresponse()
+    print("%s: upload %d %s" % (host, resp.status, resp.reason))
+    return resp.status == 202
+
+
+def metrics(host, port):
+    """Return the /metrics text."""
+    conn = http.client.HTTPConnection(host, port, timeout=10)
+    conn.request("GET", "/metrics")
+    return conn.getresponse().read().decode()
+
+
+def wait_verified(host, port, timeout=300):
+    """Poll /metrics until the image is verified or failed."""
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        text = metrics(host, port)
+        state = int(metric(text, "opta_firmware_state") or 0)
+        if state in (4, 5):
+            print("%s: %s, %d B/s, slice max %d us, storage step max %d us" % (
+                host, STATES[state],
+                metric(text, "opta_firmware_bytes_per_second") or 0,
+                metric(text, "opta_firmware_service_max_microseconds") or 0,
+                metric(text, "opta_firmware_step_max_microseconds") or 0))
+            return state == 4
+        print("%s: %s %d%%" % (host, STATES.get(state, state),
+                               metric(text, "opta_firmware_progress_percent") or 0))
+        time.sleep(1)
+    return False
+
+
+def reboot(host, http_port, port, register):
+    """Write the reboot value with FC06 if the controller can activate the image."""
+    if not metric(metrics(host, http_port), "opta_firmware_activation"):
+        print("%s: image staged, reboot refused (no activation hook)" % host)
+        return False
+    pdu = struct.pack(">BHH", 0x06, register, REBOOT)
+    with socket.create_connection((host, port), timeout=5) as s:
+        s.sendall(struct.pack(">HHHB", 1, 0, len(pdu) + 1, 1) + pdu)
+        reply = s.recv(260)
+    ok = len(reply) >= 8 and reply[7] == 0x06
+    print("%s: reboot %s" % (host, "commanded" if ok else "rejected"))
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image")
+    parser.add_argument("hosts", nargs="+")
+    parser.add_argument("--port", type=int, default=80, help="HTTP port")
+    parser.add_argument("--token", default="change-this-token", help="MODBUS_HTTP_UPLOAD_TOKEN")
+    parser.add_argument("--reboot-register", type=int, help="update state register address")
+    parser.add_argument("--modbus-port", type=int, default=502)
+    opts = parser.parse_args()
+
+    with open(opts.image, "rb") as f:
+        image = f.read()
+
+    failed = 0
+    for host in opts.hosts:
+        if not upload(host, opts.port, image, opts.token) or not wait_verified(host, opts.port):
+            failed += 1
+            continue
+        if opts.reboot_register is not None and not reboot(host, opts.port, opts.modbus_port, opts.reboot_register):
+            failed += 1
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+# ==========================================================
+# Project: Arduino Modbus Controller
+# File: tools/generate_map.py
+# Description:
+#   Generates the device declarations, the constexpr register
+#   map, the client poll plan and the register map document
+#   from one JSON (or YAML) device description.
+# Author: Lukas Zuberbühler
+# License: MIT License
+# ==========================================================
+"""Generate register map artefacts from a device description.
+
+Examples:
+    generate_map.py devices.json --header ModbusMap.h --doc REGISTERS.md --plan plan.json
+    generate_map.py devices.yaml            (header on stdout, needs PyYAML)
+
+The header declares the devices, one constexpr address per item and
+modbusList built with ModbusItem::of<>(), so the sync routines and the
+addresses are fixed at compile time. Include it once in the sketch, after
+the backends and the objects referenced by "args".
+
+Description (see tools/devices.example.json):
+    {"options": {"addressing": "dense", "max_gap": 8},
+     "devices": [{"name": "valve1", "class": "SafeRelay",
+                  "args": ["expBackend", "D0", "0", "SWITCH_OFF", "IGNORE"],
+                  "poll_group": 1, "description": "Watering valve 1"}]}
+
+"declare": false skips the declaration of devices defined by hand (lambdas)
+and of member registers such as "alarms.sequence". "count": n expands an
+array member into n items name[0] ... name[n - 1].
+"type" (coil, discrete, holding, input) and "extended" override the mapping
+derived from the class; "access" overrides the access shown in the document.
+"""
+
+import argparse
+import json
+import re
+import sys
+
+# class -> (mapping type, extended-data holding register)
+CLASSES = {
+    "StableRelay": ("coil", False),
+    "SafeRelay": ("coil", True),
+    "DiscreteInput": ("discrete", False),
+    "AnalogInput": ("input", False),
+    "Variable": ("holding", False),
+    "Heartbeat": ("holding", False),
+    "SharedVariable": ("holding", False),
+    "StoredRegister": ("holding", False),
+    "WriteGroup": ("holding", False),
+    "InputVariable": ("input", False),
+    "AlarmTable": ("holding", False),
+    "AlarmRegister": ("input", False),
+    "FirmwareUpdate": ("holding", False),
+}
+
+TABLES = {
+    "coil": ("ModbusType::Coil", "MODBUS_COIL_OFFSET", 0, 1, 2000),
+    "discrete": ("ModbusType::DiscreteInput", "MODBUS_DISCRETE_OFFSET", 10000, 2, 2000),
+    "holding": ("ModbusType::HoldingRegister", "MODBUS_HOLDING_OFFSET", 40000, 3, 125),
+    "input": ("ModbusType::InputRegister", "MODBUS_INPUT_OFFSET", 30000, 4, 125),
+}
+WRITABLE = {"coil", "holding"}
+
+
+def load(path):
+    with open(path) as f:
+        text = f.read()
+    if path.endswith((".yaml", ".yml")):
+        import yaml  # optional dependency
+        return yaml.safe_load(text)
+    return json.loads(text)
+
+
+def mapping(dev):
+    base = dev["class"].split("<")[0].strip()
+    kind, ext = CLASSES.get(base, (None, False))
+    kind = dev.get("type", kind)
+    if kind not in TABLES:
+        raise SystemExit("%s: unknown mapping type, set \"type\"" % dev["name"])
+    return kind, dev.get("extended", ext)
+
+
+def expand(devices):
+    """Replace array entries ("count") by one device per element."""
+    out = []
+    for dev in devices:
+        if "count" not in dev:
+            out.append(dev)
+            continue
+        for n in range(dev["count"]):
+            elem = {k: v for k, v in dev.items() if k != "count"}
+            elem["name"] = "%s[%d]" % (dev["name"], n)
+            elem["declare"] = False
+            out.append(elem)
+    return out
+
+
+def plan_addresses(devices, addressing):
+    """Assign addresses exactly like ModbusHandler::planAddresses()."""
+    items = []
+    for index, dev in enumerate(devices):
+        kind, ext = mapping(dev)
+        items.append({"index": index, "dev": dev, "type": kind, "extended": ext,
+                      "group": dev.get("poll_group", 0), "address": index, "aux": index if ext else None})
+    if addressing == "index":
+        return items
+
+    next_free = {t: 0 for t in TABLES}
+    for group in sorted({i["group"] for i in items}):
+        for item in (i for i in items if i["group"] == group):
+            item["address"] = next_free[item["type"]]
+            next_free[item["type"]] += 1
+            if item["extended"]:
+                item["aux"] = next_free["holding"]
+                next_free["holding"] += 1
+    return items
+
+
+def used_addresses(items, table):
+    addrs = [i["address"] for i in items if i["type"] == table]
+    if table == "holding":
+        addrs += [i["aux"] for i in items if i["extended"]]
+    return sorted(addrs)
+
+
+def poll_plan(items, max_gap):
+    """Fewest read requests per table; gaps up to max_gap are read along."""
+    plan = []
+    for table, (_, _, offset, fc, limit) in TABLES.items():
+        addrs = used_addresses(items, table)
+        start = prev = None
+        for a in addrs + [None]:
+            if start is not None and (a is None or a - prev - 1 > max_gap or a - start + 1 > limit):
+                plan.append({"table": table, "function": fc, "address": offset + start, "count": prev - start + 1})
+                start = None
+            if a is not None:
+                start = a if start is None else start
+                prev = a
+    return plan
+
+
+def const_name(name):
+    name = re.sub(r"(?<=[a-z0-9])(?=[A-Z])", "_", name)
+    return "MB_" + re.sub(r"[^A-Za-z0-9]+", "_", name).strip("_").upper()
+
+
+def header(items, source):
+    out = ["// Generated by tools/generate_map.py from %s - do not edit." % source,
+           "#pragma once", "", '#include "ModbusItem.h"', ""]
+
+    decls = [i for i in items if i["dev"].get("declare", True)]
+    if decls:
+        out.append("// Devices")
+        for i in decls:
+            dev = i["dev"]
+            args = ", ".join(str(a) for a in dev.get("args", []))
+            out.append("%s %s%s;" % (dev["class"], dev["name"], "(%s)" % args if args else ""))
+        out.append("")
+
+    out.append("// Register map (Modbus addresses including table offsets)")
+    for i in items:
+        _, offset, _, _, _ = TABLES[i["type"]]
+        out.append("constexpr uint16_t %s = %s + %d;" % (const_name(i["dev"]["name"]), offset, i["address"]))
+        if i["extended"]:
+            out.append("constexpr uint16_t %s_EXT = MODBUS_HOLDING_OFFSET + %d;" % (const_name(i["dev"]["name"]), i["aux"]))
+    for table in TABLES:
+        addrs = used_addresses(items, table)
+        out.append("constexpr size_t MB_%s_COUNT = %d;" % (table.upper(), addrs[-1] + 1 if addrs else 0))
+    out.append("")
+
+    out.append("ModbusItem modbusList[] = {")
+    for i in items:
+        mtype = TABLES[i["type"]][0]
+        targs = mtype + (", true" if i["extended"] else "")
+        out.append("    ModbusItem::of<%s>(&%s, %d, %d, nullptr, %d),   // %s %d%s" % (
+            targs, i["dev"]["name"], i["address"], i["aux"] or 0, i["group"], i["type"], i["address"],
+            ", holding %d" % i["aux"] if i["extended"] else ""))
+    out.append("};")
+    return "\n".join(out) + "\n"
+
+
+def document(items, plan, source):
+    out = ["# Modbus register map", "", "Generated from `%s`." % source, "",
+           "| Item | Name | Table | Address | Access | Poll group | Description |",
+           "|---:|---|---|---:|---|---:|---|"]
+    for i in items:
+        _, _, offset, _, _ = TABLES[i["type"]]
+        access = i["dev"].get("access", "R/W" if i["type"] in WRITABLE else "R")
+        desc = i["dev"].get("description", "")
+        out.append("| %d | %s | %s | %d | %s | %d | %s |" % (
+            i["index"], i["dev"]["name"], i["type"], offset + i["address"], access, i["group"], desc))
+        if i["extended"]:
+            out.append("| %d | %s (extended) | holding | %d | R/W | %d | Extended data |" % (
+                i["index"], i["dev"]["name"], 40000 + i["aux"], i["group"]))
+    out += ["", "## Poll plan", "", "| Function | Table | Address | Count |", "|---:|---|---:|---:|"]
+    for p in plan:
+        out.append("| %d | %s | %d | %d |" % (p["function"], p["table"], p["address"], p["count"]))
+    return "\n".join(out) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("description", help="JSON or YAML device description")
+    parser.add_argument("--header", help="C++ header with declarations, register map and modbusList")
+    parser.add_argument("--doc", help="Markdown register map")
+    parser.add_argument("--plan", help="JSON poll plan")
+    opts = parser.parse_args()
+
+    desc = load(opts.description)
+    options = desc.get("options", {})
+    items = plan_addresses(expand(desc["devices"]), options.get("addressing", "dense"))
+    plan = poll_plan(items, options.get("max_gap", 8))
+    source = opts.description.split("/")[-1]
+
+    if opts.header:
+        with open(opts.header, "w") as f:
+            f.write(header(items, source))
+    if opts.doc:
+        with open(opts.doc, "w") as f:
+            f.write(document(items, plan, source))
+    if opts.plan:
+        with open(opts.plan, "w") as f:
+            json.dump(plan, f, indent=2)
+    if not (opts.header or opts.doc or opts.plan):
+        sys.stdout.write(header(items, source))
+
+
+if __name__ == "__main__":
+    main()
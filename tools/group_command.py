@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+# ==========================================================
+# Project: Arduino Modbus Controller
+# File: tools/group_command.py
+# Description:
+#   Sends authenticated multicast group commands received by
+#   GroupCommandListener.h on all controllers at once.
+# Author: Lukas Zuberbühler
+# License: MIT License
+# ==========================================================
+"""Send one group command datagram.
+
+The replay counter defaults to the time in tenths of a second since
+2024-01-01 UTC, but at least one above the last counter this tool sent
+for the sender id (kept in --state), so commands sent back to back are
+not dropped as replays.
+
+Examples:
+    group_command.py switch 1 off --targets 0x1 --key change-this-key --sender 2
+    group_command.py safe on
+    group_command.py set 4 600
+"""
+
+import argparse
+import hashlib
+import hmac
+import json
+import os
+import socket
+import struct
+import time
+
+COMMANDS = {"switch": 1, "safe": 2, "set": 3}
+EPOCH = 1704067200  # 2024-01-01 UTC, counter origin
+
+
+def build(command, group, value, counter, targets, key, sender=0):
+    """Return the 32-byte datagram."""
+    body = struct.pack(">2sBBIIBBH", b"OG", 1, COMMANDS[command], counter, targets, group, sender, value)
+    tag = hmac.new(key.encode(), body, hashlib.sha256).digest()[:16]
+    return body + tag
+
+
+def next_counter(path, sender):
+    """Time-based counter, strictly above the last one sent for this sender."""
+    try:
+        with open(path) as f:
+            state = json.load(f)
+    except (OSError, ValueError):
+        state = {}
+    last = state.get(str(sender), 0)
+    counter = max(last + 1, int((time.time() - EPOCH) * 10)) & 0xFFFFFFFF
+    state[str(sender)] = counter
+    with open(path, "w") as f:
+        json.dump(state, f)
+    return counter
+
+
+def parse_value(text):
+    states = {"on": 1, "off": 0}
+    return states[text.lower()] if text.lower() in states else int(text, 0)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("command", choices=COMMANDS)
+    parser.add_argument("args", nargs="+", help="switch GROUP on|off, safe on|off, set GROUP VALUE")
+    parser.add_argument("--targets", type=lambda t: int(t, 0), default=0xFFFFFFFF)
+    parser.add_argument("--key", default="change-this-key")
+    parser.add_argument("--address", default="239.255.80.2")
+    parser.add_argument("--port", type=int, default=5021)
+    parser.add_argument("--sender", type=int, default=0,
+                        help="sender id 0..255; every sender needs its own (replay counters are per id)")
+    parser.add_argument("--counter", type=int, default=None,
+                        help="replay counter (default: see above)")
+    parser.add_argument("--state", default=os.path.expanduser("~/.group_command.json"),
+                        help="file keeping the last counter per sender id")
+    parser.add_argument("--repeat", type=int, default=1, help="send the datagram N times (duplicates are dropped as replays)")
+    opts = parser.parse_args()
+
+    if opts.command == "safe":
+        group, value = 0, parse_value(opts.args[0])
+    else:
+        group, value = int(opts.args[0], 0), parse_value(opts.args[1])
+
+    counter = opts.counter if opts.counter is not None else next_counter(opts.state, opts.sender)
+    packet = build(opts.command, group, value, counter & 0xFFFFFFFF, opts.targets, opts.key, opts.sender)
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 2)
+    for _ in range(opts.repeat):
+        sock.sendto(packet, (opts.address, opts.port))
+
+
+if __name__ == "__main__":
+    main()
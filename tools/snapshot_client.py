@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+# ==========================================================
+# Project: Arduino Modbus Controller
+# File: tools/snapshot_client.py
+# Description:
+#   Reference client for the bulk snapshot function code (0x41)
+#   served by SnapshotServer.h. Requests the process image and
+#   decodes the (optionally PackBits encoded) response.
+# Author: Lukas Zuberbühler
+# License: MIT License
+# ==========================================================
+"""Read the whole process image of a controller in one round trip.
+
+Usage:
+    snapshot_client.py HOST [--port 5020] [--tables chdi] [--start N] [--count N] [--rle]
+"""
+
+import argparse
+import socket
+import struct
+
+FUNCTION = 0x41
+FLAG_RLE = 0x01
+TABLES = [("coils", 0x01, True), ("discrete", 0x02, True),
+          ("holding", 0x04, False), ("input", 0x08, False)]
+
+
+def unpack_bits(data):
+    """Decode a PackBits encoded byte string."""
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        n = data[i]
+        i += 1
+        if n < 128:
+            out += data[i:i + n + 1]
+            i += n + 1
+        elif n > 128:
+            out += bytes([data[i]]) * (257 - n)
+            i += 1
+    return bytes(out)
+
+
+def decode(pdu):
+    """Decode a snapshot response PDU into (sequence, {table: [values]})."""
+    if pdu[0] == FUNCTION | 0x80:
+        raise RuntimeError("exception code %d" % pdu[1])
+    if pdu[0] != FUNCTION:
+        raise RuntimeError("unexpected function code 0x%02x" % pdu[0])
+
+    tables, flags = pdu[1], pdu[2]
+    sequence = struct.unpack(">I", pdu[3:7])[0]
+    payload = pdu[7:]
+    if flags & FLAG_RLE:
+        payload = unpack_bits(payload)
+
+    image = {}
+    pos = 0
+    for name, bit, is_bits in TABLES:
+        if not tables & bit:
+            continue
+        count = struct.unpack(">H", payload[pos:pos + 2])[0]
+        pos += 2
+        if is_bits:
+            raw = payload[pos:pos + (count + 7) // 8]
+            image[name] = [(raw[i // 8] >> (i % 8)) & 1 for i in range(count)]
+            pos += (count + 7) // 8
+        else:
+            image[name] = list(struct.unpack(">%dH" % count, payload[pos:pos + 2 * count]))
+            pos += 2 * count
+    return sequence, image
+
+
+def recv_exact(sock, n):
+    buf = b""
+    while len(buf) < n:
+        chunk = sock.recv(n - len(buf))
+        if not chunk:
+            raise RuntimeError("connection closed")
+        buf += chunk
+    return buf
+
+
+def snapshot(host, port=5020, tables=0x0F, start=0, count=0xFFFF, rle=True, unit=0xFF, timeout=2.0):
+    """Request one snapshot and return (sequence, image)."""
+    pdu = struct.pack(">BBBHH", FUNCTION, tables, FLAG_RLE if rle else 0, start, count)
+    frame = struct.pack(">HHHB", 1, 0, len(pdu) + 1, unit) + pdu
+    with socket.create_connection((host, port), timeout=timeout) as sock:
+        sock.sendall(frame)
+        header = recv_exact(sock, 7)
+        length = struct.unpack(">H", header[4:6])[0]
+        return decode(recv_exact(sock, length - 1))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("host")
+    parser.add_argument("--port", type=int, default=5020)
+    parser.add_argument("--tables", default="chdi", help="c=coils d=discrete h=holding i=input")
+    parser.add_argument("--start", type=int, default=0)
+    parser.add_argument("--count", type=int, default=0xFFFF)
+    parser.add_argument("--rle", action="store_true", help="request PackBits encoding")
+    args = parser.parse_args()
+
+    mask = sum(bit for (name, bit, _), key in zip(TABLES, "cdhi") if key in args.tables)
+    sequence, image = snapshot(args.host, args.port, mask, args.start, args.count, args.rle)
+    print("sequence %d" % sequence)
+    for name, values in image.items():
+        print("%-8s %s" % (name, " ".join(str(v) for v in values)))
+
+
+if __name__ == "__main__":
+    main()